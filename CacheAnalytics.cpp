@@ -0,0 +1,168 @@
+#include "CacheAnalytics.h"
+#include <algorithm>
+
+// latest evictions kept in the log
+static const size_t evictionLogSize = 4096;
+
+// timeline samples kept, an hour of them at one a second
+static const size_t timelineSize = 3600;
+
+/*!
+ * Grow a per frame vector to cover a frame, doubling so a playing clip only grows it now and then
+ */
+static void growTo(std::vector<uint8_t>& frames, int frame) {
+  if((size_t)frame >= frames.size()) frames.resize(std::max<size_t>(frame + 1, frames.size() * 2));
+}
+
+CacheAnalytics::CacheAnalytics() {
+  _evictions.resize(evictionLogSize);
+  _timeline.resize(timelineSize);
+}
+
+/*!
+ * Count a hit on a frame
+ * @param distance : cache accesses since the frame was last used, at least 1
+ */
+void CacheAnalytics::reuse(uint64_t distance) {
+  int bucket = 63 - __builtin_clzll(std::max<uint64_t>(1, distance));
+  _reuse[std::min(bucket, reuseBuckets - 1)]++;
+}
+
+/*!
+ * Log a frame leaving RAM.  Full resolution frames are marked evicted, so decoding them again counts as
+ * a re-decode.
+ * @param level : level of the copy which left
+ * @param age : cache accesses since it was last used
+ * @param demoted : it left for a proxy
+ */
+void CacheAnalytics::evicted(int frame, int level, uint64_t age, bool demoted) {
+  EvictionRecord& rec = _evictions[_evictionCount++ % _evictions.size()];
+  rec.seconds = _clock.getSeconds();
+  rec.frame = frame;
+  rec.level = level;
+  rec.demoted = demoted;
+  rec.age = age;
+
+  if(level || frame < 0) return;
+  growTo(_history, frame);
+  growTo(_states, frame);
+  if(_history[frame] != FRAME_EVICTED) _evictedFrames++;
+  _history[frame] = FRAME_EVICTED;
+  if(_states[frame] == TIMELINE_EMPTY) _states[frame] = TIMELINE_EVICTED;
+}
+
+/*!
+ * Note a frame was decoded into the cache
+ * @return true if it had been evicted before, so this decode was caused by the eviction
+ */
+bool CacheAnalytics::decoded(int frame) {
+  if(frame < 0) return false;
+  growTo(_history, frame);
+  bool redecode = _history[frame] == FRAME_EVICTED;
+  if(redecode) _evictedFrames--;
+  _history[frame] = FRAME_DECODED;
+  return redecode;
+}
+
+/*!
+ * Note a copy of a frame the timeline should show went into the cache
+ * @param level : level of the copy
+ */
+void CacheAnalytics::cached(int frame, int level) {
+  if(frame < 0) return;
+  growTo(_states, frame);
+  _states[frame] = level ? TIMELINE_PROXY : TIMELINE_CACHED;
+}
+
+/*!
+ * Note the copy of a frame the timeline showed left the cache, or went stale
+ */
+void CacheAnalytics::uncached(int frame) {
+  if(frame < 0) return;
+  growTo(_states, frame);
+  bool evicted = (size_t)frame < _history.size() && _history[frame] == FRAME_EVICTED;
+  _states[frame] = evicted ? TIMELINE_EVICTED : TIMELINE_EMPTY;
+}
+
+/*!
+ * Add the counters to the timeline
+ */
+void CacheAnalytics::sample(CacheSample sample) {
+  sample.seconds = _clock.getSeconds();
+  _timeline[_sampleCount++ % _timeline.size()] = sample;
+}
+
+/*!
+ * Copy everything writeJson() writes from another analytics, leaving out the per frame vectors which
+ * grow with the clip.  Neither analytics' rings are reallocated.
+ */
+void CacheAnalytics::copyLogs(const CacheAnalytics &from) {
+  _clock = from._clock;
+  std::copy(from._reuse, from._reuse + reuseBuckets, _reuse);
+  _evictions = from._evictions;
+  _evictionCount = from._evictionCount;
+  _timeline = from._timeline;
+  _sampleCount = from._sampleCount;
+  _evictedFrames = from._evictedFrames;
+}
+
+/*!
+ * The logged evictions, oldest first
+ */
+std::vector<EvictionRecord> CacheAnalytics::getEvictions() const {
+  std::vector<EvictionRecord> evictions;
+  uint64_t first = _evictionCount > _evictions.size() ? _evictionCount - _evictions.size() : 0;
+  for(uint64_t i = first; i < _evictionCount; i++) {
+    evictions.push_back(_evictions[i % _evictions.size()]);
+  }
+  return evictions;
+}
+
+/*!
+ * The timeline's samples, oldest first
+ */
+std::vector<CacheSample> CacheAnalytics::getTimeline() const {
+  std::vector<CacheSample> timeline;
+  uint64_t first = _sampleCount > _timeline.size() ? _sampleCount - _timeline.size() : 0;
+  for(uint64_t i = first; i < _sampleCount; i++) {
+    timeline.push_back(_timeline[i % _timeline.size()]);
+  }
+  return timeline;
+}
+
+/*!
+ * Write everything as a JSON object
+ * @param totals : the cache's counters now
+ */
+void CacheAnalytics::writeJson(FILE *out, const CacheSample &totals) const {
+  fprintf(out, "{\"hits\": %lu, \"misses\": %lu, \"inserts\": %lu, \"evictions\": %lu, \"redecodes\": %lu,\n",
+          totals.hits, totals.misses, totals.inserts, totals.evictions, totals.redecodes);
+
+  // bucket i holds distances from 2^i up to 2^(i+1)
+  fprintf(out, "  \"reuse_distance_log2\": [");
+  for(int bucket = 0; bucket < reuseBuckets; bucket++) {
+    fprintf(out, "%s%lu", bucket ? ", " : "", _reuse[bucket]);
+  }
+  fprintf(out, "],\n");
+
+  fprintf(out, "  \"evicted_frames\": %zu, \"logged_evictions\": %lu,\n", _evictedFrames, _evictionCount);
+
+  fprintf(out, "  \"eviction_log\": [");
+  bool first = true;
+  for(auto& rec : getEvictions()) {
+    fprintf(out, "%s\n    {\"s\": %.3f, \"frame\": %d, \"level\": %d, \"demoted\": %s, \"age\": %lu}",
+            first ? "" : ",", rec.seconds, rec.frame, rec.level, rec.demoted ? "true" : "false", rec.age);
+    first = false;
+  }
+  fprintf(out, "],\n");
+
+  fprintf(out, "  \"timeline\": [");
+  first = true;
+  for(auto& sample : getTimeline()) {
+    fprintf(out, "%s\n    {\"s\": %.3f, \"hits\": %lu, \"misses\": %lu, \"inserts\": %lu, \"evictions\": %lu, \"redecodes\": %lu}",
+            first ? "" : ",", sample.seconds, sample.hits, sample.misses, sample.inserts, sample.evictions,
+            sample.redecodes);
+    first = false;
+  }
+  fprintf(out, "]}");
+}
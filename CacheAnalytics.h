@@ -0,0 +1,94 @@
+#ifndef VIDEOPLAYER_CACHEANALYTICS_H
+#define VIDEOPLAYER_CACHEANALYTICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+#include "Timer.h"
+
+// reuse distances are counted in power of two buckets, the last one takes everything beyond
+static const int reuseBuckets = 24;
+
+/*!
+ * A frame cleaned from RAM
+ */
+struct EvictionRecord {
+  double seconds; // since the cache was created
+  int frame;
+  int level;
+  bool demoted;   // replaced with a proxy rather than cleaned
+  uint64_t age;   // cache accesses since it was last used
+};
+
+/*!
+ * The cache's counters at a point in time, for the hit/miss timeline
+ */
+struct CacheSample {
+  double seconds = 0;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t inserts = 0;
+  uint64_t evictions = 0;
+  uint64_t redecodes = 0;
+};
+
+/*!
+ * What a frame was last seen doing, for drawing the cache timeline
+ */
+enum FrameHistory : uint8_t {
+  FRAME_UNSEEN = 0,
+  FRAME_EVICTED = 1,  // its full resolution copy was cleaned or scaled down, and it hasn't been decoded since
+  FRAME_DECODED = 2
+};
+
+/*!
+ * What the cache timeline shows for a frame, from VideoCache::getFrameStates()
+ */
+enum TimelineState : uint8_t {
+  TIMELINE_EMPTY = 0,
+  TIMELINE_EVICTED,
+  TIMELINE_PROXY,
+  TIMELINE_CACHED
+};
+
+/*!
+ * Where a VideoCache's frames went: a histogram of reuse distances, a log of the latest evictions, a
+ * timeline of counter samples, and what happened to each frame.  Sizing the cache budget for some
+ * footage is a matter of reading these.
+ *
+ * Belongs to a VideoCache and is protected by its lock.  The log and the timeline are rings allocated
+ * up front, and a hit only bumps a histogram bucket, so recording adds no locking or allocation to the
+ * hit path.  The frame history grows as frames are decoded, which is already the slow path.  What the
+ * timeline shows for each frame is kept up to date as frames come and go, so drawing it only copies it.
+ */
+class CacheAnalytics {
+public:
+  CacheAnalytics();
+  void reuse(uint64_t distance);
+  void evicted(int frame, int level, uint64_t age, bool demoted = false);
+  bool decoded(int frame);
+  void cached(int frame, int level);
+  void uncached(int frame);
+  void sample(CacheSample sample);
+  void copyLogs(const CacheAnalytics& from);
+
+  double getSeconds() { return _clock.getSeconds(); }
+  const std::vector<uint8_t>& getStates() { return _states; }
+  std::vector<EvictionRecord> getEvictions() const;
+  std::vector<CacheSample> getTimeline() const;
+  void writeJson(FILE* out, const CacheSample& totals) const;
+
+private:
+  Timer _clock;
+  uint64_t _reuse[reuseBuckets] = {};
+  std::vector<EvictionRecord> _evictions; // ring, the next record goes at _evictionCount % size
+  uint64_t _evictionCount = 0;
+  std::vector<CacheSample> _timeline;     // ring, like _evictions
+  uint64_t _sampleCount = 0;
+  std::vector<uint8_t> _history;          // FrameHistory of each frame
+  size_t _evictedFrames = 0;              // frames whose history is FRAME_EVICTED
+  std::vector<uint8_t> _states;           // TimelineState of each frame
+};
+
+#endif //VIDEOPLAYER_CACHEANALYTICS_H
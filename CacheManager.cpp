@@ -0,0 +1,103 @@
+#include "CacheManager.h"
+#include <algorithm>
+
+// frames every stream keeps whatever the others get, enough for its ring and the frame on screen
+static const uint64_t minShareFrames = 16;
+
+// how much each stream counts for before its decode cost is taken into account
+static const double focusedWeight = 4;
+static const double visibleWeight = 2;
+static const double hiddenWeight = 0.5;
+
+// decode cost can't move a stream's weight further than this either way
+static const double maxCostScale = 2;
+
+/*!
+ * Add a video's cache.  Call rebalance() once they're all added to give them their budgets.
+ * @param frameSize : size of one of its full resolution frames
+ * @return the stream's number
+ */
+int CacheManager::addStream(VideoCache &cache, uint64_t frameSize) {
+  Stream stream;
+  stream.cache = &cache;
+  stream.frameSize = frameSize;
+  stream.share.focused = _streams.empty();
+  _streams.push_back(stream);
+  return (int)_streams.size() - 1;
+}
+
+void CacheManager::setFocus(int stream) {
+  _focus = stream;
+  for(size_t i = 0; i < _streams.size(); i++) {
+    _streams[i].share.focused = (int)i == stream;
+  }
+}
+
+void CacheManager::setVisible(int stream, bool visible) {
+  _streams[stream].share.visible = visible;
+}
+
+void CacheManager::setDecodeMs(int stream, double decodeMs) {
+  _streams[stream].share.decodeMs = decodeMs;
+}
+
+/*!
+ * Work out each stream's budget and give it to the caches which have moved far enough.  Caches which
+ * shrink are cleaned before the others grow, so together they never go over the budget.
+ */
+void CacheManager::rebalance() {
+  if(_streams.empty()) return;
+
+  double totalCost = 0;
+  int costed = 0;
+  uint64_t minBytes = 0;
+  for(auto& stream : _streams) {
+    if(stream.share.decodeMs > 0) {
+      totalCost += stream.share.decodeMs;
+      costed++;
+    }
+    minBytes += minShareFrames * (stream.frameSize + sizeof(FrameRecord));
+  }
+  double meanCost = costed ? totalCost / costed : 0;
+
+  // if the budget can't even cover the minimums, share it out the same way they would have
+  double minScale = std::min(1., (double)_maxMemory / std::max<uint64_t>(1, minBytes));
+  uint64_t spare = _maxMemory - (uint64_t)(minBytes * minScale);
+
+  double totalWeight = 0;
+  for(auto& stream : _streams) {
+    StreamShare& share = stream.share;
+    share.weight = share.focused ? focusedWeight : share.visible ? visibleWeight : hiddenWeight;
+    if(share.decodeMs > 0 && meanCost > 0) {
+      share.weight *= std::max(1 / maxCostScale, std::min(share.decodeMs / meanCost, maxCostScale));
+    }
+    totalWeight += share.weight;
+  }
+
+  std::vector<uint64_t> budgets;
+  for(auto& stream : _streams) {
+    uint64_t minimum = (uint64_t)(minShareFrames * (stream.frameSize + sizeof(FrameRecord)) * minScale);
+    budgets.push_back(minimum + (uint64_t)(spare * stream.share.weight / totalWeight));
+  }
+
+  // small moves are left alone, unless the streams which didn't shrink enough would put us over
+  uint64_t total = 0;
+  std::vector<bool> moves;
+  for(size_t i = 0; i < _streams.size(); i++) {
+    uint64_t current = _streams[i].share.bytes;
+    uint64_t moved = budgets[i] > current ? budgets[i] - current : current - budgets[i];
+    moves.push_back(!current || moved > current / 16);
+    total += moves.back() ? budgets[i] : current;
+  }
+
+  for(int growing = 0; growing < 2; growing++) {
+    for(size_t i = 0; i < _streams.size(); i++) {
+      StreamShare& share = _streams[i].share;
+      bool shrinking = budgets[i] < share.bytes;
+      if(shrinking == (bool)growing || budgets[i] == share.bytes) continue;
+      if(!moves[i] && !(shrinking && total > _maxMemory)) continue;
+      share.bytes = budgets[i];
+      _streams[i].cache->setMaxBytes(budgets[i]);
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef VIDEOPLAYER_CACHEMANAGER_H
+#define VIDEOPLAYER_CACHEMANAGER_H
+
+#include <stdint.h>
+#include <vector>
+#include "VideoCache.h"
+
+/*!
+ * A stream's part of the shared budget, and what it was worked out from
+ */
+struct StreamShare {
+  uint64_t bytes = 0;    // budget its cache was last given
+  double weight = 0;     // its part of what's left once every stream has its minimum
+  double decodeMs = 0;   // average time to decode one of its frames, 0 until we know
+  bool visible = true;
+  bool focused = false;
+};
+
+
+/*!
+ * Splits one memory budget between the caches of several videos played together.
+ * Every stream is given enough for a few frames, and the rest is divided by weight: the focused stream
+ * counts for more than the other visible ones, and those for more than hidden ones.  Each weight is then
+ * scaled by how long the stream's frames take to decode compared to the others, since a miss on those
+ * costs more to fill again.
+ * A new budget is only given to a cache once it moves by more than a sixteenth, so caches aren't
+ * cleaned over small changes.  Only used from the render thread.
+ */
+class CacheManager {
+public:
+  explicit CacheManager(uint64_t maxMemory) : _maxMemory(maxMemory * 1024l * 1024l) { }
+  int addStream(VideoCache& cache, uint64_t frameSize);
+  void setFocus(int stream);
+  void setVisible(int stream, bool visible);
+  void setDecodeMs(int stream, double decodeMs);
+  void rebalance();
+  void setMaxBytes(uint64_t maxBytes) { _maxMemory = maxBytes; }
+  void setFrameSize(int stream, uint64_t frameSize) { _streams[stream].frameSize = frameSize; }
+
+  int getFocus() { return _focus; }
+  int getStreamCount() { return (int)_streams.size(); }
+  StreamShare getShare(int stream) { return _streams[stream].share; }
+  uint64_t getMaxBytes() { return _maxMemory; }
+
+private:
+  struct Stream {
+    VideoCache* cache;
+    uint64_t frameSize;
+    StreamShare share;
+  };
+
+  std::vector<Stream> _streams;
+  uint64_t _maxMemory; // in bytes, for all the streams
+  int _focus = 0;
+};
+
+#endif //VIDEOPLAYER_CACHEMANAGER_H
@@ -0,0 +1,141 @@
+#include "ClipGenerator.h"
+#include <stdio.h>
+#include <algorithm>
+#include "Timer.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+};
+
+/*!
+ * Draw frame i of the test pattern: diagonal bands scrolling across the picture, with a box moving
+ * over them, so every frame differs and motion search has something to find.
+ */
+static void drawFrame(AVFrame* frame, int i) {
+  for(int y = 0; y < frame->height; y++) {
+    uint8_t* row = frame->data[0] + y * frame->linesize[0];
+    for(int x = 0; x < frame->width; x++) {
+      row[x] = (uint8_t)(x + y * 2 + i * 4);
+    }
+  }
+
+  for(int y = 0; y < frame->height / 2; y++) {
+    uint8_t* u = frame->data[1] + y * frame->linesize[1];
+    uint8_t* v = frame->data[2] + y * frame->linesize[2];
+    for(int x = 0; x < frame->width / 2; x++) {
+      u[x] = (uint8_t)(128 + y + i * 2);
+      v[x] = (uint8_t)(64 + x - i * 3);
+    }
+  }
+
+  int size = frame->height / 4;
+  int left = (i * 8) % std::max(1, frame->width - size);
+  int top = (i * 3) % std::max(1, frame->height - size);
+  for(int y = top; y < top + size; y++) {
+    uint8_t* row = frame->data[0] + y * frame->linesize[0];
+    for(int x = left; x < left + size; x++) {
+      row[x] = 235;
+    }
+  }
+}
+
+/*!
+ * Encode a frame, or flush the encoder if frame is null, and write out any packet it gives back
+ * @return false on an error, or once a flush has nothing left
+ */
+static bool encodeFrame(AVCodecContext* codec, AVFrame* frame, AVFormatContext* out, AVStream* stream) {
+  AVPacket packet;
+  av_init_packet(&packet);
+  packet.data = nullptr;
+  packet.size = 0;
+
+  int gotPacket = 0;
+  if(avcodec_encode_video2(codec, &packet, frame, &gotPacket) < 0) {
+    printf("encode error\n");
+    return false;
+  }
+  if(!gotPacket) return frame != nullptr;
+
+  av_packet_rescale_ts(&packet, codec->time_base, stream->time_base);
+  packet.stream_index = stream->index;
+  return av_interleaved_write_frame(out, &packet) >= 0;
+}
+
+/*!
+ * Encode a test clip.  The container comes from the file name's extension.
+ * @return false if the codec or container isn't available, or writing fails
+ */
+bool generateClip(const std::string &fileName, const ClipSpec &spec) {
+  av_register_all();
+
+  AVCodec* encoder = avcodec_find_encoder_by_name(spec.codec.c_str());
+  if(!encoder) {
+    printf("no %s encoder\n", spec.codec.c_str());
+    return false;
+  }
+
+  AVFormatContext* out = nullptr;
+  if(avformat_alloc_output_context2(&out, nullptr, nullptr, fileName.c_str()) < 0 || !out) {
+    printf("can't write %s\n", fileName.c_str());
+    return false;
+  }
+
+  AVStream* stream = avformat_new_stream(out, nullptr);
+  AVCodecContext* codec = avcodec_alloc_context3(encoder);
+  codec->width = spec.width;
+  codec->height = spec.height;
+  codec->pix_fmt = AV_PIX_FMT_YUV420P;
+  codec->time_base = AVRational{1, spec.fps};
+  codec->framerate = AVRational{spec.fps, 1};
+  codec->gop_size = spec.gop;
+  codec->keyint_min = spec.gop;
+  codec->max_b_frames = spec.bFrames;
+  codec->bit_rate = (int64_t)spec.width * spec.height * spec.fps / 8;
+  if(out->oformat->flags & AVFMT_GLOBALHEADER) codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  if(spec.closedGop) codec->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+
+  bool ok = false;
+  AVFrame* frame = av_frame_alloc();
+  if(avcodec_open2(codec, encoder, nullptr) < 0) {
+    printf("failed to open %s encoder\n", spec.codec.c_str());
+  } else if(avio_open(&out->pb, fileName.c_str(), AVIO_FLAG_WRITE) < 0) {
+    printf("can't open %s\n", fileName.c_str());
+  } else {
+    avcodec_parameters_from_context(stream->codecpar, codec);
+    stream->time_base = codec->time_base;
+    ok = avformat_write_header(out, nullptr) >= 0;
+
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = spec.width;
+    frame->height = spec.height;
+    ok = ok && av_frame_get_buffer(frame, 32) >= 0;
+
+    Timer timer;
+    for(int i = 0; ok && i < spec.frames; i++) {
+      av_frame_make_writable(frame);
+      drawFrame(frame, i);
+      frame->pts = i;
+      ok = encodeFrame(codec, frame, out, stream);
+    }
+    while(ok && encodeFrame(codec, nullptr, out, stream)) { }
+
+    if(ok) av_write_trailer(out);
+    avio_closep(&out->pb);
+    if(ok) printf("generated %s: %dx%d, %d frames, gop %d, %d b-frames, %s in %.2f s\n", fileName.c_str(),
+           spec.width, spec.height, spec.frames, spec.gop, spec.bFrames, spec.codec.c_str(), timer.getSeconds());
+  }
+
+  av_frame_free(&frame);
+  avcodec_free_context(&codec);
+  avformat_free_context(out);
+  return ok;
+}
+
+/*!
+ * Read a WIDTHxHEIGHT size into a spec
+ */
+bool parseClipSize(const char *size, ClipSpec &spec) {
+  return sscanf(size, "%dx%d", &spec.width, &spec.height) == 2 && spec.width > 0 && spec.height > 0;
+}
@@ -0,0 +1,23 @@
+#ifndef VIDEOPLAYER_CLIPGENERATOR_H
+#define VIDEOPLAYER_CLIPGENERATOR_H
+
+#include <string>
+
+/*!
+ * Settings for a generated test clip
+ */
+struct ClipSpec {
+  int width = 1920;
+  int height = 1080;
+  int frames = 600;
+  int fps = 60;
+  int gop = 30;       // frames per GOP
+  int bFrames = 0;    // B-frames between references
+  bool closedGop = false; // B-frames never refer across a keyframe, otherwise it's up to the encoder
+  std::string codec = "mpeg4";
+};
+
+bool generateClip(const std::string& fileName, const ClipSpec& spec);
+bool parseClipSize(const char* size, ClipSpec& spec);
+
+#endif //VIDEOPLAYER_CLIPGENERATOR_H
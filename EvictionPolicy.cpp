@@ -0,0 +1,104 @@
+#include "EvictionPolicy.h"
+#include <stdlib.h>
+#include <math.h>
+
+// frames scored from each end of the frame order, and from the old end of the use list, per pick
+static const int candidatesPerSide = 8;
+
+// a frame behind the playhead counts as this many times further away than one ahead of it
+static const double behindWeight = 2;
+
+// added to every frame's decode time, so frames we don't know the cost of still go by distance
+static const double minRedecodeMs = 1;
+
+/*!
+ * Make a policy by the name the player's options use
+ * @return the policy, or null if there isn't one by that name
+ */
+EvictionPolicy* EvictionPolicy::create(const std::string &name) {
+  if(name == "lru") return new LruPolicy;
+  if(name == "cost") return new CostPolicy;
+  return nullptr;
+}
+
+/*!
+ * Tell the policy where the playhead is
+ * @param direction : 1 or -1 as it's moving, 0 if it isn't, which keeps the last direction
+ */
+void EvictionPolicy::setPlayhead(int frame, int direction) {
+  _playhead = frame;
+  if(direction) _direction = direction;
+}
+
+bool EvictionPolicy::canPick(const FrameRecord *rec, int keepRadius) {
+  if(rec->pins || rec->stale) return false;
+  return keepRadius < 0 || abs(rec->frame - _playhead) > keepRadius;
+}
+
+FrameRecord* LruPolicy::pick(int, FrameRecord *oldest, int keepRadius) {
+  for(FrameRecord* rec = oldest; rec; rec = rec->prev) {
+    if(canPick(rec, keepRadius)) return rec;
+  }
+  return nullptr;
+}
+
+void CostPolicy::added(FrameRecord *rec) {
+  _frames[rec->level][rec->frame] = rec;
+}
+
+void CostPolicy::removed(FrameRecord *rec) {
+  _frames[rec->level].erase(rec->frame);
+}
+
+/*!
+ * How much a frame is worth keeping: what decoding it again costs, over how far it is from the playhead.
+ * Decoding a frame deep in a GOP gets the frames before it back too, so the cost counts for less than
+ * the distance, by its square root.
+ */
+double CostPolicy::getWorth(const FrameRecord *rec) {
+  int offset = rec->frame - _playhead;
+  double distance = abs(offset);
+  if(offset * _direction < 0) distance *= behindWeight;
+  return sqrt(rec->redecodeMs + minRedecodeMs) / (1 + distance);
+}
+
+/*!
+ * Score the frames furthest from the playhead on either side, and the least recently used, and pick the
+ * one least worth keeping.  Only a few frames are looked at, pinned ones included, so if none of them may
+ * go this falls back to the least recently used frame which may.
+ */
+FrameRecord* CostPolicy::pick(int level, FrameRecord *oldest, int keepRadius) {
+  FrameRecord* best = nullptr;
+  double bestWorth = 0;
+  auto consider = [&](FrameRecord* rec) {
+    if(!canPick(rec, keepRadius)) return;
+    double worth = getWorth(rec);
+    if(!best || worth < bestWorth) {
+      best = rec;
+      bestWorth = worth;
+    }
+  };
+
+  // the frames which may go are the ones before the kept window and the ones after it
+  auto& frames = _frames[level];
+  auto keptFrom = keepRadius < 0 ? frames.end() : frames.lower_bound(_playhead - keepRadius);
+  auto keptTo = keepRadius < 0 ? frames.begin() : frames.upper_bound(_playhead + keepRadius);
+  int visited = 0;
+  for(auto it = frames.begin(); it != keptFrom && visited < candidatesPerSide; ++it, visited++) {
+    consider(it->second);
+  }
+  visited = 0;
+  auto rend = std::map<int, FrameRecord*>::reverse_iterator(keptTo);
+  for(auto it = frames.rbegin(); it != rend && visited < candidatesPerSide; ++it, visited++) {
+    consider(it->second);
+  }
+  visited = 0;
+  FrameRecord* rec = oldest;
+  for(; rec && visited < candidatesPerSide; rec = rec->prev, visited++) {
+    consider(rec);
+  }
+  for(; rec && !best; rec = rec->prev) {
+    consider(rec);
+  }
+  return best;
+}
@@ -0,0 +1,75 @@
+#ifndef VIDEOPLAYER_EVICTIONPOLICY_H
+#define VIDEOPLAYER_EVICTIONPOLICY_H
+
+#include <map>
+#include <string>
+#include "VideoCache.h"
+
+/*!
+ * Picks which frame a VideoCache cleans, or scales down to a proxy, when it's over budget.  Stale frames
+ * always go first and the smallest proxies before bigger copies, the policy only chooses within a level.
+ *
+ * The cache tells the policy about every record it adds and removes, and where the playhead is.  Stale
+ * records count as removed, since they are cleaned before the policy is asked.  All of it is called with
+ * the cache's lock held.
+ */
+class EvictionPolicy {
+public:
+  virtual ~EvictionPolicy() { }
+  static EvictionPolicy* create(const std::string& name);
+  virtual const char* getName() = 0;
+
+  virtual void added(FrameRecord*) { }
+  virtual void removed(FrameRecord*) { }
+  void setPlayhead(int frame, int direction);
+
+  /*!
+   * Pick a frame at a level.  Frames which are pinned or stale, or within keepRadius of the playhead,
+   * mustn't be picked.
+   * @param oldest : least recently used frame at the level, prev goes to more recently used ones
+   * @param keepRadius : -1 to allow frames at any distance
+   * @return the frame, or null if there isn't one which may go
+   */
+  virtual FrameRecord* pick(int level, FrameRecord* oldest, int keepRadius) = 0;
+
+protected:
+  bool canPick(const FrameRecord* rec, int keepRadius);
+
+  int _playhead = 0;
+  int _direction = 0; // direction the playhead last moved in, 0 until it has
+};
+
+/*!
+ * The least recently used frame.  Playback touches frames in order, so this ends up cleaning frames far
+ * behind the playhead first, but also the ones ahead of it when it turns around.
+ */
+class LruPolicy : public EvictionPolicy {
+public:
+  const char* getName() override { return "lru"; }
+  FrameRecord* pick(int level, FrameRecord* oldest, int keepRadius) override;
+};
+
+/*!
+ * The frame which is cheapest to get back for how soon it may be needed.  A frame's worth keeping goes
+ * up with the time it took to decode from its GOP's keyframe, which is what a miss on it costs, and down
+ * with its distance from the playhead.  Frames behind the playhead count as further away than those
+ * ahead, but are still kept over frames far ahead, since stepping back and reversing need them.
+ *
+ * The frames furthest from the playhead are at either end of the frame order, so each pick only looks at
+ * a few frames from each end, and a few of the least recently used.  Finding the ends is O(log n), and
+ * looking at them is constant unless none of them may go.
+ */
+class CostPolicy : public EvictionPolicy {
+public:
+  const char* getName() override { return "cost"; }
+  void added(FrameRecord* rec) override;
+  void removed(FrameRecord* rec) override;
+  FrameRecord* pick(int level, FrameRecord* oldest, int keepRadius) override;
+
+private:
+  double getWorth(const FrameRecord* rec);
+
+  std::map<int, FrameRecord*> _frames[cacheLevels]; // by frame number
+};
+
+#endif //VIDEOPLAYER_EVICTIONPOLICY_H
@@ -0,0 +1,185 @@
+#include "FileReader.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// buffer FFmpeg reads through, each fill is one readCallback()
+static const int avioBufferSize = 64 * 1024;
+
+// kept resident ahead of the read position while it moves forward
+static const int64_t readaheadWindow = 16 * 1024 * 1024;
+
+// read ahead this much at a time, so a newer range doesn't wait long for the current one
+static const int64_t readaheadChunk = 1024 * 1024;
+
+// ranges waiting to be read ahead, the oldest are dropped beyond this
+static const size_t maxRanges = 8;
+
+FileReader::~FileReader() {
+  close();
+}
+
+/*!
+ * Map the file and start the readahead thread
+ * @return false if the file can't be mapped, the caller should let FFmpeg open it instead
+ */
+bool FileReader::open(const std::string &fileName) {
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+
+  struct stat fileStat;
+  if(fstat(fd, &fileStat) || !S_ISREG(fileStat.st_mode) || !fileStat.st_size) {
+    ::close(fd);
+    return false;
+  }
+
+  void* map = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(map == MAP_FAILED) {
+    printf("failed to map %s, reading it with FFmpeg\n", fileName.c_str());
+    return false;
+  }
+  _map = (uint8_t*)map;
+  _size = fileStat.st_size;
+
+  uint8_t* buffer = (uint8_t*)av_malloc(avioBufferSize);
+  _avio = avio_alloc_context(buffer, avioBufferSize, 0, this, &FileReader::readCallback, nullptr,
+                             &FileReader::seekCallback);
+  if(!_avio) {
+    av_free(buffer);
+    close();
+    return false;
+  }
+
+  _running = true;
+  _thread = std::thread(&FileReader::readaheadLoop, this);
+  return true;
+}
+
+/*!
+ * Stop the readahead thread and unmap the file.  The demuxer using the context must be closed first.
+ */
+void FileReader::close() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _running = false;
+    _ranges.clear();
+  }
+  _cv.notify_all();
+  if(_thread.joinable()) _thread.join();
+
+  if(_avio) {
+    av_freep(&_avio->buffer);
+    av_freep(&_avio);
+  }
+  if(_map) munmap(_map, _size);
+  _map = nullptr;
+  _size = 0;
+}
+
+/*!
+ * Read part of the file ahead of the demuxer.  Can be called from any thread.
+ * @param offset : byte position in the file
+ * @param size : number of bytes
+ */
+void FileReader::prefetch(int64_t offset, int64_t size) {
+  int64_t start = std::max<int64_t>(0, offset);
+  int64_t end = std::min<int64_t>(offset + size, _size);
+  if(start >= end) return;
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(!_running) return;
+    _ranges.emplace_front(start, end);
+    if(_ranges.size() > maxRanges) _ranges.pop_back();
+  }
+  _cv.notify_one();
+}
+
+int FileReader::readCallback(void *opaque, uint8_t *buf, int size) {
+  FileReader* reader = (FileReader*)opaque;
+  if(reader->_pos >= (int64_t)reader->_size) return AVERROR_EOF;
+
+  int bytes = (int)std::min<int64_t>(size, reader->_size - reader->_pos);
+  memcpy(buf, reader->_map + reader->_pos, bytes);
+  reader->_pos += bytes;
+  reader->followRead();
+  return bytes;
+}
+
+int64_t FileReader::seekCallback(void *opaque, int64_t offset, int whence) {
+  FileReader* reader = (FileReader*)opaque;
+  if(whence & AVSEEK_SIZE) return reader->_size;
+
+  int64_t pos;
+  switch(whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = reader->_pos + offset;
+      break;
+    case SEEK_END:
+      pos = reader->_size + offset;
+      break;
+    default:
+      return -1;
+  }
+  if(pos < 0 || pos > (int64_t)reader->_size) return -1;
+  reader->_pos = pos;
+  return pos;
+}
+
+/*!
+ * Keep the readahead window ahead of the read position.  It's only moved once the position is halfway
+ * through it, or has jumped out of it.
+ */
+void FileReader::followRead() {
+  bool inWindow = _pos >= _followedFrom && _pos <= _followedTo;
+  if(inWindow && _pos + readaheadWindow / 2 <= _followedTo) return;
+
+  // only the part we haven't already asked for
+  int64_t from = inWindow ? _followedTo : _pos;
+  _followedFrom = _pos;
+  _followedTo = _pos + readaheadWindow;
+  prefetch(from, _followedTo - from);
+}
+
+/*!
+ * Main loop of the readahead thread.  Takes the newest range a chunk at a time, hinting the kernel to
+ * start reading the chunk and then touching each page so we wait for it here, not in the demuxer.
+ */
+void FileReader::readaheadLoop() {
+  TRACE_THREAD("readahead");
+  const int64_t pageSize = sysconf(_SC_PAGESIZE);
+  std::unique_lock<std::mutex> lock(_mutex);
+  while(true) {
+    _cv.wait(lock, [this] { return !_running || !_ranges.empty(); });
+    if(!_running) return;
+
+    // the rest of the range goes back on the front, where a newer one can still get ahead of it
+    auto range = _ranges.front();
+    _ranges.pop_front();
+    int64_t end = std::min(range.second, range.first + readaheadChunk);
+    if(end < range.second) _ranges.emplace_front(end, range.second);
+    lock.unlock();
+
+    {
+      TRACE_SCOPE(TRACE_READAHEAD);
+      int64_t start = range.first & ~(pageSize - 1);
+      madvise(_map + start, end - start, MADV_WILLNEED);
+      volatile uint8_t touched = 0;
+      for(int64_t offset = start; offset < end; offset += pageSize) {
+        touched = _map[offset];
+      }
+      (void)touched;
+    }
+    _readaheadBytes += end - range.first;
+    lock.lock();
+  }
+}
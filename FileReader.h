@@ -0,0 +1,69 @@
+#ifndef VIDEOPLAYER_FILEREADER_H
+#define VIDEOPLAYER_FILEREADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <libavformat/avformat.h>
+};
+
+/*!
+ * How a decoder's demuxer reads the file
+ */
+enum FileReadMode {
+  READ_FFMPEG, // FFmpeg's file protocol, small read() calls on the decoding thread
+  READ_MMAP    // a FileReader
+};
+
+/*!
+ * Custom AVIOContext which reads a memory mapped file, so the demuxer copies packets straight out of
+ * the page cache.  A readahead thread faults pages in before the demuxer gets to them: it keeps a
+ * window ahead of the read position as that moves forward, and jumps to ranges it's given with
+ * prefetch(), such as the GOP a seek is about to land in, or the previous GOP when playing backward.
+ * The newest prefetch is read first, and whatever it interrupted carries on afterward.
+ * Stalls on pages which aren't resident then happen on the readahead thread instead of the decoder's.
+ */
+class FileReader {
+public:
+  FileReader() = default;
+  ~FileReader();
+  bool open(const std::string& fileName);
+  void close();
+  void prefetch(int64_t offset, int64_t size);
+
+  AVIOContext* getContext() { return _avio; }
+  uint64_t getReadaheadBytes() { return _readaheadBytes; }
+
+private:
+  static int readCallback(void* opaque, uint8_t* buf, int size);
+  static int64_t seekCallback(void* opaque, int64_t offset, int whence);
+  void followRead();
+  void readaheadLoop();
+
+  uint8_t* _map = nullptr;
+  size_t _size = 0;
+  AVIOContext* _avio = nullptr;
+
+  // only used by the demuxer's thread
+  int64_t _pos = 0;
+  int64_t _followedFrom = 0; // window last asked for around the read position
+  int64_t _followedTo = 0;
+
+  // protected by _mutex
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::pair<int64_t, int64_t>> _ranges; // start, end of ranges to read ahead, newest first
+  bool _running = false;
+  std::thread _thread;
+
+  std::atomic<uint64_t> _readaheadBytes{0};
+};
+
+#endif //VIDEOPLAYER_FILEREADER_H
@@ -0,0 +1,281 @@
+#include "FrameAllocator.h"
+#include "VideoCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static const size_t hugePageSize = 2 << 20;
+
+// parts are cache line aligned
+static const uint64_t partAlign = 64;
+
+// size classes, counting the ones reserve() is given, so frames of many sizes don't fragment the slab
+static const size_t maxSizeClasses = 16;
+
+FrameAllocator::~FrameAllocator() {
+  for(auto* rec : _records) {
+    delete rec;
+  }
+  if(_map) munmap(_map, _mapSize);
+}
+
+/*!
+ * Map and fault in the slab.  Explicit huge pages are used if there are enough reserved, otherwise we
+ * ask for transparent huge pages.
+ * @param slotCount : number of full frames the slab holds
+ * @param levelSizes : size of a frame at each level, the first is the slot size and the rest start off
+ *                     the size classes
+ * @return false if the slab couldn't be mapped, in which case frames come from the heap
+ */
+bool FrameAllocator::reserve(int slotCount, const std::vector<uint64_t>& levelSizes) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if(_map || !slotCount || levelSizes.empty()) return false;
+
+  _slotSize = (levelSizes[0] + partAlign - 1) / partAlign * partAlign;
+  size_t bytes = (slotCount * _slotSize + hugePageSize - 1) / hugePageSize * hugePageSize;
+
+  SlabPages pages = SLAB_HUGETLB;
+  void* map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+  if(map != MAP_FAILED) {
+    _map = (uint8_t*)map;
+    _mapSize = bytes;
+    _slab = _map;
+  } else {
+    // one huge page extra, so we can align the start
+    _mapSize = bytes + hugePageSize;
+    map = mmap(nullptr, _mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED) {
+      printf("failed to map %.0f MB frame slab\n", bytes / (1024. * 1024.));
+      return false;
+    }
+    _map = (uint8_t*)map;
+    _slab = (uint8_t*)(((uintptr_t)_map + hugePageSize - 1) / hugePageSize * hugePageSize);
+    pages = madvise(_slab, bytes, MADV_HUGEPAGE) ? SLAB_SMALL_PAGES : SLAB_TRANSPARENT_HUGE;
+
+    // fault it all in now rather than on first use
+    memset(_slab, 0, bytes);
+  }
+
+  for(uint64_t size : levelSizes) {
+    uint64_t part = (size + partAlign - 1) / partAlign * partAlign;
+    _partSize.push_back(part);
+    _partCount.push_back((int)std::min<uint64_t>(64, _slotSize / part));
+  }
+  _slotClass.assign(slotCount, 0);
+  _slotFree.assign(slotCount, 0);
+  _partialPos.assign(slotCount, -1);
+  _partial.resize(levelSizes.size());
+  for(int slot = slotCount - 1; slot >= 0; slot--) {
+    _freeSlots.push_back(slot);
+  }
+
+  _stats.slots = slotCount;
+  _stats.slabBytes = bytes;
+  _stats.slotSize = _slotSize;
+  _stats.pages = pages;
+  printf("frame slab: %d frames (%.0f MB) on %s\n", slotCount, bytes / (1024. * 1024.), getPagesName(pages));
+  return true;
+}
+
+/*!
+ * Allocate a record and its data
+ * @param level : proxy level of the frame, for the record
+ */
+FrameRecord* FrameAllocator::alloc(int frame, uint64_t size, int level) {
+  FrameRecord* rec = nullptr;
+  uint8_t* data;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(!_records.empty()) {
+      rec = _records.back();
+      _records.pop_back();
+    }
+    data = takeSlot(size);
+    if(data) _stats.slabAllocs++;
+    else _stats.heapAllocs++;
+  }
+
+  if(!rec) rec = new FrameRecord;
+  if(!data) data = new uint8_t[size];
+  *rec = FrameRecord();
+  rec->data = data;
+  rec->frame = frame;
+  rec->size = size;
+  rec->level = level;
+  return rec;
+}
+
+/*!
+ * Give back a record and its data
+ */
+void FrameAllocator::free(FrameRecord *rec) {
+  uint8_t* heapData = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_slab && rec->data >= _slab && rec->data < _slab + _slotFree.size() * _slotSize) {
+      returnSlot(rec->data);
+    } else {
+      heapData = rec->data;
+    }
+    _records.push_back(rec);
+  }
+  delete[] heapData;
+}
+
+/*!
+ * Take a slot, or a part of one, for a frame.  Must hold the lock.
+ * @return the frame's data, or null if it doesn't fit or the slab is full
+ */
+uint8_t* FrameAllocator::takeSlot(uint64_t size) {
+  int sizeClass = _slab ? findClass(size) : -1;
+  if(sizeClass < 0) return nullptr;
+
+  if(sizeClass == 0) {
+    int slot = popFreeSlot();
+    if(slot < 0) return nullptr;
+    return _slab + slot * _slotSize;
+  }
+
+  if(_partial[sizeClass].empty()) {
+    int slot = popFreeSlot();
+    if(slot < 0) return nullptr;
+    _slotClass[slot] = sizeClass;
+    _slotFree[slot] = getFullMask(sizeClass);
+    addPartial(slot, sizeClass);
+  }
+
+  int slot = _partial[sizeClass].back();
+  int part = __builtin_ctzll(_slotFree[slot]);
+  _slotFree[slot] &= ~(1ull << part);
+  if(!_slotFree[slot]) removePartial(slot, sizeClass);
+  return _slab + slot * _slotSize + part * _partSize[sizeClass];
+}
+
+/*!
+ * Find the smallest size class a frame fits in.  If that would waste over half of each part, a class is
+ * added for the frame's size.  Must hold the lock.
+ * @return the class, or -1 if the frame is bigger than a slot, or so small that the most parts a slot can
+ *         be split into would leave over half of it unused
+ */
+int FrameAllocator::findClass(uint64_t size) {
+  if(size * 64 < _slotSize / 2) return -1;
+  int best = -1;
+  for(size_t sizeClass = 0; sizeClass < _partSize.size(); sizeClass++) {
+    if(_partSize[sizeClass] >= size && (best < 0 || _partSize[sizeClass] < _partSize[best])) best = (int)sizeClass;
+  }
+  if(best < 0) return -1;
+
+  uint64_t part = (size + partAlign - 1) / partAlign * partAlign;
+  if(_partSize[best] >= 2 * part && _slotSize / part >= 2 && _partSize.size() < maxSizeClasses) {
+    best = (int)_partSize.size();
+    _partSize.push_back(part);
+    _partCount.push_back((int)std::min<uint64_t>(64, _slotSize / part));
+    _partial.emplace_back();
+  }
+  return best;
+}
+
+/*!
+ * Give back a slot, or a part of one.  A split slot is whole again once all its parts are back.
+ * Must hold the lock.
+ */
+void FrameAllocator::returnSlot(uint8_t *data) {
+  uint64_t offset = data - _slab;
+  int slot = (int)(offset / _slotSize);
+  int sizeClass = _slotClass[slot];
+  if(sizeClass == 0) {
+    _freeSlots.push_back(slot);
+    return;
+  }
+
+  int part = (int)((offset - slot * _slotSize) / _partSize[sizeClass]);
+  if(!_slotFree[slot]) addPartial(slot, sizeClass);
+  _slotFree[slot] |= 1ull << part;
+  if(_slotFree[slot] == getFullMask(sizeClass)) {
+    removePartial(slot, sizeClass);
+    _slotClass[slot] = 0;
+    _freeSlots.push_back(slot);
+  }
+}
+
+/*!
+ * Take a whole free slot, a resident one if there are any.  Must hold the lock.
+ * @return the slot, or -1 if there are none
+ */
+int FrameAllocator::popFreeSlot() {
+  std::vector<int>& slots = _freeSlots.empty() ? _releasedSlots : _freeSlots;
+  if(slots.empty()) return -1;
+  int slot = slots.back();
+  slots.pop_back();
+  return slot;
+}
+
+/*!
+ * Give the pages of free slots back to the kernel, so a smaller budget shows up as less memory used.
+ * The slots are taken out of the free list while their pages are dropped, so the lock isn't held for
+ * the system calls.  Only pages wholly inside a slot are dropped, its neighbors may be in use.
+ * @param maxBytes : release at most about this much, to keep each call short
+ * @return bytes released
+ */
+uint64_t FrameAllocator::releaseFree(uint64_t maxBytes) {
+  std::vector<int> slots;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // explicit huge pages go back to their own pool, not to anyone short of memory
+    if(!_slab || _stats.pages == SLAB_HUGETLB) return 0;
+    while(!_freeSlots.empty() && slots.size() * _slotSize < maxBytes) {
+      slots.push_back(_freeSlots.back());
+      _freeSlots.pop_back();
+    }
+  }
+  if(slots.empty()) return 0;
+
+  const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+  uint64_t released = 0;
+  for(int slot : slots) {
+    uintptr_t start = ((uintptr_t)(_slab + slot * _slotSize) + pageSize - 1) / pageSize * pageSize;
+    uintptr_t end = (uintptr_t)(_slab + (slot + 1) * _slotSize) / pageSize * pageSize;
+    if(end > start && !madvise((void*)start, end - start, MADV_DONTNEED)) released += end - start;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _releasedSlots.insert(_releasedSlots.end(), slots.begin(), slots.end());
+  return released;
+}
+
+void FrameAllocator::addPartial(int slot, int sizeClass) {
+  _partialPos[slot] = (int)_partial[sizeClass].size();
+  _partial[sizeClass].push_back(slot);
+}
+
+void FrameAllocator::removePartial(int slot, int sizeClass) {
+  std::vector<int>& partial = _partial[sizeClass];
+  int pos = _partialPos[slot];
+  partial[pos] = partial.back();
+  _partialPos[partial[pos]] = pos;
+  partial.pop_back();
+  _partialPos[slot] = -1;
+}
+
+uint64_t FrameAllocator::getFullMask(int sizeClass) {
+  int count = _partCount[sizeClass];
+  return count == 64 ? ~0ull : (1ull << count) - 1;
+}
+
+FrameAllocatorStats FrameAllocator::getStats() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  FrameAllocatorStats stats = _stats;
+  stats.freeSlots = (int)(_freeSlots.size() + _releasedSlots.size());
+  stats.releasedSlots = (int)_releasedSlots.size();
+  return stats;
+}
+
+const char* FrameAllocator::getPagesName(SlabPages pages) {
+  switch(pages) {
+    case SLAB_HUGETLB: return "hugetlb pages";
+    case SLAB_TRANSPARENT_HUGE: return "transparent huge pages";
+    case SLAB_SMALL_PAGES: return "small pages";
+    default: return "heap";
+  }
+}
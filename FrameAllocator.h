@@ -0,0 +1,82 @@
+#ifndef VIDEOPLAYER_FRAMEALLOCATOR_H
+#define VIDEOPLAYER_FRAMEALLOCATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+struct FrameRecord;
+
+/*!
+ * Pages backing the slab, best first
+ */
+enum SlabPages {
+  SLAB_NONE,           // not reserved, everything comes from the heap
+  SLAB_SMALL_PAGES,
+  SLAB_TRANSPARENT_HUGE,
+  SLAB_HUGETLB
+};
+
+struct FrameAllocatorStats {
+  uint64_t slabAllocs = 0;
+  uint64_t heapAllocs = 0; // frames which didn't fit in the slab
+  int slots = 0;
+  int freeSlots = 0;
+  int releasedSlots = 0;   // free slots whose pages were given back, included in freeSlots
+  uint64_t slabBytes = 0;
+  uint64_t slotSize = 0;
+  SlabPages pages = SLAB_NONE;
+};
+
+/*!
+ * Allocates frame records and their data for the VideoCache.
+ * The data comes from a slab of fixed size slots which is mapped and faulted in once, on huge pages if
+ * we can get them, so caching frames doesn't touch the heap or take page faults.  A slot holds one full
+ * frame, or is split into equal parts for smaller frames of one size class.  The classes start as the
+ * proxy levels, and more are added for the sizes frames take after the output size changes.  If the slab
+ * is full, or wasn't reserved, frames go to the heap instead.  Records are reused rather than freed.
+ * When the budget is cut, releaseFree() gives the pages of free slots back to the kernel a few at a
+ * time.  Those slots are only used once the resident ones run out, and take page faults again then.
+ */
+class FrameAllocator {
+public:
+  FrameAllocator() = default;
+  ~FrameAllocator();
+  bool reserve(int slotCount, const std::vector<uint64_t>& levelSizes);
+  FrameRecord* alloc(int frame, uint64_t size, int level);
+  void free(FrameRecord* rec);
+  uint64_t releaseFree(uint64_t maxBytes);
+  FrameAllocatorStats getStats();
+  static const char* getPagesName(SlabPages pages);
+
+private:
+  uint8_t* takeSlot(uint64_t size);
+  int findClass(uint64_t size);
+  int popFreeSlot();
+  void returnSlot(uint8_t* data);
+  void addPartial(int slot, int sizeClass);
+  void removePartial(int slot, int sizeClass);
+  uint64_t getFullMask(int sizeClass);
+
+  std::mutex _mutex;
+  uint8_t* _map = nullptr;
+  size_t _mapSize = 0;
+  uint8_t* _slab = nullptr;  // _map aligned for huge pages
+  uint64_t _slotSize = 0;
+  std::vector<int> _freeSlots;
+  std::vector<int> _releasedSlots;        // free slots whose pages were given back
+
+  // slots split for smaller frames
+  std::vector<uint64_t> _partSize;        // size of each part in each size class, the whole slot for class 0
+  std::vector<int> _partCount;
+  std::vector<int> _slotClass;            // size class each slot is split for, 0 if it's whole
+  std::vector<uint64_t> _slotFree;        // free parts of each split slot, a bit each
+  std::vector<std::vector<int>> _partial; // split slots with free parts, for each size class
+  std::vector<int> _partialPos;           // position of each split slot in its _partial list
+
+  std::vector<FrameRecord*> _records;     // spare records
+  FrameAllocatorStats _stats;
+};
+
+#endif //VIDEOPLAYER_FRAMEALLOCATOR_H
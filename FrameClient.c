@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include "FrameClient.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+struct FrameClient {
+  FrameShmHeader* header;
+  uint8_t* map;
+  size_t mapBytes;
+  int id;                 /* entry in header->consumers, and bit in the slots' refs */
+  uint64_t bit;
+  int* held;              /* frames held in each slot, the bit is cleared when the last is released */
+  uint64_t lastSequence;  /* newest frame shown which frameClientNextFrame() gave out */
+};
+
+static int64_t nowMs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*!
+ * Sleep until the server publishes something after published was read, or the deadline
+ * @param deadline : nowMs() to give up at, -1 for never
+ * @return 0 if the deadline passed
+ */
+static int waitPublished(FrameClient* client, uint32_t published, int64_t deadline) {
+  struct timespec timeout;
+  struct timespec* wait = NULL;
+  if(deadline >= 0) {
+    int64_t ms = deadline - nowMs();
+    if(ms <= 0) return 0;
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_nsec = (ms % 1000) * 1000000;
+    wait = &timeout;
+  }
+  syscall(SYS_futex, &client->header->published, FUTEX_WAIT, published, wait, NULL, 0);
+  return 1;
+}
+
+/*!
+ * Take a slot, unless the server is writing it
+ */
+static int holdSlot(FrameClient* client, int slot) {
+  if(client->held[slot]) {
+    client->held[slot]++;
+    return 1;
+  }
+  uint64_t* refs = &client->header->slots[slot].refs;
+  uint64_t old = __atomic_load_n(refs, __ATOMIC_RELAXED);
+  while(!(old & FRAME_SHM_WRITER)) {
+    if(__atomic_compare_exchange_n(refs, &old, old | client->bit, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      client->held[slot] = 1;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void releaseSlot(FrameClient* client, int slot) {
+  if(--client->held[slot]) return;
+  __atomic_fetch_and(&client->header->slots[slot].refs, ~client->bit, __ATOMIC_RELEASE);
+}
+
+/*!
+ * Describe a held slot's frame
+ */
+static void fillFrame(FrameClient* client, int slot, FrameClientFrame* out) {
+  const FrameShmSlot* shm = &client->header->slots[slot];
+  out->frame = shm->frame;
+  out->pts = shm->pts;
+  out->format = shm->format;
+  out->width = shm->width;
+  out->height = shm->height;
+  out->level = shm->level;
+  for(int plane = 0; plane < 4; plane++) {
+    out->planes[plane] = shm->offset[plane] ? client->map + shm->offset[plane] : NULL;
+    out->linesize[plane] = shm->linesize[plane];
+  }
+  out->size = shm->size;
+  out->sequence = shm->sequence;
+  out->slot = slot;
+  __atomic_fetch_add(&client->header->consumers[client->id].acquired, 1, __ATOMIC_RELAXED);
+}
+
+static int isServerAlive(FrameClient* client) {
+  return __atomic_load_n(&client->header->serverPid, __ATOMIC_ACQUIRE) != 0;
+}
+
+/*!
+ * Attach to a player's frame server
+ * @param name : what the player was given with --serve
+ * @return null if there's no server by that name, or it has as many clients as it takes
+ */
+FrameClient* frameClientOpen(const char* name) {
+  char path[NAME_MAX + 1];
+  snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+  int fd = shm_open(path, O_RDWR, 0);
+  if(fd < 0) {
+    printf("no frame server %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  struct stat fileStat;
+  if(fstat(fd, &fileStat) || (size_t)fileStat.st_size < sizeof(FrameShmHeader)) {
+    printf("frame server %s isn't ready\n", path);
+    close(fd);
+    return NULL;
+  }
+  void* map = mmap(NULL, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    printf("failed to map frame server %s\n", path);
+    return NULL;
+  }
+
+  FrameShmHeader* header = (FrameShmHeader*)map;
+  if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != FRAME_SHM_MAGIC || header->version != FRAME_SHM_VERSION ||
+     header->mapBytes != (uint64_t)fileStat.st_size) {
+    printf("frame server %s isn't one this client reads\n", path);
+    munmap(map, fileStat.st_size);
+    return NULL;
+  }
+
+  FrameClient* client = (FrameClient*)calloc(1, sizeof(FrameClient));
+  client->header = header;
+  client->map = (uint8_t*)map;
+  client->mapBytes = fileStat.st_size;
+  client->held = (int*)calloc(header->slotCount, sizeof(int));
+  client->id = -1;
+  for(int id = 0; id < FRAME_SHM_MAX_CONSUMERS && client->id < 0; id++) {
+    int32_t free = 0;
+    if(__atomic_compare_exchange_n(&header->consumers[id].pid, &free, getpid(), 0, __ATOMIC_ACQ_REL,
+                                   __ATOMIC_RELAXED)) {
+      client->id = id;
+    }
+  }
+  if(client->id < 0) {
+    printf("frame server %s has %d clients already\n", path, FRAME_SHM_MAX_CONSUMERS);
+    frameClientClose(client);
+    return NULL;
+  }
+  client->bit = 1ull << client->id;
+  return client;
+}
+
+/*!
+ * Detach, releasing any frames still held
+ */
+void frameClientClose(FrameClient* client) {
+  if(!client) return;
+  if(client->id >= 0) {
+    FrameShmConsumer* consumer = &client->header->consumers[client->id];
+    for(uint32_t slot = 0; slot < client->header->slotCount; slot++) {
+      if(client->held[slot]) __atomic_fetch_and(&client->header->slots[slot].refs, ~client->bit, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&consumer->requestedFrame, -1, __ATOMIC_RELAXED);
+    __atomic_store_n(&consumer->acquired, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&consumer->pid, 0, __ATOMIC_RELEASE);
+  }
+  munmap(client->map, client->mapBytes);
+  free(client->held);
+  free(client);
+}
+
+/*!
+ * Get a frame by number.  Frames which were shown recently are in the ring already, others are asked
+ * for, and the player publishes them if they are in its cache.
+ * @param timeoutMs : how long to wait for the frame, 0 not to, -1 for as long as it takes
+ * @return FRAME_CLIENT_OK with the frame held in out, FRAME_CLIENT_TIMEOUT or FRAME_CLIENT_CLOSED
+ */
+int frameClientGetFrame(FrameClient* client, int frame, int timeoutMs, FrameClientFrame* out) {
+  FrameShmHeader* header = client->header;
+  FrameShmConsumer* consumer = &header->consumers[client->id];
+  int64_t deadline = timeoutMs < 0 ? -1 : nowMs() + timeoutMs;
+  int result = FRAME_CLIENT_TIMEOUT;
+  while(1) {
+    if(!isServerAlive(client)) {
+      result = FRAME_CLIENT_CLOSED;
+      break;
+    }
+    uint32_t published = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+    int found = 0;
+    for(uint32_t slot = 0; slot < header->slotCount && !found; slot++) {
+      if(__atomic_load_n(&header->slots[slot].frame, __ATOMIC_RELAXED) != frame) continue;
+      if(!holdSlot(client, slot)) continue;
+      // it may have been filled again before we held it
+      if(header->slots[slot].frame == frame && header->slots[slot].sequence) {
+        fillFrame(client, slot, out);
+        found = 1;
+      } else {
+        releaseSlot(client, slot);
+      }
+    }
+    if(found) {
+      result = FRAME_CLIENT_OK;
+      break;
+    }
+    __atomic_store_n(&consumer->requestedFrame, frame, __ATOMIC_RELEASE);
+    if(!waitPublished(client, published, deadline)) break;
+  }
+  __atomic_store_n(&consumer->requestedFrame, -1, __ATOMIC_RELEASE);
+  return result;
+}
+
+/*!
+ * Follow the playhead: get the newest frame shown since the last one this gave out, waiting for one if
+ * there isn't one yet.  Frames shown while the client was busy are skipped.
+ * @param timeoutMs : how long to wait, 0 not to, -1 for as long as it takes
+ * @return FRAME_CLIENT_OK with the frame held in out, FRAME_CLIENT_TIMEOUT or FRAME_CLIENT_CLOSED
+ */
+int frameClientNextFrame(FrameClient* client, int timeoutMs, FrameClientFrame* out) {
+  FrameShmHeader* header = client->header;
+  int64_t deadline = timeoutMs < 0 ? -1 : nowMs() + timeoutMs;
+  while(1) {
+    if(!isServerAlive(client)) return FRAME_CLIENT_CLOSED;
+    uint32_t published = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+    int slot = __atomic_load_n(&header->latestSlot, __ATOMIC_ACQUIRE);
+    if(slot >= 0 && holdSlot(client, slot)) {
+      FrameShmSlot* shm = &header->slots[slot];
+      if(shm->sequence > client->lastSequence && !shm->requested) {
+        client->lastSequence = shm->sequence;
+        fillFrame(client, slot, out);
+        return FRAME_CLIENT_OK;
+      }
+      releaseSlot(client, slot);
+    }
+    if(!waitPublished(client, published, deadline)) return FRAME_CLIENT_TIMEOUT;
+  }
+}
+
+/*!
+ * Give a frame back to the player.  Its planes mustn't be read after this.
+ */
+void frameClientRelease(FrameClient* client, FrameClientFrame* frame) {
+  if(frame->slot < 0) return;
+  releaseSlot(client, frame->slot);
+  frame->slot = -1;
+}
+
+/*!
+ * Frame the player showed last, -1 if it hasn't shown any yet
+ */
+int frameClientGetPlayhead(FrameClient* client) {
+  int slot = __atomic_load_n(&client->header->latestSlot, __ATOMIC_ACQUIRE);
+  return slot < 0 ? -1 : __atomic_load_n(&client->header->slots[slot].frame, __ATOMIC_RELAXED);
+}
+
+void frameClientGetTimeBase(FrameClient* client, int* num, int* den) {
+  *num = client->header->timeBaseNum;
+  *den = client->header->timeBaseDen;
+}
+
+/*!
+ * Frames the player didn't publish because its clients held every slot
+ */
+uint64_t frameClientGetDrops(FrameClient* client) {
+  return __atomic_load_n(&client->header->drops, __ATOMIC_RELAXED);
+}
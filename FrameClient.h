@@ -0,0 +1,57 @@
+#ifndef VIDEOPLAYER_FRAMECLIENT_H
+#define VIDEOPLAYER_FRAMECLIENT_H
+
+/*
+ * C API for reading the frames a player publishes with --serve, from another process on the same machine.
+ * Frames are read where the player put them in shared memory: a frame is held until it's released, and
+ * the player never reuses a slot which is held, so hold frames no longer than it takes to read them.  A
+ * client which holds too many makes the player drop frames rather than wait.
+ *
+ * A client is used by one thread at a time.  Threads which read frames at the same time should each open
+ * their own.
+ */
+
+#include <stdint.h>
+#include "FrameShm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_CLIENT_OK 0
+#define FRAME_CLIENT_TIMEOUT 1   /* the frame didn't turn up in time */
+#define FRAME_CLIENT_CLOSED -1   /* the player has gone */
+
+typedef struct FrameClient FrameClient;
+
+/*
+ * A frame held by a client, from frameClientGetFrame() or frameClientNextFrame()
+ */
+typedef struct {
+  int frame;
+  int64_t pts;              /* in frameClientGetTimeBase() units, INT64_MIN if unknown */
+  int format;               /* FRAME_SHM_YUV420P */
+  int width;
+  int height;
+  int level;                /* 0 for full resolution, otherwise the proxy level the player showed */
+  const uint8_t* planes[4]; /* null past the format's planes */
+  int linesize[4];
+  uint64_t size;
+  uint64_t sequence;        /* publish number, increasing */
+  int slot;
+} FrameClientFrame;
+
+FrameClient* frameClientOpen(const char* name);
+void frameClientClose(FrameClient* client);
+int frameClientGetFrame(FrameClient* client, int frame, int timeoutMs, FrameClientFrame* out);
+int frameClientNextFrame(FrameClient* client, int timeoutMs, FrameClientFrame* out);
+void frameClientRelease(FrameClient* client, FrameClientFrame* frame);
+int frameClientGetPlayhead(FrameClient* client);
+void frameClientGetTimeBase(FrameClient* client, int* num, int* den);
+uint64_t frameClientGetDrops(FrameClient* client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIDEOPLAYER_FRAMECLIENT_H */
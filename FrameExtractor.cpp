@@ -0,0 +1,287 @@
+#include "FrameExtractor.h"
+#include "Timer.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// GOPs are put together until a chunk has at least this many frames, so short GOPs don't cost a seek each
+static const int minChunkFrames = 30;
+
+// when writing in order, each worker can be this many chunks ahead of the writer
+static const int chunksAheadPerWorker = 2;
+
+// chunk buffers are aligned to this, which O_DIRECT and the page cache both like
+static const size_t bufferAlignment = 4096;
+
+/*!
+ * @param workers : decode threads, -1 for one per core
+ */
+FrameExtractor::FrameExtractor(const std::string &fileName, int workers) : _fileName(fileName) {
+  _workerCount = workers > 0 ? workers : std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+FrameExtractor::~FrameExtractor() {
+  for(auto* buffer : _freeBuffers) free(buffer);
+  for(auto& chunk : _chunks) free(chunk.buffer);
+  if(_map) munmap(_map, _mapBytes);
+  if(_outFd >= 0) close(_outFd);
+}
+
+/*!
+ * Extract frames start to end, inclusive, as raw YUV420P at the source's size
+ * @param out : file to write, which is replaced, or - for stdout.  Anything this prints goes to stderr
+ *              while stdout is the output.
+ * @return false if the range couldn't be decoded or written
+ */
+bool FrameExtractor::run(int start, int end, const std::string &out) {
+  Timer clock;
+  if(out == "-") {
+    fflush(stdout);
+    _outFd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
+  if(!openDecoders() || !planChunks(start, end) || !openOutput(out)) return false;
+
+  std::vector<std::thread> threads;
+  int workers = std::min(_workerCount, (int)_chunks.size());
+  for(int worker = 0; worker < workers; worker++) {
+    threads.emplace_back(&FrameExtractor::workLoop, this, worker);
+  }
+
+  bool written = _map ? true : writeChunks();
+  if(!written) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _failed = true;
+  }
+  _cv.notify_all();
+  for(auto& thread : threads) thread.join();
+
+  if(_map) {
+    Timer flushTimer;
+    munmap(_map, _mapBytes);
+    _map = nullptr;
+    _stats.writeSeconds += flushTimer.getSeconds();
+  }
+  close(_outFd);
+  _outFd = -1;
+
+  _stats.workers = workers;
+  _stats.chunks = (int)_chunks.size();
+  _stats.seconds = clock.getSeconds();
+  if(_failed) return false;
+  _stats.frames = _chunks.back().last - _start + 1;
+  _stats.bytes = _stats.frames * _frameBytes;
+  return true;
+}
+
+/*!
+ * Open a decoder for each worker, each with a cache just big enough for the frames it's converting
+ * @return false if the file can't be decoded or has no index
+ */
+bool FrameExtractor::openDecoders() {
+  for(int worker = 0; worker < _workerCount; worker++) {
+    auto cache = std::unique_ptr<VideoCache>(new VideoCache(0));
+    auto decoder = std::unique_ptr<VideoDecoder>(new VideoDecoder(_fileName, *cache));
+    decoder->setReadMode(_readMode);
+    if(!decoder->open()) return false;
+    if(!decoder->getIndex().isLoaded()) {
+      printf("extracting needs the packet index of %s\n", _fileName.c_str());
+      return false;
+    }
+    cache->reserveFrames(decoder->getFrameDataSize());
+    _caches.push_back(std::move(cache));
+    _decoders.push_back(std::move(decoder));
+  }
+  _frameBytes = _decoders[0]->getFrameDataSize();
+  return true;
+}
+
+/*!
+ * Split the range at keyframes into chunks of whole GOPs, apart from the ends of the range, and find
+ * where each has to be decoded from
+ */
+bool FrameExtractor::planChunks(int start, int end) {
+  PacketIndex& index = _decoders[0]->getIndex();
+  if(start > end || start >= index.getFrameCount() || end < 0) {
+    printf("no frames from %d to %d, the video has %d\n", start, end, index.getFrameCount());
+    return false;
+  }
+  start = std::max(0, start);
+  end = std::min(end, index.getFrameCount() - 1);
+
+  _start = start;
+  int maxFrames = 0;
+  for(int first = start; first <= end;) {
+    // whole GOPs, until there are enough frames
+    int last = first - 1;
+    do {
+      int next = index.getKeyframeAfter(last + 1);
+      last = next < 0 || next > end ? end : next - 1;
+    } while(last < end && last - first + 1 < minChunkFrames);
+    Chunk chunk;
+    chunk.first = first;
+    chunk.last = last;
+    chunk.decodeFrom = first;
+    int keyframe = index.getKeyframeBefore(first);
+    if(index.hasLeadingFrames(keyframe)) chunk.decodeFrom = std::max(0, index.getKeyframeBefore(keyframe - 1));
+    _chunks.push_back(chunk);
+    maxFrames = std::max(maxFrames, last - first + 1);
+    first = last + 1;
+  }
+  _bufferBytes = (maxFrames * _frameBytes + bufferAlignment - 1) / bufferAlignment * bufferAlignment;
+  return true;
+}
+
+/*!
+ * Open the output.  A regular file is allocated at its full size and mapped, unless mapping is turned off.
+ */
+bool FrameExtractor::openOutput(const std::string &out) {
+  if(_outFd < 0) _outFd = open(out.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(_outFd < 0) {
+    printf("can't write %s: %s\n", out.c_str(), strerror(errno));
+    return false;
+  }
+
+  struct stat outStat;
+  if(!_mapOutput || fstat(_outFd, &outStat) || !S_ISREG(outStat.st_mode)) return true;
+  _mapBytes = (uint64_t)(_chunks.back().last - _start + 1) * _frameBytes;
+  // fallocate makes sure the disk has room, so a full disk fails here rather than as a SIGBUS
+  int allocated = posix_fallocate(_outFd, 0, _mapBytes);
+  if(allocated && (allocated != EOPNOTSUPP || ftruncate(_outFd, _mapBytes))) {
+    printf("can't allocate %.0f MB for %s: %s\n", _mapBytes / (1024. * 1024.), out.c_str(), strerror(allocated));
+    return false;
+  }
+  void* map = mmap(nullptr, _mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, _outFd, 0);
+  if(map == MAP_FAILED) {
+    printf("failed to map %s, writing it instead\n", out.c_str());
+    return true;
+  }
+  _map = (uint8_t*)map;
+  _stats.mapped = true;
+  return true;
+}
+
+/*!
+ * Main loop of a worker thread.  Takes chunks in order and decodes them, into the mapped output or a
+ * buffer for the writer.  Without a mapping, it waits rather than get too far ahead of the writer.
+ */
+void FrameExtractor::workLoop(int worker) {
+  TRACE_THREAD("extract worker");
+  int ahead = _workerCount * chunksAheadPerWorker;
+  std::unique_lock<std::mutex> lock(_mutex);
+  while(true) {
+    Timer stallTimer;
+    while(!_failed && !_map && _nextChunk < (int)_chunks.size() && _nextChunk >= _written + ahead) {
+      _cv.wait(lock);
+    }
+    _stats.stallSeconds += stallTimer.getSeconds();
+    if(_failed || _nextChunk >= (int)_chunks.size()) return;
+    Chunk& chunk = _chunks[_nextChunk++];
+    if(!_map && !(chunk.buffer = takeBuffer())) {
+      printf("can't allocate %.0f MB for a chunk\n", _bufferBytes / (1024. * 1024.));
+      _failed = true;
+      _cv.notify_all();
+      return;
+    }
+
+    lock.unlock();
+    Timer decodeTimer;
+    bool decoded = decodeChunk(*_decoders[worker], chunk);
+    double decodeSeconds = decodeTimer.getSeconds();
+    lock.lock();
+
+    _stats.decodeSeconds += decodeSeconds;
+    if(!decoded) _failed = true;
+    chunk.done = true;
+    _cv.notify_all();
+  }
+}
+
+/*!
+ * Decode a chunk's frames in order, copying each to where it goes in the output.  Frames from where the
+ * chunk is decoded from up to its first are only decoded for their references.
+ * @return false if a frame couldn't be decoded
+ */
+bool FrameExtractor::decodeChunk(VideoDecoder &decoder, Chunk &chunk) {
+  for(int frame = chunk.decodeFrom; frame < chunk.first; frame++) {
+    if(_failed) return false;
+    decoder.seekTo(frame);
+  }
+  for(int frame = chunk.first; frame <= chunk.last; frame++) {
+    if(_failed) return false;
+    decoder.seekTo(frame);
+    FrameRecord* rec = decoder.getCurrentFrame() == frame ? decoder.getConvertedFrame() : nullptr;
+    if(!rec) {
+      printf("couldn't decode frame %d, got %d\n", frame, decoder.getCurrentFrame());
+      return false;
+    }
+    uint8_t* dst = _map ? _map + (uint64_t)(frame - _start) * _frameBytes :
+                   chunk.buffer + (uint64_t)(frame - chunk.first) * _frameBytes;
+    memcpy(dst, rec->data, _frameBytes);
+  }
+  return true;
+}
+
+/*!
+ * Write the chunks to the output in order, each as soon as it's decoded
+ */
+bool FrameExtractor::writeChunks() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for(auto& chunk : _chunks) {
+    while(!chunk.done && !_failed) _cv.wait(lock);
+    if(_failed) return false;
+    uint8_t* buffer = chunk.buffer;
+
+    lock.unlock();
+    Timer writeTimer;
+    bool written = writeAll(buffer, (uint64_t)(chunk.last - chunk.first + 1) * _frameBytes);
+    double writeSeconds = writeTimer.getSeconds();
+    lock.lock();
+
+    _stats.writeSeconds += writeSeconds;
+    if(!written) return false;
+    chunk.buffer = nullptr;
+    _freeBuffers.push_back(buffer);
+    _written++;
+    _cv.notify_all();
+  }
+  return true;
+}
+
+/*!
+ * Write all of a buffer, however many writes the output takes
+ */
+bool FrameExtractor::writeAll(const uint8_t *data, uint64_t bytes) {
+  while(bytes) {
+    ssize_t written = write(_outFd, data, bytes);
+    if(written < 0 && errno == EINTR) continue;
+    if(written <= 0) {
+      printf("extract write failed: %s\n", strerror(errno));
+      return false;
+    }
+    data += written;
+    bytes -= written;
+  }
+  return true;
+}
+
+/*!
+ * Get a chunk buffer, reusing one the writer is done with.  Must hold the lock.
+ */
+uint8_t* FrameExtractor::takeBuffer() {
+  if(!_freeBuffers.empty()) {
+    uint8_t* buffer = _freeBuffers.back();
+    _freeBuffers.pop_back();
+    return buffer;
+  }
+  void* buffer = nullptr;
+  if(posix_memalign(&buffer, bufferAlignment, _bufferBytes)) return nullptr;
+  return (uint8_t*)buffer;
+}
@@ -0,0 +1,101 @@
+#ifndef VIDEOPLAYER_FRAMEEXTRACTOR_H
+#define VIDEOPLAYER_FRAMEEXTRACTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FileReader.h"
+#include "VideoCache.h"
+#include "VideoDecoder.h"
+
+struct ExtractStats {
+  int frames = 0;           // frames written
+  uint64_t bytes = 0;
+  int chunks = 0;
+  int workers = 0;
+  bool mapped = false;      // written through a mapping of the output rather than write()
+  double seconds = 0;
+  double decodeSeconds = 0; // decoding and converting, summed over the workers
+  double writeSeconds = 0;  // in write(), or in munmap() flushing the mapping
+  double stallSeconds = 0;  // workers waiting for the writer to make room
+
+  double getFps() { return seconds > 0 ? frames / seconds : 0; }
+  double getMBps() { return seconds > 0 ? bytes / (1024. * 1024.) / seconds : 0; }
+};
+
+/*!
+ * Decodes a range of frames to raw YUV420P at the source's size, as fast as the machine allows, with no
+ * window or playback.  The range is split at keyframes into chunks, and a pool of workers, each with its
+ * own VideoDecoder, decodes the chunks in parallel.  Needs the packet index.
+ *
+ * A chunk starting at a closed GOP's keyframe decodes the same as it would going through the range in
+ * order.  An open GOP's frames may refer to the GOP before, so a chunk starting at one of those is
+ * decoded from the keyframe before, and the frames ahead of the chunk are thrown away.  One GOP of
+ * references is what encoders use, though a stream may refer back further than that.
+ *
+ * A regular file is sized up front and mapped, and each worker copies its frames straight to where they
+ * go in it.  Anything else, such as a pipe, is written in order: workers fill page aligned chunk buffers,
+ * a bounded number ahead of the writer, which writes each one whole as soon as the chunks before it are.
+ */
+class FrameExtractor {
+public:
+  FrameExtractor(const std::string& fileName, int workers);
+  ~FrameExtractor();
+  void setReadMode(FileReadMode readMode) { _readMode = readMode; }
+  void setMapOutput(bool mapOutput) { _mapOutput = mapOutput; }
+  bool run(int start, int end, const std::string& out);
+  ExtractStats getStats() { return _stats; }
+
+private:
+  /*!
+   * Consecutive GOPs of the range, decoded by one worker
+   */
+  struct Chunk {
+    int first;
+    int last;
+    int decodeFrom;            // first, or the keyframe before if first's GOP is open
+    uint8_t* buffer = nullptr; // frames, when they're written in order
+    bool done = false;
+  };
+
+  bool openDecoders();
+  bool planChunks(int start, int end);
+  bool openOutput(const std::string& out);
+  void workLoop(int worker);
+  bool decodeChunk(VideoDecoder& decoder, Chunk& chunk);
+  bool writeChunks();
+  bool writeAll(const uint8_t* data, uint64_t bytes);
+  uint8_t* takeBuffer();
+
+  std::string _fileName;
+  int _workerCount;
+  FileReadMode _readMode = READ_MMAP;
+  bool _mapOutput = true;
+  std::vector<std::unique_ptr<VideoCache>> _caches;
+  std::vector<std::unique_ptr<VideoDecoder>> _decoders;
+
+  int _start = 0;
+  uint64_t _frameBytes = 0;
+  std::vector<Chunk> _chunks;
+  int _outFd = -1;
+  uint8_t* _map = nullptr;   // the output, when it's mapped
+  uint64_t _mapBytes = 0;
+  uint64_t _bufferBytes = 0; // of a chunk buffer, enough for the biggest chunk
+  ExtractStats _stats;
+  std::atomic<bool> _failed{false}; // checked by the workers between frames
+
+  // protected by _mutex
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  int _nextChunk = 0;        // next for a worker to take
+  int _written = 0;          // chunks the writer is done with
+  std::vector<uint8_t*> _freeBuffers;
+};
+
+#endif //VIDEOPLAYER_FRAMEEXTRACTOR_H
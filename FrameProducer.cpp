@@ -0,0 +1,285 @@
+#include "FrameProducer.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <algorithm>
+
+FrameProducer::~FrameProducer() {
+  stop();
+
+  // give back the pins of anything left in the ring
+  while(_ring.front()) popFrame();
+}
+
+/*!
+ * Start the decode thread
+ * @param ringFrames : number of decoded frames the decode thread can get ahead of the consumer
+ */
+void FrameProducer::start(size_t ringFrames) {
+  _ring.init(ringFrames);
+  _running = true;
+  _thread = std::thread(&FrameProducer::decodeLoop, this);
+}
+
+/*!
+ * Stop the decode thread.  It finishes the frame it is working on first.
+ */
+void FrameProducer::stop() {
+  _running = false;
+  if(_thread.joinable()) _thread.join();
+}
+
+/*!
+ * Tell the decode thread where the playhead is.  If the playhead jumped or reversed, or the speed
+ * changed, the decode thread is restarted at the new position and anything it already queued is dropped.
+ * @param target : frame the consumer wants next
+ * @param direction : 1 or -1 to decode ahead while playing, 0 to only decode the target
+ * @param speed : shuttle speed, frames the playhead moves per displayed frame
+ */
+void FrameProducer::request(int target, int direction, int speed) {
+  int lastTarget = _target.load();
+  // when shuttling the target moves speed frames per displayed frame, more if a frame ran late
+  bool jumped = abs(target - lastTarget) > (speed > 1 ? speed * 8 : 1);
+  bool reversed = direction && direction != _lastDirection;
+  bool changedSpeed = speed != _speed.load();
+  if(direction) _lastDirection = direction;
+
+  _target = target;
+  _direction = direction;
+  _speed = speed;
+  if(jumped || reversed || changedSpeed) {
+    restart();
+  }
+
+  // start reading where the decode thread is about to seek while it's still finishing its last frame
+  if(jumped || reversed) _decoder.prefetch(target);
+  if(direction < 0) prefetchBehind(target);
+}
+
+/*!
+ * Going backward, the decode thread starts on the previous GOP as soon as the playhead enters a GOP, and
+ * the one before that is next.  Read both ahead, the previous one first.
+ */
+void FrameProducer::prefetchBehind(int target) {
+  // only the index is safe to use from this thread
+  PacketIndex& index = _decoder.getIndex();
+  if(!index.isLoaded()) return;
+
+  int gopStart = index.getKeyframeBefore(target);
+  if(gopStart == _prefetchedGop) return;
+  _prefetchedGop = gopStart;
+
+  int previous = gopStart > 0 ? index.getKeyframeBefore(gopStart - 1) : -1;
+  if(previous > 0) _decoder.prefetch(previous - 1);
+  if(previous >= 0) _decoder.prefetch(previous);
+}
+
+/*!
+ * Restart the decode thread at the current target
+ */
+void FrameProducer::restart() {
+  _consumerGeneration = ++_generation;
+}
+
+/*!
+ * Change the size the decode thread converts frames to, and restart it so the frames queued at the old
+ * size are dropped
+ */
+void FrameProducer::setOutputSize(int width, int height) {
+  _outputSize = (uint64_t)width << 32 | (uint32_t)height;
+  restart();
+}
+
+/*!
+ * Get a frame from the front of the ring if it is there.  Frames queued for an old request, or which the
+ * playhead has already passed, are dropped.  The slot and its record stay valid until popFrame().
+ * @return the frame's slot, or null if it isn't at the front
+ */
+FrameSlot* FrameProducer::peekFrame(int frame) {
+  while(FrameSlot* slot = _ring.front()) {
+    if(slot->generation != _consumerGeneration || (slot->frame - frame) * _lastDirection < 0) {
+      popFrame();
+      continue;
+    }
+
+    // still ahead of the playhead, leave it for later
+    if(slot->frame != frame) return nullptr;
+    return slot;
+  }
+  return nullptr;
+}
+
+/*!
+ * Get the newest frame in the ring which is due at a frame, for shuttling where frames are skipped.
+ * Frames queued for an old request, or which a newer due frame replaces, are dropped.
+ * @return the frame's slot, or null if nothing in the ring is due yet
+ */
+FrameSlot* FrameProducer::peekLatest(int frame) {
+  while(FrameSlot* slot = _ring.front()) {
+    if(slot->generation != _consumerGeneration) {
+      popFrame();
+      continue;
+    }
+    if((slot->frame - frame) * _lastDirection > 0) return nullptr;
+
+    FrameSlot* next = _ring.peek(1);
+    if(next && next->generation == _consumerGeneration && (next->frame - frame) * _lastDirection <= 0) {
+      popFrame();
+      continue;
+    }
+    return slot;
+  }
+  return nullptr;
+}
+
+/*!
+ * Remove the frame at the front of the ring and release its record
+ */
+void FrameProducer::popFrame() {
+  _cache.releaseFrame(_ring.front()->record);
+  _ring.pop();
+}
+
+/*!
+ * Check if the decode thread has moved past a frame without queueing it, which happens when it skipped
+ * the frame because it was cached, and then the frame was cleaned.
+ */
+bool FrameProducer::hasPassed(int frame) {
+  FrameSlot* head = _ring.front();
+  int decoderAt = head ? head->frame : _decodeNext.load();
+  return (decoderAt - frame) * _lastDirection > 0;
+}
+
+/*!
+ * How far ahead of the target the decode thread may work
+ */
+int FrameProducer::getMaxLead(int target, int direction, int speed) {
+  if(direction == 0) return 1;
+
+  int lead = (int)_ring.capacity() * speed;
+  if(direction < 0) {
+    // allow the last frame of the previous GOP, which decodes that whole GOP while this one is shown
+    int gopStart = _decoder.getKeyframeBefore(target);
+    if(gopStart > 0) lead = std::max(lead, target - gopStart + 2);
+  }
+  return lead;
+}
+
+/*!
+ * Frames to skip at a shuttle speed.  Dropping the frames nothing refers to is enough at 2x and 4x, but
+ * on long GOPs only keyframes keep up beyond that.  We need the index to know where those are.
+ */
+DecodeSkip FrameProducer::getSkipForSpeed(int speed) {
+  if(speed >= 8 && _decoder.getIndex().isLoaded()) return DECODE_KEYFRAMES;
+  if(speed >= 2) return DECODE_REFERENCE;
+  return DECODE_ALL;
+}
+
+/*!
+ * Get the first keyframe at or after a frame in the direction we're going
+ * @param step : 1 or -1
+ * @return the keyframe, or -1 if there isn't one
+ */
+int FrameProducer::getKeyframeFrom(int frame, int step) {
+  int before = _decoder.getKeyframeBefore(frame);
+  if(step < 0 || before == frame) return before;
+  return _decoder.getKeyframeAfter(frame);
+}
+
+/*!
+ * Main loop of the decode thread.
+ * Works through the frames from the consumer's target in the current direction, decoding any which
+ * aren't cached in either tier, until it is as far ahead of the target as getMaxLead() allows.
+ * When shuttling, it steps speed frames at a time, or from keyframe to keyframe.
+ */
+void FrameProducer::decodeLoop() {
+  TRACE_THREAD("producer");
+  uint32_t generation = _generation.load();
+  int next = _target.load();
+  uint64_t outputSize = 0;
+
+  while(_running) {
+    uint32_t currentGeneration = _generation.load();
+    int target = _target.load();
+    int direction = _direction.load();
+    int speed = direction ? _speed.load() : 1;
+    int step = direction < 0 ? -1 : 1;
+
+    DecodeSkip skip = getSkipForSpeed(speed);
+    _decoder.setSkip(skip);
+    _skip = skip;
+
+    if(currentGeneration != generation) {
+      generation = currentGeneration;
+      next = target;
+    }
+    if(_outputSize.load() != outputSize) {
+      outputSize = _outputSize.load();
+      _decoder.setOutputSize((int)(outputSize >> 32), (int)(outputSize & 0xffffffff));
+    }
+
+    // don't bother with frames the playhead has already passed
+    if((next - target) * step < 0) next = target;
+    if(skip == DECODE_KEYFRAMES) next = getKeyframeFrom(next, step);
+    _decodeNext = next;
+
+    int lead = (next - target) * step;
+    if(lead >= getMaxLead(target, direction, speed) || next < 0 || next > _decoder.getLastFrame()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    // RAM, then the spill tier, then a stale copy from before a resize, then decode it
+    if(!_cache.hasFrame(next) && !_cache.loadFromSpill(next) && !_cache.rescaleStale(next, next)) {
+      int produced = produceFrame(next, generation);
+
+      // a skipped frame gives us the next one which wasn't, carry on from there
+      if(produced >= 0) next = step > 0 ? std::max(next, produced) : std::min(next, produced);
+    }
+    next += step * (skip == DECODE_KEYFRAMES ? 1 : speed);
+  }
+}
+
+/*!
+ * Decode a frame and push its cache record into the ring.  Gives up on the seek, or waiting for space
+ * in the ring, if the consumer restarts the decoder in the meantime.
+ * @param frame : frame number
+ * @param generation : generation the frame is for
+ * @return the frame pushed, which when skipping frames may be a later one, or -1 if nothing was pushed
+ */
+int FrameProducer::produceFrame(int frame, uint32_t generation) {
+  _decoder.setCancel(_cancelSeeks ? &_generation : nullptr, generation);
+  _decoder.seekTo(frame);
+
+  // restarted while seeking, the target has moved on
+  if(_decoder.getCurrentFrame() != frame && _decoder.isCancelled()) return -1;
+
+  int produced = frame;
+  if(_decoder.getCurrentFrame() != frame) {
+    if(frame > _decoder.getLastFrame()) return -1;
+
+    if(_decoder.getSkip() != DECODE_ALL) {
+      produced = _decoder.getCurrentFrame();
+    } else {
+      // timestamps don't always line up with our frame numbering, show what we got in its place
+      printf("[ERROR] wanted frame %d, got %d instead!\n", frame, _decoder.getCurrentFrame());
+    }
+  }
+
+  FrameRecord* rec = _decoder.getConvertedFrame();
+
+  FrameSlot* slot;
+  while(!(slot = _ring.beginPush())) {
+    if(!_running || _generation.load() != generation) return -1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // the ring holds its own pin, the decoder drops its one when it converts the next frame
+  _cache.pinFrame(rec);
+  slot->record = rec;
+  slot->frame = produced;
+  slot->generation = generation;
+  _ring.commitPush();
+  return produced;
+}
@@ -0,0 +1,82 @@
+#ifndef VIDEOPLAYER_FRAMEPRODUCER_H
+#define VIDEOPLAYER_FRAMEPRODUCER_H
+
+#include <atomic>
+#include <thread>
+#include "FrameRing.h"
+#include "VideoCache.h"
+#include "VideoDecoder.h"
+
+/*!
+ * Decode thread which runs ahead of the playhead.
+ * Frames it decodes are added to the cache, and frames at or ahead of the playhead are also pushed into
+ * a ring for the consumer (the render thread) to pick up.  The consumer never waits for the decoder.
+ *
+ * Going forward, it stays up to a ring's worth of frames ahead.  Going backward, it decodes whole GOPs:
+ * as soon as the playhead enters a GOP it starts decoding the previous one from its keyframe, so the
+ * previous GOP is cached by the time the playhead gets there.
+ *
+ * Above 1x (shuttle), it only decodes some of the frames: every speed'th frame with the frames nothing
+ * refers to skipped, or just the keyframes at the top speeds.  Frames are queued under the frame number
+ * the decoder actually gave, and the consumer shows the newest one which is due.
+ *
+ * The output size is handed over like the target and applied by the decode thread, which owns the decoder.
+ *
+ * A restart also cancels the seek the decode thread is in the middle of, so a burst of jumps costs one
+ * seek to where the playhead ends up rather than one per jump.  The frames the abandoned seek decoded stay
+ * cached.
+ */
+class FrameProducer {
+public:
+  FrameProducer(VideoDecoder& decoder, VideoCache& cache) : _decoder(decoder), _cache(cache) { }
+  ~FrameProducer();
+  void start(size_t ringFrames);
+  void stop();
+  void setCancelSeeks(bool cancelSeeks) { _cancelSeeks = cancelSeeks; }
+
+  // consumer side
+  void request(int target, int direction, int speed = 1);
+  void restart();
+  void setOutputSize(int width, int height);
+  FrameSlot* peekFrame(int frame);
+  FrameSlot* peekLatest(int frame);
+  void popFrame();
+  bool hasPassed(int frame);
+
+  size_t getRingDepth() { return _ring.size(); }
+  size_t getRingCapacity() { return _ring.capacity(); }
+  int getDecodeNext() { return _decodeNext; }
+  int getLastDirection() { return _lastDirection; }
+  DecodeSkip getSkip() { return _skip; }
+
+private:
+  void decodeLoop();
+  void prefetchBehind(int target);
+  int getMaxLead(int target, int direction, int speed);
+  DecodeSkip getSkipForSpeed(int speed);
+  int getKeyframeFrom(int frame, int step);
+  int produceFrame(int frame, uint32_t generation);
+
+  VideoDecoder& _decoder;
+  VideoCache& _cache;
+  FrameRing _ring;
+  std::thread _thread;
+  bool _cancelSeeks = true;  // set before start()
+
+  // owned by the consumer
+  int _lastDirection = 1;
+  int _prefetchedGop = -1;   // GOP the playhead was in when we last prefetched behind it
+  uint32_t _consumerGeneration = 0;
+
+  // shared between threads
+  std::atomic<bool> _running{false};
+  std::atomic<int> _target{0};            // frame the consumer wants next
+  std::atomic<int> _direction{1};         // direction to decode ahead in, 0 for just the target
+  std::atomic<int> _speed{1};             // shuttle speed, 1 for every frame
+  std::atomic<DecodeSkip> _skip{DECODE_ALL}; // what the decode thread is skipping, for display
+  std::atomic<uint32_t> _generation{0};   // bumped by the consumer to restart decoding at the target
+  std::atomic<int> _decodeNext{0};        // next frame the decode thread will consider
+  std::atomic<uint64_t> _outputSize{0};   // width in the top half and height in the bottom, 0 for the source's
+};
+
+#endif //VIDEOPLAYER_FRAMEPRODUCER_H
@@ -0,0 +1,102 @@
+#ifndef VIDEOPLAYER_FRAMERING_H
+#define VIDEOPLAYER_FRAMERING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+struct FrameRecord;
+
+/*!
+ * A decoded frame waiting in the ring to be displayed.  The record is pinned in the VideoCache until the
+ * slot is popped.
+ */
+struct FrameSlot {
+  FrameRecord* record;
+  int frame;
+  uint32_t generation; // seek generation the frame was decoded for
+};
+
+/*!
+ * Bounded single-producer/single-consumer queue of decoded frames.
+ * Slots hold pinned cache records rather than copies of the frames, and are allocated up front, so
+ * neither side copies, allocates or takes a lock.
+ */
+class FrameRing {
+public:
+  FrameRing() = default;
+  ~FrameRing() {
+    delete[] _slots;
+  }
+
+  /*!
+   * Allocate the slots.  Must be called before either thread uses the ring.
+   * @param capacity : number of frames the ring can hold
+   */
+  void init(size_t capacity) {
+    _capacity = capacity;
+    _slots = new FrameSlot[capacity];
+    for(size_t i = 0; i < capacity; i++) {
+      _slots[i].record = nullptr;
+      _slots[i].frame = -1;
+      _slots[i].generation = 0;
+    }
+  }
+
+  size_t capacity() { return _capacity; }
+
+  /*!
+   * Number of frames in the ring.  Exact for either thread's own view, approximate for anyone else.
+   */
+  size_t size() {
+    return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+  }
+
+  // producer side
+
+  /*!
+   * Get the slot to fill next, or null if the ring is full.  Nothing is visible to the consumer
+   * until commitPush().
+   */
+  FrameSlot* beginPush() {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if(tail - _head.load(std::memory_order_acquire) == _capacity) return nullptr;
+    return &_slots[tail % _capacity];
+  }
+
+  void commitPush() {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // consumer side
+
+  /*!
+   * Get the oldest frame in the ring, or null if the ring is empty.  The slot stays valid until pop().
+   */
+  FrameSlot* front() {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if(head == _tail.load(std::memory_order_acquire)) return nullptr;
+    return &_slots[head % _capacity];
+  }
+
+  /*!
+   * Get the frame a number of places behind the front, or null if the ring doesn't hold that many.
+   */
+  FrameSlot* peek(size_t offset) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if(_tail.load(std::memory_order_acquire) - head <= offset) return nullptr;
+    return &_slots[(head + offset) % _capacity];
+  }
+
+  void pop() {
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+private:
+  FrameSlot* _slots = nullptr;
+  size_t _capacity = 0;
+  alignas(64) std::atomic<size_t> _head{0}; // next slot to read, written by consumer
+  alignas(64) std::atomic<size_t> _tail{0}; // next slot to write, written by producer
+};
+
+#endif //VIDEOPLAYER_FRAMERING_H
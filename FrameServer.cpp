@@ -0,0 +1,237 @@
+#include "FrameServer.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+};
+
+// consumers are checked for having died this often
+static const double reclaimSeconds = 1;
+
+FrameServer::~FrameServer() {
+  close();
+}
+
+static uint64_t roundToPage(uint64_t bytes) {
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+  return (bytes + page - 1) / page * page;
+}
+
+/*!
+ * Create the shared memory.  Anything left under the name by a server which didn't close is replaced.
+ * @param name : shared memory object, a / is put in front if it doesn't start with one
+ * @param slots : frames the ring holds, at least 2
+ * @param slotBytes : biggest frame which will be published
+ * @param index : for the frames' pts, or null
+ * @param timeBaseNum : unit of the pts
+ */
+bool FrameServer::open(const std::string &name, int slots, uint64_t slotBytes, PacketIndex *index,
+                       int timeBaseNum, int timeBaseDen) {
+  close();
+  _name = name[0] == '/' ? name : "/" + name;
+  slots = std::max(2, slots);
+  slotBytes = roundToPage(slotBytes);
+  uint64_t dataOffset = roundToPage(FRAME_SHM_HEADER_BYTES(slots));
+  uint64_t mapBytes = dataOffset + slots * slotBytes;
+
+  shm_unlink(_name.c_str());
+  int fd = shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if(fd < 0) {
+    printf("failed to create frame server %s: %s\n", _name.c_str(), strerror(errno));
+    return false;
+  }
+  if(ftruncate(fd, mapBytes)) {
+    printf("failed to allocate %.0f MB for frame server %s\n", mapBytes / (1024. * 1024.), _name.c_str());
+    ::close(fd);
+    shm_unlink(_name.c_str());
+    return false;
+  }
+  void* map = mmap(nullptr, mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(map == MAP_FAILED) {
+    printf("failed to map frame server %s\n", _name.c_str());
+    shm_unlink(_name.c_str());
+    return false;
+  }
+
+  _map = (uint8_t*)map;
+  _header = (FrameShmHeader*)map;
+  _index = index && index->isLoaded() ? index : nullptr;
+  _nextSlot = 0;
+  _stats = FrameServerStats();
+  _reclaimClock.start();
+
+  // the mapping starts zeroed, so only what isn't 0 is set.  magic goes last, clients check it
+  _header->version = FRAME_SHM_VERSION;
+  _header->slotCount = slots;
+  _header->slotBytes = slotBytes;
+  _header->dataOffset = dataOffset;
+  _header->mapBytes = mapBytes;
+  _header->serverPid = getpid();
+  _header->timeBaseNum = timeBaseNum;
+  _header->timeBaseDen = timeBaseDen;
+  _header->latestSlot = -1;
+  for(auto& consumer : _header->consumers) consumer.requestedFrame = -1;
+  for(int slot = 0; slot < slots; slot++) _header->slots[slot].frame = -1;
+  __atomic_store_n(&_header->magic, FRAME_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  printf("frame server: %d frames (%.0f MB) in %s\n", slots, mapBytes / (1024. * 1024.), _name.c_str());
+  return true;
+}
+
+/*!
+ * Remove the shared memory.  Clients which still have it mapped can carry on reading what's there, and
+ * see serverPid go to 0.
+ */
+void FrameServer::close() {
+  if(!_header) return;
+  __atomic_store_n(&_header->serverPid, 0, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&_header->published, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &_header->published, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+  munmap(_map, _header->mapBytes);
+  shm_unlink(_name.c_str());
+  _header = nullptr;
+  _map = nullptr;
+}
+
+/*!
+ * Copy a frame into the ring and wake the consumers.  Never waits for them.
+ * @param rec : pinned frame, which can be a proxy
+ * @param requested : published for a consumer's request, so consumers following what's shown skip it
+ * @return false if it was dropped because consumers hold every slot
+ */
+bool FrameServer::publish(const FrameRecord *rec, bool requested) {
+  if(!_header) return false;
+  Timer timer;
+  reclaimConsumers();
+
+  uint64_t size = VideoCache::getFrameBytes(rec->width, rec->height);
+  int index = size <= _header->slotBytes ? takeSlot() : -1;
+  if(index < 0) {
+    _stats.drops++;
+    __atomic_fetch_add(&_header->drops, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  // we hold the slot, so nobody reads any of it until refs is cleared
+  FrameShmSlot& slot = _header->slots[index];
+  uint8_t* data = _map + _header->dataOffset + index * _header->slotBytes;
+  memcpy(data, rec->data, size);
+  uint8_t* planes[4];
+  int linesizes[4];
+  av_image_fill_arrays(planes, linesizes, data, AV_PIX_FMT_YUV420P, rec->width, rec->height, 1);
+  for(int plane = 0; plane < 4; plane++) {
+    slot.linesize[plane] = planes[plane] ? linesizes[plane] : 0;
+    slot.offset[plane] = planes[plane] ? planes[plane] - _map : 0;
+  }
+  __atomic_store_n(&slot.frame, rec->frame, __ATOMIC_RELAXED);
+  slot.format = FRAME_SHM_YUV420P;
+  slot.width = rec->width;
+  slot.height = rec->height;
+  slot.level = rec->level;
+  slot.requested = requested;
+  slot.pts = _index && rec->frame < _index->getFrameCount() ? _index->getPts(rec->frame) : INT64_MIN;
+  slot.size = size;
+  uint64_t sequence = _header->sequence + 1;
+  __atomic_store_n(&slot.sequence, sequence, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot.refs, 0, __ATOMIC_RELEASE);
+
+  __atomic_store_n(&_header->sequence, sequence, __ATOMIC_RELEASE);
+  if(!requested) __atomic_store_n(&_header->latestSlot, index, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&_header->published, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &_header->published, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+
+  if(requested) _stats.requests++;
+  else _stats.published++;
+  _stats.maxPublishMs = std::max(_stats.maxPublishMs, timer.getMs());
+  return true;
+}
+
+/*!
+ * Publish the frames consumers have asked for which aren't in the ring, if the cache has them at full
+ * resolution.  They're pinned without counting as hits or being moved up the use list, so what external
+ * tools ask for doesn't change the analytics or what the cache cleans.
+ */
+void FrameServer::serveRequests(VideoCache &cache) {
+  if(!_header) return;
+  for(auto& consumer : _header->consumers) {
+    if(!__atomic_load_n(&consumer.pid, __ATOMIC_ACQUIRE)) continue;
+    int frame = __atomic_load_n(&consumer.requestedFrame, __ATOMIC_ACQUIRE);
+    if(frame < 0 || hasFrame(frame)) continue;
+    if(FrameRecord* rec = cache.pinFrame(frame)) {
+      publish(rec, true);
+      cache.releaseFrame(rec);
+    }
+  }
+}
+
+FrameServerStats FrameServer::getStats() {
+  _stats.consumers = 0;
+  if(_header) {
+    for(auto& consumer : _header->consumers) {
+      if(__atomic_load_n(&consumer.pid, __ATOMIC_ACQUIRE)) _stats.consumers++;
+    }
+  }
+  return _stats;
+}
+
+/*!
+ * Take the oldest slot nobody holds, other than the newest frame shown's
+ * @return the slot, held with FRAME_SHM_WRITER, or -1 if consumers hold all of them
+ */
+int FrameServer::takeSlot() {
+  int slots = (int)_header->slotCount;
+  int latest = __atomic_load_n(&_header->latestSlot, __ATOMIC_RELAXED);
+  for(int i = 0; i < slots; i++) {
+    int index = (_nextSlot + i) % slots;
+    if(index == latest) continue;
+    uint64_t free = 0;
+    if(__atomic_compare_exchange_n(&_header->slots[index].refs, &free, FRAME_SHM_WRITER, false,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      _nextSlot = (index + 1) % slots;
+      return index;
+    }
+  }
+  return -1;
+}
+
+/*!
+ * Check if a frame is in the ring.  The server is the only writer of the slots' frames, so it can read
+ * them without holding the slots.
+ */
+bool FrameServer::hasFrame(int frame) {
+  for(uint32_t slot = 0; slot < _header->slotCount; slot++) {
+    if(_header->slots[slot].frame == frame && _header->slots[slot].sequence) return true;
+  }
+  return false;
+}
+
+/*!
+ * Take back the slots and the entries of consumers which exited without detaching
+ */
+void FrameServer::reclaimConsumers() {
+  if(_reclaimClock.getSeconds() < reclaimSeconds) return;
+  _reclaimClock.start();
+  for(int i = 0; i < FRAME_SHM_MAX_CONSUMERS; i++) {
+    FrameShmConsumer& consumer = _header->consumers[i];
+    int pid = __atomic_load_n(&consumer.pid, __ATOMIC_ACQUIRE);
+    if(!pid || kill(pid, 0) == 0 || errno != ESRCH) continue;
+
+    for(uint32_t slot = 0; slot < _header->slotCount; slot++) {
+      __atomic_fetch_and(&_header->slots[slot].refs, ~(1ull << i), __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&consumer.requestedFrame, -1, __ATOMIC_RELAXED);
+    __atomic_store_n(&consumer.pid, 0, __ATOMIC_RELEASE);
+    _stats.reclaimed++;
+  }
+}
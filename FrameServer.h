@@ -0,0 +1,65 @@
+#ifndef VIDEOPLAYER_FRAMESERVER_H
+#define VIDEOPLAYER_FRAMESERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "FrameShm.h"
+#include "PacketIndex.h"
+#include "Timer.h"
+#include "VideoCache.h"
+
+struct FrameServerStats {
+  uint64_t published = 0;  // frames shown which were published
+  uint64_t requests = 0;   // frames published for a consumer's request
+  uint64_t drops = 0;      // frames not published because every slot was held
+  uint64_t reclaimed = 0;  // consumers which died attached, whose slots were taken back
+  int consumers = 0;
+  double maxPublishMs = 0;
+};
+
+/*!
+ * Publishes the frames a stream shows into POSIX shared memory, so other processes on the machine, such
+ * as scopes and detectors, can read them without decoding the video again.  FrameShm.h has the layout,
+ * and FrameClient.h the C API clients use.
+ *
+ * The shared memory is a ring of slots, each big enough for a frame at the source's size.  Publishing
+ * copies a frame into the oldest slot no consumer holds, which is the one copy made: consumers read the
+ * frames where they are, holding the slot until they release it.  If consumers hold every slot the frame
+ * is dropped, so a slow consumer never holds up playback.  The slot of the newest frame shown is never
+ * reused while it's the newest.
+ *
+ * A consumer asks for a frame which isn't in the ring by setting its request, and serveRequests()
+ * publishes it from the cache if it's there.  Nothing is decoded for a request.
+ *
+ * Only used from the render thread.
+ */
+class FrameServer {
+public:
+  FrameServer() = default;
+  ~FrameServer();
+  bool open(const std::string& name, int slots, uint64_t slotBytes, PacketIndex* index, int timeBaseNum,
+            int timeBaseDen);
+  void close();
+  bool isOpen() { return _header != nullptr; }
+  bool publish(const FrameRecord* rec, bool requested = false);
+  void serveRequests(VideoCache& cache);
+  FrameServerStats getStats();
+
+  const std::string& getName() { return _name; }
+
+private:
+  int takeSlot();
+  bool hasFrame(int frame);
+  void reclaimConsumers();
+
+  std::string _name;
+  FrameShmHeader* _header = nullptr;
+  uint8_t* _map = nullptr;
+  PacketIndex* _index = nullptr; // for the frames' pts
+  int _nextSlot = 0;             // where takeSlot() starts looking, so the oldest slots go first
+  Timer _reclaimClock;
+  FrameServerStats _stats;
+};
+
+#endif //VIDEOPLAYER_FRAMESERVER_H
@@ -0,0 +1,79 @@
+#ifndef VIDEOPLAYER_FRAMESHM_H
+#define VIDEOPLAYER_FRAMESHM_H
+
+/*
+ * Layout of the shared memory a FrameServer publishes frames into, shared by the player and the C client
+ * in FrameClient.h.  Plain C, so clients needn't be built with the player.
+ *
+ * The mapping starts with a FrameShmHeader, followed by the slots' frame data, each slot's on a page
+ * boundary at dataOffset + slot * slotBytes.  Fields which change after the server starts are only read
+ * and written with the __atomic builtins.
+ *
+ * A slot's refs word says who holds it: a bit for each consumer reading it, or FRAME_SHM_WRITER while the
+ * server fills it.  The server only takes a slot nobody holds and consumers only take one the server
+ * isn't filling, each with a compare and swap of refs, so a frame never changes under a reader and the
+ * server never waits for one.  Holding bits rather than a count lets the server take back the slots of a
+ * consumer which died holding them.
+ */
+
+#include <stdint.h>
+
+#define FRAME_SHM_MAGIC 0x52465056u   /* "VPFR" */
+#define FRAME_SHM_VERSION 1
+#define FRAME_SHM_MAX_CONSUMERS 63
+#define FRAME_SHM_WRITER (1ull << 63)
+
+/* pixel formats, in FrameShmSlot::format */
+#define FRAME_SHM_YUV420P 0           /* 8 bit planar Y, then U and V at half the width and height */
+
+/*
+ * A client attached to the server.  A client takes a free entry by setting pid, and its index is its bit
+ * in the slots' refs.
+ */
+typedef struct {
+  int32_t pid;            /* 0 if the entry is free */
+  int32_t requestedFrame; /* frame the client is waiting for which isn't in the ring, -1 for none */
+  uint64_t acquired;      /* frames the client has taken */
+} FrameShmConsumer;
+
+/*
+ * A published frame.  Everything but refs is only written while the server holds the slot.
+ */
+typedef struct {
+  uint64_t refs;          /* consumer bits, or FRAME_SHM_WRITER */
+  uint64_t sequence;      /* publish number of the frame in the slot, 0 while it's empty */
+  int32_t frame;
+  int32_t format;         /* FRAME_SHM_YUV420P */
+  int32_t width;
+  int32_t height;
+  int32_t level;          /* 0 for full resolution, otherwise the proxy level the player showed */
+  int32_t requested;      /* published for a consumer's request rather than shown */
+  int64_t pts;            /* in timeBaseNum / timeBaseDen seconds, INT64_MIN if unknown */
+  int32_t linesize[4];
+  uint64_t offset[4];     /* of each plane from the start of the mapping, 0 if there isn't one */
+  uint64_t size;          /* bytes of frame data */
+} FrameShmSlot;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slotCount;
+  uint32_t published;     /* bumped on every publish, consumers wait on it as a futex */
+  uint64_t slotBytes;     /* frame data each slot can hold */
+  uint64_t dataOffset;    /* of the first slot's frame data */
+  uint64_t mapBytes;      /* size of the whole mapping */
+  int32_t serverPid;
+  int32_t timeBaseNum;
+  int32_t timeBaseDen;
+  int32_t latestSlot;     /* slot of the last frame shown, -1 before the first */
+  uint64_t sequence;      /* last publish number */
+  uint64_t drops;         /* frames not published because every slot was held */
+  FrameShmConsumer consumers[FRAME_SHM_MAX_CONSUMERS];
+  FrameShmSlot slots[1];  /* slotCount of them */
+} FrameShmHeader;
+
+/* bytes of header for a number of slots */
+#define FRAME_SHM_HEADER_BYTES(slotCount) \
+  (sizeof(FrameShmHeader) + ((slotCount) - 1) * sizeof(FrameShmSlot))
+
+#endif /* VIDEOPLAYER_FRAMESHM_H */
@@ -0,0 +1,330 @@
+#include "GopWorkers.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+
+// GOPs behind the direction we were last going count as this much further away
+static const int behindWeight = 2;
+
+// GOPs which jumps would land in count as this far away, as a part of the jump distance
+static const int jumpPriorityDivisor = 4;
+
+GopWorkers::~GopWorkers() {
+  stop();
+}
+
+/*!
+ * Add a video for the workers to fill the cache of.  Streams must be added before start().
+ * @param fileName : video to decode
+ * @param cache : cache to fill
+ * @param packetCache : packet cache the workers share for this video, or null
+ * @return the stream's number, for setCenter() and setWeight()
+ */
+int GopWorkers::addStream(const std::string &fileName, VideoCache &cache, PacketCache *packetCache) {
+  auto stream = std::unique_ptr<Stream>(new Stream());
+  stream->fileName = fileName;
+  stream->cache = &cache;
+  stream->packetCache = packetCache;
+  _streams.push_back(std::move(stream));
+  return (int)_streams.size() - 1;
+}
+
+/*!
+ * Open a decoder for each worker on each stream and start them
+ * @param workers : number of threads
+ * @return false if no stream has an index to find GOPs with
+ */
+bool GopWorkers::start(int workers) {
+  _decoders.resize(workers);
+  for(auto& decoders : _decoders) decoders.resize(_streams.size());
+
+  bool anyIndexed = false;
+  for(size_t i = 0; i < _streams.size(); i++) {
+    Stream& stream = *_streams[i];
+    for(int worker = 0; worker < workers; worker++) {
+      auto decoder = std::unique_ptr<VideoDecoder>(new VideoDecoder(stream.fileName, *stream.cache));
+      decoder->setPacketCache(stream.packetCache);
+      decoder->setReadMode(_readMode);
+      if(!decoder->open() || !decoder->getIndex().isLoaded()) {
+        printf("gop workers need the packet index, not filling %s\n", stream.fileName.c_str());
+        for(auto& decoders : _decoders) decoders[i].reset();
+        break;
+      }
+      _decoders[worker][i] = std::move(decoder);
+    }
+    if(_decoders[0][i]) {
+      stream.index = &_decoders[0][i]->getIndex();
+      anyIndexed = true;
+    }
+  }
+  if(!anyIndexed) {
+    _decoders.clear();
+    return false;
+  }
+
+  _running = true;
+  for(int worker = 0; worker < workers; worker++) {
+    _threads.emplace_back(&GopWorkers::workLoop, this, worker);
+  }
+  return true;
+}
+
+/*!
+ * Stop the workers.  Each finishes the GOP it's working on first.
+ */
+void GopWorkers::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _running = false;
+    for(auto& stream : _streams) {
+      stream->queue.clear();
+      stream->index = nullptr;
+    }
+  }
+  _cv.notify_all();
+  for(auto& thread : _threads) {
+    thread.join();
+  }
+  _threads.clear();
+  _decoders.clear();
+}
+
+/*!
+ * Fill a stream's cache around a frame.  The work is only planned again once the frame is a quarter of
+ * the radius away from where it was last planned, or the direction changes, so this can be called every
+ * display frame.
+ * @param frame : frame to fill around, normally the playhead
+ * @param radius : number of frames to fill on each side
+ * @param direction : 1 or -1 for the way the user was last going, whose side is filled first, 0 for neither
+ */
+void GopWorkers::setCenter(int stream, int frame, int radius, int direction) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Stream& s = *_streams[stream];
+    if(!s.index) return;
+    if(s.center >= 0 && radius == s.radius && direction == s.direction &&
+       abs(frame - s.center) < std::max(1, radius / 4)) return;
+    s.center = frame;
+    s.radius = radius;
+    s.direction = direction;
+
+    // every GOP overlapping the range, by how far its nearest frame is from the center
+    PacketIndex& index = *s.index;
+    int first = std::max(0, frame - radius);
+    int last = std::min(frame + radius, index.getFrameCount() - 1);
+    std::map<int, int> distances; // keyframe, distance
+    for(int keyframe = std::max(0, index.getKeyframeBefore(first)); keyframe >= 0 && keyframe <= last;
+        keyframe = index.getKeyframeAfter(keyframe)) {
+      int end = index.getKeyframeAfter(keyframe);
+      if(end < 0) end = index.getFrameCount();
+      int distance = frame < keyframe ? keyframe - frame : (frame >= end ? frame - end + 1 : 0);
+      bool behind = direction > 0 ? end <= frame : direction < 0 && keyframe > frame;
+      distances[keyframe] = behind ? distance * behindWeight : distance;
+    }
+
+    // where a jump either way would land, just after the nearest GOPs
+    for(int jump = -1; _jumpDistance && jump <= 1; jump += 2) {
+      int target = frame + jump * _jumpDistance;
+      if(target < 0 || target >= index.getFrameCount()) continue;
+      int keyframe = index.getKeyframeBefore(target);
+      if(keyframe < 0) continue;
+      int distance = _jumpDistance / jumpPriorityDivisor;
+      auto planned = distances.find(keyframe);
+      if(planned == distances.end() || planned->second > distance) distances[keyframe] = distance;
+    }
+
+    std::vector<std::pair<int, int>> gops; // distance, keyframe
+    for(auto& gop : distances) {
+      gops.emplace_back(gop.second, gop.first);
+    }
+    std::stable_sort(gops.begin(), gops.end());
+    s.queue.assign(gops.begin(), gops.end());
+  }
+  _cv.notify_all();
+}
+
+/*!
+ * Hold the workers off while something more important needs the cores, such as the player's own
+ * decoding falling behind.  Pausing stops the GOPs being decoded at their next frame.
+ */
+void GopWorkers::setPaused(bool paused) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(paused == _paused) return;
+    _paused = paused;
+    if(paused) interrupt();
+  }
+  _cv.notify_all();
+}
+
+/*!
+ * Drop the work planned, and stop the GOPs being decoded at their next frame, because the user did
+ * something.  Nothing more is decoded until setCenter() plans again around the new position.
+ */
+void GopWorkers::preempt() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for(auto& stream : _streams) {
+    stream->queue.clear();
+  }
+  interrupt();
+}
+
+/*!
+ * Stop the GOPs being decoded, and plan again on the next setCenter().  Must hold the lock.
+ */
+void GopWorkers::interrupt() {
+  _epoch++;
+  for(auto& stream : _streams) {
+    stream->center = -1;
+  }
+}
+
+/*!
+ * Set how much of the pool a stream gets compared to the others
+ * @param weight : GOP distances are divided by this, more than 0
+ */
+void GopWorkers::setWeight(int stream, double weight) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _streams[stream]->weight = weight;
+}
+
+/*!
+ * Change the size a stream's frames are decoded at.  Each worker applies it to its own decoder when it
+ * next takes a GOP of the stream, and the GOPs being decoded at the old size are stopped.
+ */
+void GopWorkers::setOutputSize(int stream, int width, int height) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  Stream& s = *_streams[stream];
+  if(width == s.width && height == s.height) return;
+  s.width = width;
+  s.height = height;
+  interrupt();
+}
+
+/*!
+ * Check if the workers have finished everything they were given
+ */
+bool GopWorkers::isIdle() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for(auto& stream : _streams) {
+    if(!stream->queue.empty()) return false;
+  }
+  return _busy == 0;
+}
+
+uint64_t GopWorkers::getGopsDecoded() {
+  uint64_t gops = 0;
+  for(auto& stream : _streams) gops += stream->gopsDecoded;
+  return gops;
+}
+
+/*!
+ * Frames the workers have decoded for a stream, across all their decoders
+ */
+uint64_t GopWorkers::getDecodedFrames(int stream) {
+  uint64_t frames = 0;
+  for(auto& decoders : _decoders) {
+    if(decoders[stream]) frames += decoders[stream]->getDecodedFrames();
+  }
+  return frames;
+}
+
+/*!
+ * Time the workers have spent decoding a stream's frames, across all their decoders
+ */
+uint64_t GopWorkers::getDecodeNs(int stream) {
+  uint64_t ns = 0;
+  for(auto& decoders : _decoders) {
+    if(decoders[stream]) ns += decoders[stream]->getDecodeNs();
+  }
+  return ns;
+}
+
+/*!
+ * Time the workers have spent waiting on reads of a stream's file, across all their decoders
+ */
+uint64_t GopWorkers::getIoWaitNs(int stream) {
+  uint64_t ns = 0;
+  for(auto& decoders : _decoders) {
+    if(decoders[stream]) ns += decoders[stream]->getIoWaitNs();
+  }
+  return ns;
+}
+
+/*!
+ * Take the nearest GOP, by weighted distance, from the stream queues.  Must hold the lock.
+ * @param keyframe : set to the GOP's keyframe
+ * @return the stream it's from, or -1 if there's nothing to do
+ */
+int GopWorkers::takeGop(int &keyframe) {
+  int best = -1;
+  double bestDistance = 0;
+  for(size_t i = 0; i < _streams.size(); i++) {
+    Stream& stream = *_streams[i];
+    if(stream.queue.empty()) continue;
+    double distance = stream.queue.front().first / stream.weight;
+    if(best < 0 || distance < bestDistance) {
+      best = (int)i;
+      bestDistance = distance;
+    }
+  }
+  if(best < 0 || _paused) return -1;
+
+  keyframe = _streams[best]->queue.front().second;
+  _streams[best]->queue.pop_front();
+  return best;
+}
+
+/*!
+ * Main loop of a worker thread.  Takes the nearest GOP which hasn't been taken yet and decodes it, while
+ * the stream's next GOP is read ahead for whichever worker takes it.
+ */
+void GopWorkers::workLoop(int worker) {
+  TRACE_THREAD("gop worker");
+  std::unique_lock<std::mutex> lock(_mutex);
+  while(true) {
+    int keyframe = 0;
+    int stream = -1;
+    while(_running && (stream = takeGop(keyframe)) < 0) _cv.wait(lock);
+    if(!_running) return;
+    _busy++;
+    uint32_t epoch = _epoch;
+    int nextKeyframe = _streams[stream]->queue.empty() ? -1 : _streams[stream]->queue.front().second;
+    int width = _streams[stream]->width;
+    int height = _streams[stream]->height;
+
+    lock.unlock();
+    VideoDecoder& decoder = *_decoders[worker][stream];
+    decoder.setOutputSize(width, height);
+    if(nextKeyframe >= 0) decoder.prefetch(nextKeyframe);
+    decodeGop(*_streams[stream], decoder, keyframe, epoch);
+    lock.lock();
+
+    _busy--;
+  }
+}
+
+/*!
+ * Decode a GOP from its keyframe, as far as its last frame which isn't cached yet, once any stale frames
+ * in it are scaled to the output size.  Stops early if the workers are paused or preempted.
+ * @param epoch : _epoch when the GOP was taken
+ */
+void GopWorkers::decodeGop(Stream &stream, VideoDecoder &decoder, int keyframe, uint32_t epoch) {
+  PacketIndex& index = decoder.getIndex();
+  int end = index.getKeyframeAfter(keyframe);
+  if(end < 0) end = index.getFrameCount();
+  stream.cache->rescaleStale(keyframe, end - 1);
+
+  int last = end - 1;
+  while(last >= keyframe && stream.cache->hasFrame(last)) last--;
+  if(last < keyframe) return;
+
+  for(int frame = keyframe; frame <= last; frame++) {
+    if(_epoch != epoch) return;
+    decoder.seekTo(frame);
+    if(decoder.getCurrentFrame() != frame) break;
+  }
+  stream.gopsDecoded++;
+}
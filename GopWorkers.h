@@ -0,0 +1,97 @@
+#ifndef VIDEOPLAYER_GOPWORKERS_H
+#define VIDEOPLAYER_GOPWORKERS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "PacketCache.h"
+#include "VideoCache.h"
+#include "VideoDecoder.h"
+
+/*!
+ * Pool of decode threads which fill the cache around a position, one GOP per thread at a time.
+ * Each worker has its own VideoDecoder, so its own demuxer and codec context on the same file, and GOPs
+ * are independent, so workers decode them in parallel.  GOPs nearest the position are decoded first.
+ * Workers need the packet index to find the GOPs.
+ *
+ * GOPs on the side the user was last going are taken first, then the GOPs of the frames a jump would
+ * land on, then the rest of the range.  Workers only fill the cache in time nothing else needs: the
+ * player pauses them while its own decoding is behind, and any input preempts them, stopping the GOPs
+ * being decoded at the next frame until the work is planned again around the new position.
+ *
+ * The pool is shared by every video being played.  Each worker has a decoder for each stream, and takes
+ * the nearest GOP of whichever stream has the nearest one once distances are divided by the stream's
+ * weight, so a stream with twice the weight is filled twice as far out in the same time.
+ *
+ * After the output size changes, a GOP's stale frames are scaled to the new size before anything in it
+ * is decoded, so the cache is rebuilt from the playhead out.
+ */
+class GopWorkers {
+public:
+  GopWorkers() = default;
+  ~GopWorkers();
+  int addStream(const std::string& fileName, VideoCache& cache, PacketCache* packetCache);
+  void setReadMode(FileReadMode readMode) { _readMode = readMode; }
+  bool start(int workers);
+  void stop();
+  void setCenter(int stream, int frame, int radius, int direction = 0);
+  void setJumpDistance(int frames) { _jumpDistance = frames; }
+  void setPaused(bool paused);
+  void preempt();
+  void setWeight(int stream, double weight);
+  void setOutputSize(int stream, int width, int height);
+  bool isIdle();
+
+  int getWorkerCount() { return (int)_threads.size(); }
+  uint64_t getGopsDecoded();
+  uint64_t getGopsDecoded(int stream) { return _streams[stream]->gopsDecoded; }
+  uint64_t getDecodedFrames(int stream);
+  uint64_t getDecodeNs(int stream);
+  uint64_t getIoWaitNs(int stream);
+
+private:
+  /*!
+   * A video the workers fill the cache of
+   */
+  struct Stream {
+    std::string fileName;
+    VideoCache* cache;
+    PacketCache* packetCache;
+    PacketIndex* index = nullptr; // first worker's, null if the stream has none and gets no work
+    std::deque<std::pair<int, int>> queue; // distance, keyframe of the GOPs to decode, nearest first
+    int center = -1;              // position the queue was planned around, -1 to plan again
+    int radius = 0;
+    int direction = 0;
+    double weight = 1;
+    int width = 0;                // output size, 0 for the source's
+    int height = 0;
+    std::atomic<uint64_t> gopsDecoded{0};
+  };
+
+  void workLoop(int worker);
+  int takeGop(int& keyframe);
+  void interrupt();
+  void decodeGop(Stream& stream, VideoDecoder& decoder, int keyframe, uint32_t epoch);
+
+  std::vector<std::unique_ptr<Stream>> _streams;
+  std::vector<std::vector<std::unique_ptr<VideoDecoder>>> _decoders; // for each worker, one per stream
+  std::vector<std::thread> _threads;
+  FileReadMode _readMode = READ_MMAP;
+
+  // protected by _mutex, along with each stream's queue, center, radius, direction, weight and size
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  int _busy = 0;          // workers decoding a GOP
+  bool _running = false;
+  bool _paused = false;
+  int _jumpDistance = 0;  // frames a jump moves the playhead, 0 if there are no jumps to plan for
+
+  std::atomic<uint32_t> _epoch{0}; // bumped to stop the GOPs being decoded
+};
+
+#endif //VIDEOPLAYER_GOPWORKERS_H
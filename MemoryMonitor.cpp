@@ -0,0 +1,258 @@
+#include "MemoryMonitor.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+
+// the trigger fires when tasks stall on memory for this long within the window, in microseconds.
+// Unprivileged triggers need a window which is a multiple of 2 seconds.
+static const char* psiTrigger = "some 150000 2000000";
+
+// "some" avg10 percentages: at or above high is pressure, below low is calm
+static const double highAvg10 = 10;
+static const double lowAvg10 = 1;
+
+// seconds of calm before the budget grows again
+static const int calmSeconds = 5;
+
+// the budget isn't cut below this
+static const uint64_t minBudget = 128l * 1024 * 1024;
+
+// at start the budget takes at most this much of the cgroup's headroom
+static const double headroomShare = 0.75;
+
+// the cgroup counts as close to its limit with less than this left
+static const int64_t minHeadroom = 64l * 1024 * 1024;
+
+MemoryMonitor::~MemoryMonitor() {
+  stop();
+}
+
+/*!
+ * Cap the budget to the cgroup's headroom and start watching pressure
+ * @param maxBytes : budget asked for, which is never grown past
+ * @param psiFile : stand-in for the PSI source, empty for the kernel's
+ */
+void MemoryMonitor::start(uint64_t maxBytes, const std::string &psiFile) {
+  uint64_t target = maxBytes;
+  int64_t cgroupMax, cgroupCurrent, cgroupFile;
+  if(readCgroup(cgroupMax, cgroupCurrent, cgroupFile) && cgroupMax > 0) {
+    int64_t headroom = std::max<int64_t>(0, getHeadroom(cgroupMax, cgroupCurrent, cgroupFile));
+    target = std::min<uint64_t>(target, std::max<uint64_t>(minBudget, (uint64_t)(headroom * headroomShare)));
+    printf("cgroup memory.max %.0f MB, %.0f MB in use and %.0f MB of page cache: cache budget %.0f of %.0f MB\n",
+           cgroupMax / (1024. * 1024.), (cgroupCurrent - cgroupFile) / (1024. * 1024.), cgroupFile / (1024. * 1024.),
+           target / (1024. * 1024.), maxBytes / (1024. * 1024.));
+  }
+  _targetBytes = target;
+
+  _simulated = !psiFile.empty();
+  _psiFile = psiFile;
+  if(!_simulated) {
+    std::string cgroupPressure = getCgroupDir() + "/memory.pressure";
+    if(openTrigger(cgroupPressure)) _psiFile = cgroupPressure;
+    else if(openTrigger("/proc/pressure/memory")) _psiFile = "/proc/pressure/memory";
+    else if(FILE* file = fopen("/proc/pressure/memory", "r")) {
+      // no trigger, but the averages are still there to poll
+      fclose(file);
+      _psiFile = "/proc/pressure/memory";
+    } else {
+      printf("no memory pressure information, only the cgroup limit is watched\n");
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.maxBytes = maxBytes;
+  _stats.targetBytes = target;
+  _stats.cgroupMax = cgroupMax;
+  _stats.cgroupCurrent = cgroupCurrent;
+  _stats.cgroupFile = cgroupFile;
+  _stats.minTargetBytes = target;
+  _running = true;
+  _thread = std::thread(&MemoryMonitor::monitorLoop, this);
+}
+
+void MemoryMonitor::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _running = false;
+  }
+  _cv.notify_all();
+  if(_thread.joinable()) _thread.join();
+  if(_triggerFd >= 0) close(_triggerFd);
+  _triggerFd = -1;
+}
+
+MemoryMonitorStats MemoryMonitor::getStats() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+/*!
+ * Directory of our cgroup in the cgroup v2 hierarchy, empty if we aren't in one
+ */
+std::string MemoryMonitor::getCgroupDir() {
+  FILE* file = fopen("/proc/self/cgroup", "r");
+  if(!file) return "";
+  char line[4096];
+  std::string dir;
+  while(fgets(line, sizeof(line), file)) {
+    if(strncmp(line, "0::", 3)) continue;
+    line[strcspn(line, "\n")] = 0;
+    dir = std::string("/sys/fs/cgroup") + (line + 3);
+    break;
+  }
+  fclose(file);
+  return dir;
+}
+
+/*!
+ * Read our cgroup's memory.max and memory.current, and how much of the latter is clean page cache
+ * @param max : set to the limit in bytes, -1 if there is none
+ * @param file : set to the page cache which isn't dirty or being written back, from memory.stat
+ * @return false if we aren't in a cgroup v2 with the memory controller
+ */
+bool MemoryMonitor::readCgroup(int64_t &max, int64_t &current, int64_t &file) {
+  max = -1;
+  current = 0;
+  file = 0;
+  std::string dir = getCgroupDir();
+  if(dir.empty()) return false;
+
+  char value[64] = {};
+  FILE* in = fopen((dir + "/memory.max").c_str(), "r");
+  if(!in) return false;
+  bool read = fscanf(in, "%63s", value) == 1;
+  fclose(in);
+  if(!read) return false;
+  if(strcmp(value, "max")) max = atoll(value);
+
+  in = fopen((dir + "/memory.current").c_str(), "r");
+  if(!in) return false;
+  read = fscanf(in, "%ld", &current) == 1;
+  fclose(in);
+  if(!read) return false;
+
+  // without memory.stat all of it counts as in use, which is only cautious
+  in = fopen((dir + "/memory.stat").c_str(), "r");
+  if(!in) return true;
+  int64_t total = 0, dirty = 0, writeback = 0;
+  char line[256];
+  while(fgets(line, sizeof(line), in)) {
+    sscanf(line, "file %ld", &total);
+    sscanf(line, "file_dirty %ld", &dirty);
+    sscanf(line, "file_writeback %ld", &writeback);
+  }
+  fclose(in);
+  file = std::min(current, std::max<int64_t>(0, total - dirty - writeback));
+  return true;
+}
+
+/*!
+ * Register a PSI trigger, which makes the file poll with POLLPRI when it fires
+ */
+bool MemoryMonitor::openTrigger(const std::string &path) {
+  int fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+  if(fd < 0) return false;
+  if(write(fd, psiTrigger, strlen(psiTrigger) + 1) < 0) {
+    close(fd);
+    return false;
+  }
+  _triggerFd = fd;
+  return true;
+}
+
+/*!
+ * Read the "some" avg10 percentage from the PSI source, 0 if there isn't one
+ */
+double MemoryMonitor::readAvg10() {
+  if(_psiFile.empty()) return 0;
+  FILE* file = fopen(_psiFile.c_str(), "r");
+  if(!file) return 0;
+  double avg10 = 0;
+  char line[256];
+  while(fgets(line, sizeof(line), file)) {
+    if(sscanf(line, "some avg10=%lf", &avg10) == 1) break;
+  }
+  fclose(file);
+  return avg10;
+}
+
+/*!
+ * Move the target budget and log why
+ */
+void MemoryMonitor::setTarget(uint64_t bytes, const char *reason) {
+  uint64_t old = _targetBytes;
+  if(bytes == old) return;
+  _targetBytes = bytes;
+  printf("%s: cache budget %.0f -> %.0f MB\n", reason, old / (1024. * 1024.), bytes / (1024. * 1024.));
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.targetBytes = bytes;
+  _stats.minTargetBytes = std::min(_stats.minTargetBytes, bytes);
+  if(bytes < old) _stats.shrinks++;
+  else _stats.grows++;
+}
+
+/*!
+ * Main loop of the monitor thread.  Waits up to a second for the trigger, then looks at the averages
+ * and the cgroup and moves the budget.
+ */
+void MemoryMonitor::monitorLoop() {
+  TRACE_THREAD("memory monitor");
+  int calm = 0;
+  while(true) {
+    bool triggered = false;
+    if(_triggerFd >= 0) {
+      struct pollfd fd = {_triggerFd, POLLPRI, 0};
+      triggered = poll(&fd, 1, 1000) > 0 && (fd.revents & POLLPRI);
+      if(fd.revents & POLLERR) {
+        // the file went away, carry on with the averages
+        close(_triggerFd);
+        _triggerFd = -1;
+      }
+    }
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if(_triggerFd < 0) _cv.wait_for(lock, std::chrono::seconds(1), [this] { return !_running; });
+      if(!_running) return;
+    }
+
+    double avg10 = readAvg10();
+    int64_t cgroupMax, cgroupCurrent, cgroupFile;
+    readCgroup(cgroupMax, cgroupCurrent, cgroupFile);
+    int64_t headroom = getHeadroom(cgroupMax, cgroupCurrent, cgroupFile);
+    bool nearLimit = cgroupMax > 0 && headroom < minHeadroom;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stats.avg10 = avg10;
+      _stats.cgroupMax = cgroupMax;
+      _stats.cgroupCurrent = cgroupCurrent;
+      _stats.cgroupFile = cgroupFile;
+      if(triggered) _stats.triggers++;
+    }
+
+    uint64_t target = _targetBytes;
+    uint64_t maxBytes = getStats().maxBytes;
+    if(triggered || avg10 >= highAvg10 || nearLimit) {
+      calm = 0;
+      char reason[128];
+      snprintf(reason, sizeof(reason), "memory pressure (%s, some avg10 %.2f%%)",
+               triggered ? "trigger" : nearLimit ? "near cgroup limit" : "average", avg10);
+      setTarget(std::max(std::min(minBudget, maxBytes), target - target / 4), reason);
+      continue;
+    }
+
+    calm = avg10 < lowAvg10 ? calm + 1 : 0;
+    if(calm >= calmSeconds && target < maxBytes) {
+      // don't grow into the last of the cgroup's headroom
+      uint64_t grown = std::min(maxBytes, target + maxBytes / 8);
+      if(cgroupMax > 0) grown = std::min<uint64_t>(grown, target + std::max<int64_t>(0, headroom - minHeadroom));
+      setTarget(grown, "memory pressure cleared");
+      calm = 0;
+    }
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef VIDEOPLAYER_MEMORYMONITOR_H
+#define VIDEOPLAYER_MEMORYMONITOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct MemoryMonitorStats {
+  uint64_t targetBytes = 0;    // cache budget the player should move to
+  uint64_t maxBytes = 0;       // budget we were started with, never grown past
+  int64_t cgroupMax = -1;      // memory.max of our cgroup, -1 if there's no limit or no cgroup v2
+  int64_t cgroupCurrent = 0;   // memory.current of our cgroup
+  int64_t cgroupFile = 0;      // clean page cache in memory.current, which the kernel reclaims before it has to
+  uint64_t minTargetBytes = 0; // lowest the budget has been
+  double avg10 = 0;            // "some" stall percentage over the last 10 seconds
+  uint64_t triggers = 0;       // PSI trigger events
+  uint64_t shrinks = 0;
+  uint64_t grows = 0;
+};
+
+/*!
+ * Works out how big the cache budget can safely be from the cgroup's memory limits and the kernel's
+ * memory pressure stall information (PSI), so a cache sized for a workstation doesn't get the player
+ * OOM-killed in a container.
+ *
+ * The cgroup's headroom doesn't count clean page cache as used.  The player reads through the video and
+ * writes the spill file, so memory.current climbs to the limit by design, but the kernel drops that page
+ * cache before it has to stall anyone.
+ *
+ * At start the budget is capped to part of the cgroup's headroom.  A thread then watches pressure: a PSI
+ * trigger on memory.pressure, or /proc/pressure/memory outside of a cgroup, wakes it as soon as tasks
+ * stall on memory, and the 10 second average is read every second.  Under pressure, or when the cgroup
+ * is close to its limit, the budget is cut by a quarter each second down to a floor.  Once pressure has
+ * been low for a while it grows back an eighth at a time, up to where it started.
+ *
+ * A file can stand in for the PSI source, in the same format, to try it without real pressure.  The
+ * player applies the budget a step at a time, so a cut never cleans more in one frame than it can take.
+ */
+class MemoryMonitor {
+public:
+  MemoryMonitor() = default;
+  ~MemoryMonitor();
+  void start(uint64_t maxBytes, const std::string& psiFile);
+  void stop();
+
+  uint64_t getTargetBytes() { return _targetBytes; }
+  MemoryMonitorStats getStats();
+  static bool readCgroup(int64_t& max, int64_t& current, int64_t& file);
+  static int64_t getHeadroom(int64_t max, int64_t current, int64_t file) { return max - (current - file); }
+
+private:
+  static std::string getCgroupDir();
+  bool openTrigger(const std::string& path);
+  double readAvg10();
+  void monitorLoop();
+  void setTarget(uint64_t bytes, const char* reason);
+
+  std::string _psiFile;        // read for the averages
+  bool _simulated = false;     // _psiFile isn't the kernel's, so it has no trigger
+  int _triggerFd = -1;
+  std::atomic<uint64_t> _targetBytes{0};
+
+  // protected by _mutex
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _running = false;
+  std::thread _thread;
+  MemoryMonitorStats _stats;
+};
+
+#endif //VIDEOPLAYER_MEMORYMONITOR_H
@@ -0,0 +1,93 @@
+#include "PacketCache.h"
+
+PacketGop::~PacketGop() {
+  for(auto* packet : packets) {
+    av_packet_free(&packet);
+  }
+}
+
+/*!
+ * Add a complete GOP, cleaning the least recently used GOPs if that puts us over budget
+ */
+void PacketCache::addGop(std::shared_ptr<PacketGop> gop) {
+  std::vector<std::shared_ptr<PacketGop>> cleaned;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_gopMap.find(gop->keyframe) != _gopMap.end()) return;
+
+    _totalMemUse += sizeof(PacketGop) + gop->size;
+    pushNewest(gop.get());
+    _gopMap[gop->keyframe] = gop;
+    _stats.inserts++;
+
+    // never clean the GOP we just added, even if it alone is over budget
+    while(_totalMemUse > _maxMemory && _oldest != gop.get()) {
+      PacketGop* oldest = _oldest;
+      unlink(oldest);
+      _totalMemUse -= sizeof(PacketGop) + oldest->size;
+      auto kv = _gopMap.find(oldest->keyframe);
+      cleaned.push_back(kv->second);
+      _gopMap.erase(kv);
+      _stats.cleans++;
+    }
+  }
+
+  // packets are freed here, outside the lock, unless a decoder is still replaying them
+  cleaned.clear();
+}
+
+/*!
+ * Get a GOP and update its age
+ * @param keyframe : frame number of the GOP's keyframe
+ * @return the GOP, or null if it isn't cached
+ */
+std::shared_ptr<PacketGop> PacketCache::getGop(int keyframe) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto kv = _gopMap.find(keyframe);
+  if(kv == _gopMap.end()) {
+    _stats.misses++;
+    return nullptr;
+  }
+
+  _stats.hits++;
+  if(kv->second.get() != _newest) {
+    unlink(kv->second.get());
+    pushNewest(kv->second.get());
+  }
+  return kv->second;
+}
+
+bool PacketCache::hasGop(int keyframe) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _gopMap.find(keyframe) != _gopMap.end();
+}
+
+PacketCacheStats PacketCache::getStats() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+/*!
+ * Remove a GOP from the use list
+ */
+void PacketCache::unlink(PacketGop *gop) {
+  if(gop->prev) gop->prev->next = gop->next;
+  else _newest = gop->next;
+
+  if(gop->next) gop->next->prev = gop->prev;
+  else _oldest = gop->prev;
+
+  gop->prev = nullptr;
+  gop->next = nullptr;
+}
+
+/*!
+ * Put a GOP at the front of the use list
+ */
+void PacketCache::pushNewest(PacketGop *gop) {
+  gop->prev = nullptr;
+  gop->next = _newest;
+  if(_newest) _newest->prev = gop;
+  _newest = gop;
+  if(!_oldest) _oldest = gop;
+}
@@ -0,0 +1,75 @@
+#ifndef VIDEOPLAYER_PACKETCACHE_H
+#define VIDEOPLAYER_PACKETCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+};
+
+/*!
+ * The compressed packets of one GOP, in decode order, starting with its keyframe.
+ */
+struct PacketGop {
+  ~PacketGop();
+
+  int keyframe;     // frame number of the keyframe
+  int nextKeyframe; // frame number of the next GOP's keyframe, -1 if this is the last GOP
+  uint64_t size = 0;
+  std::vector<AVPacket*> packets;
+
+  // use list, like VideoCache's
+  PacketGop* prev = nullptr;
+  PacketGop* next = nullptr;
+};
+
+struct PacketCacheStats {
+  uint64_t hits = 0;    // GOPs replayed from memory
+  uint64_t misses = 0;  // GOPs which had to be read from the file
+  uint64_t inserts = 0;
+  uint64_t cleans = 0;
+};
+
+/*!
+ * Demuxed, still compressed video packets, kept by GOP so a decoder can decode any cached GOP again
+ * without seeking or reading the file.  Packets are much smaller than decoded frames, so this can hold
+ * far more of the video than the VideoCache can.
+ * GOPs are handed out as shared pointers, so a GOP which is being replayed stays valid if it is cleaned.
+ */
+class PacketCache {
+public:
+  explicit PacketCache(uint64_t maxMemory) : _maxMemory(maxMemory * 1024l * 1024l) { }
+  void addGop(std::shared_ptr<PacketGop> gop);
+  std::shared_ptr<PacketGop> getGop(int keyframe);
+  bool hasGop(int keyframe);
+  PacketCacheStats getStats();
+
+  double getMB() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _totalMemUse / (1024. * 1024.);
+  }
+
+  size_t getGopCount() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _gopMap.size();
+  }
+
+private:
+  void unlink(PacketGop* gop);
+  void pushNewest(PacketGop* gop);
+
+  std::mutex _mutex;
+  std::unordered_map<int, std::shared_ptr<PacketGop>> _gopMap; // by keyframe
+  PacketGop* _newest = nullptr;
+  PacketGop* _oldest = nullptr;
+  uint64_t _totalMemUse = 0;
+  uint64_t _maxMemory; // in bytes
+  PacketCacheStats _stats;
+};
+
+#endif //VIDEOPLAYER_PACKETCACHE_H
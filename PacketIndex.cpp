@@ -0,0 +1,252 @@
+#include "PacketIndex.h"
+#include "Timer.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+};
+
+static const char indexMagic[8] = {'V', 'P', 'I', 'D', 'X', 0, 0, 0};
+static const uint32_t indexVersion = 1;
+
+PacketIndex::~PacketIndex() {
+  clear();
+}
+
+void PacketIndex::clear() {
+  if(_map) munmap(_map, _mapSize);
+  _map = nullptr;
+  _mapSize = 0;
+  _entries = nullptr;
+  _count = 0;
+  _gopCount = 0;
+  _built.clear();
+  _keyframes.clear();
+}
+
+std::string PacketIndex::getSidecarName(const std::string &fileName) {
+  return fileName + ".vpidx";
+}
+
+/*!
+ * Load the index from its sidecar, or build it and save a new sidecar if there isn't a valid one.
+ * @param fileName : video file
+ * @param streamIndex : video stream to index
+ * @return false if the index couldn't be loaded or built
+ */
+bool PacketIndex::open(const std::string &fileName, int streamIndex) {
+  Timer timer;
+  if(load(fileName, streamIndex)) {
+    printf("loaded packet index %s: %zu packets, %zu gops in %.2f ms\n",
+           getSidecarName(fileName).c_str(), _count, _gopCount, timer.getMs());
+    return true;
+  }
+
+  if(!build(fileName, streamIndex)) {
+    printf("failed to build packet index\n");
+    return false;
+  }
+  printf("built packet index: %zu packets, %zu gops in %.2f ms\n", _count, _gopCount, _buildMs);
+
+  if(!save(fileName, streamIndex)) {
+    printf("couldn't save packet index to %s, keeping it in memory\n", getSidecarName(fileName).c_str());
+  }
+  return true;
+}
+
+/*!
+ * Build the index by demuxing (but not decoding) every packet of the stream
+ */
+bool PacketIndex::build(const std::string &fileName, int streamIndex) {
+  clear();
+  Timer timer;
+
+  AVFormatContext* context = avformat_alloc_context();
+  if(avformat_open_input(&context, fileName.c_str(), nullptr, nullptr)) {
+    return false;
+  }
+
+  if(avformat_find_stream_info(context, nullptr) < 0 || streamIndex >= (int)context->nb_streams) {
+    avformat_close_input(&context);
+    return false;
+  }
+
+  // only demux the stream we want
+  for(unsigned int i = 0; i < context->nb_streams; i++) {
+    if((int)i != streamIndex) context->streams[i]->discard = AVDISCARD_ALL;
+  }
+
+  AVPacket packet;
+  int64_t gop = -1;
+  while(av_read_frame(context, &packet) >= 0) {
+    if(packet.stream_index == streamIndex) {
+      PacketIndexEntry entry;
+      entry.pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+      entry.dts = packet.dts;
+      entry.pos = packet.pos;
+      entry.flags = 0;
+      if(packet.flags & AV_PKT_FLAG_KEY) {
+        entry.flags |= PACKET_INDEX_KEY;
+        gop++;
+      }
+      entry.gop = gop < 0 ? 0 : (uint32_t)gop;
+      _built.push_back(entry);
+    }
+    av_packet_unref(&packet);
+  }
+  avformat_close_input(&context);
+
+  // packets are demuxed in decode order, frame numbers go in display order
+  std::stable_sort(_built.begin(), _built.end(), [](const PacketIndexEntry& a, const PacketIndexEntry& b) {
+    return a.pts < b.pts;
+  });
+
+  _entries = _built.data();
+  _count = _built.size();
+  _gopCount = gop + 1;
+  findKeyframes();
+  _buildMs = timer.getMs();
+  return _count > 0;
+}
+
+/*!
+ * Write the index to the sidecar file, then map it
+ */
+bool PacketIndex::save(const std::string &fileName, int streamIndex) {
+  struct stat sourceStat;
+  if(stat(fileName.c_str(), &sourceStat)) return false;
+
+  PacketIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, indexMagic, sizeof(indexMagic));
+  header.version = indexVersion;
+  header.streamIndex = streamIndex;
+  header.sourceSize = sourceStat.st_size;
+  header.sourceMtime = sourceStat.st_mtime;
+  header.count = _count;
+  header.gopCount = _gopCount;
+
+  // write to a temporary file and rename it, so a reader never sees half an index
+  std::string sidecar = getSidecarName(fileName);
+  std::string temp = sidecar + ".tmp";
+  FILE* fp = fopen(temp.c_str(), "wb");
+  if(!fp) return false;
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(_entries, sizeof(PacketIndexEntry), _count, fp) == _count;
+  ok = (fclose(fp) == 0) && ok;
+  if(!ok || rename(temp.c_str(), sidecar.c_str())) {
+    unlink(temp.c_str());
+    return false;
+  }
+
+  // switch over to the mapped copy so we don't keep two
+  PacketIndex mapped;
+  if(mapped.load(fileName, streamIndex)) {
+    std::swap(_entries, mapped._entries);
+    std::swap(_count, mapped._count);
+    std::swap(_gopCount, mapped._gopCount);
+    std::swap(_built, mapped._built);
+    std::swap(_keyframes, mapped._keyframes);
+    std::swap(_map, mapped._map);
+    std::swap(_mapSize, mapped._mapSize);
+  }
+  return true;
+}
+
+/*!
+ * Map the sidecar file, if there is one and it matches the video
+ */
+bool PacketIndex::load(const std::string &fileName, int streamIndex) {
+  clear();
+
+  struct stat sourceStat;
+  if(stat(fileName.c_str(), &sourceStat)) return false;
+
+  int fd = ::open(getSidecarName(fileName).c_str(), O_RDONLY);
+  if(fd < 0) return false;
+
+  struct stat indexStat;
+  if(fstat(fd, &indexStat) || (size_t)indexStat.st_size < sizeof(PacketIndexHeader)) {
+    close(fd);
+    return false;
+  }
+
+  void* map = mmap(nullptr, indexStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) return false;
+
+  auto* header = (const PacketIndexHeader*)map;
+  bool valid = !memcmp(header->magic, indexMagic, sizeof(indexMagic)) &&
+               header->version == indexVersion &&
+               header->streamIndex == (uint32_t)streamIndex &&
+               header->sourceSize == (uint64_t)sourceStat.st_size &&
+               header->sourceMtime == (int64_t)sourceStat.st_mtime &&
+               header->count > 0 &&
+               sizeof(PacketIndexHeader) + header->count * sizeof(PacketIndexEntry) == (size_t)indexStat.st_size;
+  if(!valid) {
+    munmap(map, indexStat.st_size);
+    return false;
+  }
+
+  _map = map;
+  _mapSize = indexStat.st_size;
+  _entries = (const PacketIndexEntry*)((const uint8_t*)map + sizeof(PacketIndexHeader));
+  _count = header->count;
+  _gopCount = header->gopCount;
+  findKeyframes();
+  return true;
+}
+
+void PacketIndex::findKeyframes() {
+  _keyframes.clear();
+  for(size_t i = 0; i < _count; i++) {
+    if(_entries[i].flags & PACKET_INDEX_KEY) _keyframes.push_back((int)i);
+  }
+}
+
+/*!
+ * Get the frame number for a timestamp.  Timestamps between frames round down to the earlier frame.
+ */
+int PacketIndex::getFrameForPts(int64_t pts) {
+  const PacketIndexEntry* end = _entries + _count;
+  const PacketIndexEntry* it = std::upper_bound(_entries, end, pts, [](int64_t p, const PacketIndexEntry& e) {
+    return p < e.pts;
+  });
+  if(it == _entries) return 0;
+  return (int)(it - _entries) - 1;
+}
+
+/*!
+ * Get the closest keyframe at or before a frame.  Decoding from there will reach the frame.
+ * @return the keyframe, or -1 if there isn't one
+ */
+int PacketIndex::getKeyframeBefore(int frame) {
+  auto it = std::upper_bound(_keyframes.begin(), _keyframes.end(), frame);
+  if(it == _keyframes.begin()) return -1;
+  return *(--it);
+}
+
+/*!
+ * Check if a keyframe starts an open GOP: the frames just before it are decoded after it, and may refer
+ * to the GOP before.  Decoding from such a keyframe can't give those frames, and needn't give the same
+ * frames after it either, if they refer past it too.
+ */
+bool PacketIndex::hasLeadingFrames(int keyframe) {
+  return keyframe > 0 && _entries[keyframe - 1].gop == _entries[keyframe].gop;
+}
+
+/*!
+ * Get the first keyframe after a frame, which is where the frame's GOP ends
+ * @return the keyframe, or -1 if the frame is in the last GOP
+ */
+int PacketIndex::getKeyframeAfter(int frame) {
+  auto it = std::upper_bound(_keyframes.begin(), _keyframes.end(), frame);
+  if(it == _keyframes.end()) return -1;
+  return *it;
+}
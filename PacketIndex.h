@@ -0,0 +1,77 @@
+#ifndef VIDEOPLAYER_PACKETINDEX_H
+#define VIDEOPLAYER_PACKETINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define PACKET_INDEX_KEY 1
+
+/*!
+ * Index entry for one video packet.  Entries are sorted by pts, so an entry's position is its frame number.
+ */
+struct PacketIndexEntry {
+  int64_t pts;
+  int64_t dts;
+  int64_t pos;    // byte position in the file, -1 if unknown
+  uint32_t gop;   // number of keyframes before this packet in decode order, minus one
+  uint32_t flags; // PACKET_INDEX_KEY
+};
+
+/*!
+ * Header of a .vpidx sidecar file, followed by the entries.  The size and modification time of the
+ * video are stored so a stale index is rebuilt.
+ */
+struct PacketIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t streamIndex;
+  uint64_t sourceSize;
+  int64_t sourceMtime;
+  uint64_t count;
+  uint64_t gopCount;
+};
+
+/*!
+ * Index of every packet in a video stream, built with a single demux pass and saved next to the video
+ * as <video>.vpidx.  Later opens memory map the sidecar instead of reading the file again.
+ */
+class PacketIndex {
+public:
+  PacketIndex() = default;
+  ~PacketIndex();
+  bool open(const std::string& fileName, int streamIndex);
+  bool build(const std::string& fileName, int streamIndex);
+  bool load(const std::string& fileName, int streamIndex);
+  bool save(const std::string& fileName, int streamIndex);
+
+  bool isLoaded() { return _count > 0; }
+  int getFrameCount() { return (int)_count; }
+  int getGopCount() { return (int)_gopCount; }
+  int64_t getPts(int frame) { return _entries[frame].pts; }
+  int64_t getPos(int frame) { return _entries[frame].pos; }
+  bool isKeyframe(int frame) { return _entries[frame].flags & PACKET_INDEX_KEY; }
+  int getFrameForPts(int64_t pts);
+  int getKeyframeBefore(int frame);
+  int getKeyframeAfter(int frame);
+  bool hasLeadingFrames(int keyframe);
+  double getBuildMs() { return _buildMs; }
+
+  static std::string getSidecarName(const std::string& fileName);
+
+private:
+  void clear();
+  void findKeyframes();
+
+  const PacketIndexEntry* _entries = nullptr;
+  size_t _count = 0;
+  size_t _gopCount = 0;
+  std::vector<PacketIndexEntry> _built; // entries, if we built them instead of mapping them
+  std::vector<int> _keyframes;          // frame numbers of keyframes, in order
+  void* _map = nullptr;
+  size_t _mapSize = 0;
+  double _buildMs = 0;
+};
+
+#endif //VIDEOPLAYER_PACKETINDEX_H
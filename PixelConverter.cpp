@@ -0,0 +1,278 @@
+#include "PixelConverter.h"
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/cpu.h>
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXELCONVERTER_X86
+#include <immintrin.h>
+#endif
+
+// scalar kernels, which are also the reference the others must match
+
+static void deinterleaveScalar(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+  for(int x = 0; x < count; x++) {
+    u[x] = src[x * 2];
+    v[x] = src[x * 2 + 1];
+  }
+}
+
+static void average2Scalar(const uint8_t* a, const uint8_t* b, uint8_t* dst, int count) {
+  for(int x = 0; x < count; x++) {
+    dst[x] = (uint8_t)((a[x] + b[x] + 1) >> 1);
+  }
+}
+
+/*!
+ * Average 2x2 blocks of two rows.  With an odd width, the last column is used twice.
+ * @param from : first output column, so the SIMD kernels can use this for their tails
+ */
+static void average4Tail(const uint8_t* a, const uint8_t* b, uint8_t* dst, int srcWidth, int from) {
+  int count = (srcWidth + 1) / 2;
+  for(int x = from; x < count; x++) {
+    int left = x * 2;
+    int right = std::min(left + 1, srcWidth - 1);
+    dst[x] = (uint8_t)((a[left] + a[right] + b[left] + b[right] + 2) >> 2);
+  }
+}
+
+static void average4Scalar(const uint8_t* a, const uint8_t* b, uint8_t* dst, int srcWidth) {
+  average4Tail(a, b, dst, srcWidth, 0);
+}
+
+static const ConvertKernels scalarKernels = {deinterleaveScalar, average2Scalar, average4Scalar};
+
+#ifdef PIXELCONVERTER_X86
+
+// SSE4.1 kernels, 16 output pixels at a time
+
+__attribute__((target("sse4.1")))
+static void deinterleaveSse41(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+  const __m128i low = _mm_set1_epi16(0x00ff);
+  int x = 0;
+  for(; x + 16 <= count; x += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(src + x * 2));
+    __m128i b = _mm_loadu_si128((const __m128i*)(src + x * 2 + 16));
+    _mm_storeu_si128((__m128i*)(u + x), _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+    _mm_storeu_si128((__m128i*)(v + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+  }
+  deinterleaveScalar(src + x * 2, u + x, v + x, count - x);
+}
+
+__attribute__((target("sse4.1")))
+static void average2Sse41(const uint8_t* a, const uint8_t* b, uint8_t* dst, int count) {
+  int x = 0;
+  for(; x + 16 <= count; x += 16) {
+    __m128i rowA = _mm_loadu_si128((const __m128i*)(a + x));
+    __m128i rowB = _mm_loadu_si128((const __m128i*)(b + x));
+    _mm_storeu_si128((__m128i*)(dst + x), _mm_avg_epu8(rowA, rowB));
+  }
+  average2Scalar(a + x, b + x, dst + x, count - x);
+}
+
+__attribute__((target("sse4.1")))
+static void average4Sse41(const uint8_t* a, const uint8_t* b, uint8_t* dst, int srcWidth) {
+  const __m128i ones = _mm_set1_epi8(1);
+  const __m128i two = _mm_set1_epi16(2);
+  int pairs = srcWidth / 2;
+  int x = 0;
+  for(; x + 16 <= pairs; x += 16) {
+    // horizontal pair sums of each row as 16 bit, then add the rows
+    __m128i a0 = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*)(a + x * 2)), ones);
+    __m128i a1 = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*)(a + x * 2 + 16)), ones);
+    __m128i b0 = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*)(b + x * 2)), ones);
+    __m128i b1 = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*)(b + x * 2 + 16)), ones);
+    __m128i sum0 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(a0, b0), two), 2);
+    __m128i sum1 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(a1, b1), two), 2);
+    _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(sum0, sum1));
+  }
+  average4Tail(a, b, dst, srcWidth, x);
+}
+
+static const ConvertKernels sse41Kernels = {deinterleaveSse41, average2Sse41, average4Sse41};
+
+// AVX2 kernels, 32 output pixels at a time.  Packing works within 128 bit lanes, so the results are
+// put back in order with a permute.
+
+__attribute__((target("avx2")))
+static void deinterleaveAvx2(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+  const __m256i low = _mm256_set1_epi16(0x00ff);
+  int x = 0;
+  for(; x + 32 <= count; x += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(src + x * 2));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src + x * 2 + 32));
+    __m256i packedU = _mm256_packus_epi16(_mm256_and_si256(a, low), _mm256_and_si256(b, low));
+    __m256i packedV = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+    _mm256_storeu_si256((__m256i*)(u + x), _mm256_permute4x64_epi64(packedU, 0xd8));
+    _mm256_storeu_si256((__m256i*)(v + x), _mm256_permute4x64_epi64(packedV, 0xd8));
+  }
+  deinterleaveScalar(src + x * 2, u + x, v + x, count - x);
+}
+
+__attribute__((target("avx2")))
+static void average2Avx2(const uint8_t* a, const uint8_t* b, uint8_t* dst, int count) {
+  int x = 0;
+  for(; x + 32 <= count; x += 32) {
+    __m256i rowA = _mm256_loadu_si256((const __m256i*)(a + x));
+    __m256i rowB = _mm256_loadu_si256((const __m256i*)(b + x));
+    _mm256_storeu_si256((__m256i*)(dst + x), _mm256_avg_epu8(rowA, rowB));
+  }
+  average2Scalar(a + x, b + x, dst + x, count - x);
+}
+
+__attribute__((target("avx2")))
+static void average4Avx2(const uint8_t* a, const uint8_t* b, uint8_t* dst, int srcWidth) {
+  const __m256i ones = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi16(2);
+  int pairs = srcWidth / 2;
+  int x = 0;
+  for(; x + 32 <= pairs; x += 32) {
+    __m256i a0 = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(a + x * 2)), ones);
+    __m256i a1 = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(a + x * 2 + 32)), ones);
+    __m256i b0 = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(b + x * 2)), ones);
+    __m256i b1 = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(b + x * 2 + 32)), ones);
+    __m256i sum0 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(a0, b0), two), 2);
+    __m256i sum1 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(a1, b1), two), 2);
+    _mm256_storeu_si256((__m256i*)(dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(sum0, sum1), 0xd8));
+  }
+  average4Tail(a, b, dst, srcWidth, x);
+}
+
+static const ConvertKernels avx2Kernels = {deinterleaveAvx2, average2Avx2, average4Avx2};
+
+#endif
+
+PixelConverter::PixelConverter() {
+  setLevel(getBestLevel());
+}
+
+/*!
+ * Check if we have a kernel for a format.  Others have to go through swscale.
+ */
+bool PixelConverter::isSupported(AVPixelFormat format) {
+  return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_NV12 ||
+         format == AV_PIX_FMT_YUV422P || format == AV_PIX_FMT_YUV444P;
+}
+
+/*!
+ * Best instruction set this CPU supports
+ */
+ConvertLevel PixelConverter::getBestLevel() {
+#ifdef PIXELCONVERTER_X86
+  int flags = av_get_cpu_flags();
+  if(flags & AV_CPU_FLAG_AVX2) return CONVERT_AVX2;
+  if(flags & AV_CPU_FLAG_SSE4) return CONVERT_SSE41;
+#endif
+  return CONVERT_SCALAR;
+}
+
+/*!
+ * Use a particular instruction set.  Levels the CPU doesn't support fall back to the best one it does.
+ */
+void PixelConverter::setLevel(ConvertLevel level) {
+  _level = std::min(level, getBestLevel());
+  switch(_level) {
+#ifdef PIXELCONVERTER_X86
+    case CONVERT_AVX2:
+      _kernels = avx2Kernels;
+      break;
+    case CONVERT_SSE41:
+      _kernels = sse41Kernels;
+      break;
+#endif
+    default:
+      _kernels = scalarKernels;
+      break;
+  }
+}
+
+const char* PixelConverter::getLevelName(ConvertLevel level) {
+  switch(level) {
+    case CONVERT_AVX2: return "avx2";
+    case CONVERT_SSE41: return "sse4.1";
+    default: return "scalar";
+  }
+}
+
+/*!
+ * Convert a frame to YUV420P
+ * @param format : format of src, which must be one isSupported() accepts
+ * @param bands : number of threads to split the frame across, in horizontal bands
+ */
+void PixelConverter::convert(AVPixelFormat format, const uint8_t* const src[], const int srcLinesize[],
+                             uint8_t* const dst[], const int dstLinesize[], int width, int height, int bands) {
+  int chromaHeight = (height + 1) / 2;
+  bands = std::max(1, std::min(bands, chromaHeight));
+
+  std::vector<std::thread> threads;
+  for(int band = 1; band < bands; band++) {
+    threads.emplace_back([=] {
+      convertRows(format, src, srcLinesize, dst, dstLinesize, width, height,
+                  chromaHeight * band / bands, chromaHeight * (band + 1) / bands);
+    });
+  }
+  convertRows(format, src, srcLinesize, dst, dstLinesize, width, height, 0, chromaHeight / bands);
+  for(auto& thread : threads) {
+    thread.join();
+  }
+}
+
+/*!
+ * Halve the width and height of a plane with the same box filter, for scaling frames down.  Odd sizes
+ * round up.
+ * @param width, height : size of the source plane
+ */
+void PixelConverter::halve(const uint8_t *src, int srcLinesize, uint8_t *dst, int dstLinesize, int width, int height) {
+  for(int y = 0; y < (height + 1) / 2; y++) {
+    int top = y * 2;
+    int bottom = std::min(top + 1, height - 1);
+    _kernels.average4(src + top * srcLinesize, src + bottom * srcLinesize, dst + y * dstLinesize, width);
+  }
+}
+
+/*!
+ * Convert a band of the frame
+ * @param firstChromaRow, endChromaRow : output chroma rows of the band, the luma rows are twice these
+ */
+void PixelConverter::convertRows(AVPixelFormat format, const uint8_t* const src[], const int srcLinesize[],
+                                 uint8_t* const dst[], const int dstLinesize[], int width, int height,
+                                 int firstChromaRow, int endChromaRow) {
+  for(int y = firstChromaRow * 2; y < std::min(endChromaRow * 2, height); y++) {
+    memcpy(dst[0] + y * dstLinesize[0], src[0] + y * srcLinesize[0], width);
+  }
+
+  int chromaWidth = (width + 1) / 2;
+  for(int y = firstChromaRow; y < endChromaRow; y++) {
+    uint8_t* u = dst[1] + y * dstLinesize[1];
+    uint8_t* v = dst[2] + y * dstLinesize[2];
+
+    // source rows for 4:2:2 and 4:4:4, the last one is used twice if the height is odd
+    int top = y * 2;
+    int bottom = std::min(top + 1, height - 1);
+
+    switch(format) {
+      case AV_PIX_FMT_YUV420P:
+        memcpy(u, src[1] + y * srcLinesize[1], chromaWidth);
+        memcpy(v, src[2] + y * srcLinesize[2], chromaWidth);
+        break;
+      case AV_PIX_FMT_NV12:
+        _kernels.deinterleave(src[1] + y * srcLinesize[1], u, v, chromaWidth);
+        break;
+      case AV_PIX_FMT_YUV422P:
+        _kernels.average2(src[1] + top * srcLinesize[1], src[1] + bottom * srcLinesize[1], u, chromaWidth);
+        _kernels.average2(src[2] + top * srcLinesize[2], src[2] + bottom * srcLinesize[2], v, chromaWidth);
+        break;
+      case AV_PIX_FMT_YUV444P:
+        _kernels.average4(src[1] + top * srcLinesize[1], src[1] + bottom * srcLinesize[1], u, width);
+        _kernels.average4(src[2] + top * srcLinesize[2], src[2] + bottom * srcLinesize[2], v, width);
+        break;
+      default:
+        break;
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef VIDEOPLAYER_PIXELCONVERTER_H
+#define VIDEOPLAYER_PIXELCONVERTER_H
+
+#include <stdint.h>
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+};
+
+enum ConvertLevel {
+  CONVERT_SCALAR,
+  CONVERT_SSE41,
+  CONVERT_AVX2
+};
+
+/*!
+ * Row kernels used by the converter, one set per instruction set
+ */
+struct ConvertKernels {
+  void (*deinterleave)(const uint8_t* src, uint8_t* u, uint8_t* v, int count);      // NV12 chroma
+  void (*average2)(const uint8_t* a, const uint8_t* b, uint8_t* dst, int count);    // (a + b + 1) >> 1
+  void (*average4)(const uint8_t* a, const uint8_t* b, uint8_t* dst, int srcWidth); // 2x2 box, rounded
+};
+
+/*!
+ * Converts the formats decoders commonly give us to YUV420P at the same size, which is all the player
+ * needs, without going through swscale.  Chroma is downsampled with a rounded box filter.
+ * The kernels for the best instruction set the CPU has are chosen when the converter is made, and every
+ * level gives exactly the same output as the scalar one.
+ */
+class PixelConverter {
+public:
+  PixelConverter();
+  static bool isSupported(AVPixelFormat format);
+  void setLevel(ConvertLevel level);
+  ConvertLevel getLevel() { return _level; }
+  static const char* getLevelName(ConvertLevel level);
+  static ConvertLevel getBestLevel();
+
+  void convert(AVPixelFormat format, const uint8_t* const src[], const int srcLinesize[],
+               uint8_t* const dst[], const int dstLinesize[], int width, int height, int bands = 1);
+  void halve(const uint8_t* src, int srcLinesize, uint8_t* dst, int dstLinesize, int width, int height);
+
+private:
+  void convertRows(AVPixelFormat format, const uint8_t* const src[], const int srcLinesize[],
+                   uint8_t* const dst[], const int dstLinesize[], int width, int height,
+                   int firstChromaRow, int endChromaRow);
+
+  ConvertLevel _level;
+  ConvertKernels _kernels;
+};
+
+#endif //VIDEOPLAYER_PIXELCONVERTER_H
@@ -0,0 +1,159 @@
+#include "SpillCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+SpillCache::~SpillCache() {
+  if(_map) munmap(_map, _mapSize);
+}
+
+/*!
+ * Create and map the scratch file.  The file is unlinked right away, so it goes away with the process.
+ * @param path : scratch file to create, ideally on a fast local disk
+ * @param maxBytes : size of the scratch file
+ * @param frameSize : size of each frame
+ * @return false if the file couldn't be created
+ */
+bool SpillCache::open(const std::string &path, uint64_t maxBytes, uint64_t frameSize) {
+  _frameSize = frameSize;
+  _slotCount = (int)(maxBytes / frameSize);
+  _mapSize = _slotCount * frameSize;
+  if(!_slotCount) return false;
+
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(fd < 0) {
+    printf("failed to create spill file %s\n", path.c_str());
+    return false;
+  }
+  ::unlink(path.c_str());
+
+  // allocate all the blocks now, so a write never stalls waiting for the filesystem to find space
+  if(posix_fallocate(fd, 0, _mapSize)) {
+    printf("failed to allocate %.0f MB spill file\n", _mapSize / (1024. * 1024.));
+    close(fd);
+    return false;
+  }
+
+  void* map = mmap(nullptr, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    printf("failed to map spill file\n");
+    return false;
+  }
+  _map = (uint8_t*)map;
+  madvise(_map, _mapSize, MADV_RANDOM);
+
+  _slotFrame.assign(_slotCount, -1);
+  _slotPins.assign(_slotCount, 0);
+  _prev.assign(_slotCount, -1);
+  _next.assign(_slotCount, -1);
+  for(int slot = _slotCount - 1; slot >= 0; slot--) {
+    _freeSlots.push_back(slot);
+  }
+
+  printf("spill cache: %d frames (%.0f MB) in %s\n", _slotCount, _mapSize / (1024. * 1024.), path.c_str());
+  return true;
+}
+
+/*!
+ * Write a frame into the scratch file, reusing the least recently used slot if it's full.
+ */
+void SpillCache::write(int frame, const uint8_t *data) {
+  int slot;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto kv = _frameToSlot.find(frame);
+    if(kv != _frameToSlot.end()) {
+      unlink(kv->second);
+      pushNewest(kv->second);
+      return;
+    }
+
+    slot = takeSlot();
+    if(slot < 0) return;
+  }
+
+  // the slot isn't in the map or use list, so nobody else can touch it while we copy
+  memcpy(_map + slot * _frameSize, data, _frameSize);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _slotFrame[slot] = frame;
+  _frameToSlot[frame] = slot;
+  pushNewest(slot);
+}
+
+/*!
+ * Copy a frame out of the scratch file.
+ * @return false if the frame isn't there
+ */
+bool SpillCache::read(int frame, uint8_t *dst) {
+  int slot;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto kv = _frameToSlot.find(frame);
+    if(kv == _frameToSlot.end()) return false;
+    slot = kv->second;
+    _slotPins[slot]++;
+    unlink(slot);
+    pushNewest(slot);
+  }
+
+  memcpy(dst, _map + slot * _frameSize, _frameSize);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _slotPins[slot]--;
+  return true;
+}
+
+bool SpillCache::hasFrame(int frame) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _frameToSlot.find(frame) != _frameToSlot.end();
+}
+
+/*!
+ * Get an empty slot, or clean the least recently used one that isn't being read.  Must hold the lock.
+ * @return the slot, or -1 if every slot is being read
+ */
+int SpillCache::takeSlot() {
+  if(!_freeSlots.empty()) {
+    int slot = _freeSlots.back();
+    _freeSlots.pop_back();
+    return slot;
+  }
+
+  int slot = _oldest;
+  while(slot >= 0 && _slotPins[slot]) slot = _prev[slot];
+  if(slot < 0) return -1;
+
+  unlink(slot);
+  _frameToSlot.erase(_slotFrame[slot]);
+  _slotFrame[slot] = -1;
+  return slot;
+}
+
+/*!
+ * Remove a slot from the use list
+ */
+void SpillCache::unlink(int slot) {
+  if(_prev[slot] >= 0) _next[_prev[slot]] = _next[slot];
+  else _newest = _next[slot];
+
+  if(_next[slot] >= 0) _prev[_next[slot]] = _prev[slot];
+  else _oldest = _prev[slot];
+
+  _prev[slot] = -1;
+  _next[slot] = -1;
+}
+
+/*!
+ * Put a slot at the front of the use list
+ */
+void SpillCache::pushNewest(int slot) {
+  _prev[slot] = -1;
+  _next[slot] = _newest;
+  if(_newest >= 0) _prev[_newest] = slot;
+  _newest = slot;
+  if(_oldest < 0) _oldest = slot;
+}
@@ -0,0 +1,55 @@
+#ifndef VIDEOPLAYER_SPILLCACHE_H
+#define VIDEOPLAYER_SPILLCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*!
+ * Second cache tier, below the VideoCache, in a memory mapped scratch file.
+ * The file is divided into fixed size slots, one frame per slot, and is allocated when opened so
+ * writes never have to grow it.  When it's full, the least recently used slot is reused.
+ * Frame data is copied in and out without holding the lock.
+ */
+class SpillCache {
+public:
+  SpillCache() = default;
+  ~SpillCache();
+  bool open(const std::string& path, uint64_t maxBytes, uint64_t frameSize);
+  void write(int frame, const uint8_t* data);
+  bool read(int frame, uint8_t* dst);
+  bool hasFrame(int frame);
+
+  size_t getFrameCount() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _frameToSlot.size();
+  }
+
+  int getSlotCount() { return _slotCount; }
+  uint64_t getFrameSize() { return _frameSize; }
+
+private:
+  int takeSlot();
+  void unlink(int slot);
+  void pushNewest(int slot);
+
+  std::mutex _mutex;
+  uint8_t* _map = nullptr;
+  size_t _mapSize = 0;
+  uint64_t _frameSize = 0;
+  int _slotCount = 0;
+
+  std::unordered_map<int, int> _frameToSlot;
+  std::vector<int> _slotFrame; // frame held by each slot, -1 if empty
+  std::vector<int> _slotPins;  // number of reads in progress on each slot
+  std::vector<int> _prev;      // use list, like VideoCache's, but by slot number
+  std::vector<int> _next;
+  std::vector<int> _freeSlots;
+  int _newest = -1;
+  int _oldest = -1;
+};
+
+#endif //VIDEOPLAYER_SPILLCACHE_H
@@ -0,0 +1,98 @@
+#include "TextRenderer.h"
+#include <stdio.h>
+
+// glyphs are packed into rows no wider than this
+static const int atlasWidth = 1024;
+
+GlyphAtlas::~GlyphAtlas() {
+  clear();
+}
+
+/*!
+ * Free the texture.  Must be done before the renderer is destroyed.
+ */
+void GlyphAtlas::clear() {
+  if(_texture) SDL_DestroyTexture(_texture);
+  _texture = nullptr;
+}
+
+/*!
+ * Rasterize the glyphs and upload them.  Glyphs are drawn in white, tint them with SDL_SetTextureColorMod().
+ * @return false if there's no font, in which case nothing is drawn
+ */
+bool GlyphAtlas::init(SDL_Renderer *renderer, TTF_Font *font) {
+  if(!font) return false;
+
+  SDL_Color white = {255, 255, 255, 255};
+  SDL_Surface* glyphs[lastChar - firstChar + 1];
+  int x = 0, y = 0;
+  _height = TTF_FontHeight(font);
+
+  for(char c = firstChar; c <= lastChar; c++) {
+    char text[2] = {c, 0};
+    SDL_Surface* glyph = TTF_RenderText_Blended(font, text, white);
+    int width = glyph ? glyph->w : 0;
+    if(x + width > atlasWidth) {
+      x = 0;
+      y += _height;
+    }
+    glyphs[c - firstChar] = glyph;
+    _glyphs[c - firstChar] = {x, y, width, _height};
+    x += width;
+  }
+
+  SDL_Surface* atlas = SDL_CreateRGBSurfaceWithFormat(0, atlasWidth, y + _height, 32, SDL_PIXELFORMAT_RGBA32);
+  if(atlas) {
+    for(char c = firstChar; c <= lastChar; c++) {
+      SDL_Surface* glyph = glyphs[c - firstChar];
+      if(!glyph) continue;
+      SDL_SetSurfaceBlendMode(glyph, SDL_BLENDMODE_NONE);
+      SDL_BlitSurface(glyph, nullptr, atlas, &_glyphs[c - firstChar]);
+    }
+    _texture = SDL_CreateTextureFromSurface(renderer, atlas);
+    SDL_FreeSurface(atlas);
+  }
+
+  for(SDL_Surface* glyph : glyphs) {
+    if(glyph) SDL_FreeSurface(glyph);
+  }
+
+  if(!_texture) {
+    printf("failed to create glyph atlas: %s\n", SDL_GetError());
+    return false;
+  }
+  SDL_SetTextureBlendMode(_texture, SDL_BLENDMODE_BLEND);
+  return true;
+}
+
+/*!
+ * Draw text with its top left corner at x, y
+ */
+void TextLine::draw(SDL_Renderer *renderer, GlyphAtlas &atlas, const char *text, int x, int y) {
+  if(!atlas.isLoaded()) return;
+  if(_text != text) layout(atlas, text);
+
+  for(size_t i = 0; i < _dst.size(); i++) {
+    SDL_Rect dst = _dst[i];
+    dst.x += x;
+    dst.y += y;
+    SDL_RenderCopy(renderer, atlas.getTexture(), _src[i], &dst);
+  }
+}
+
+void TextLine::layout(GlyphAtlas &atlas, const char *text) {
+  _text = text;
+  _src.clear();
+  _dst.clear();
+
+  int x = 0;
+  for(const char* c = text; *c; c++) {
+    const SDL_Rect& glyph = atlas.getGlyph(*c);
+    if(*c != ' ') {
+      _src.push_back(&glyph);
+      _dst.push_back({x, 0, glyph.w, glyph.h});
+    }
+    x += glyph.w;
+  }
+  _width = x;
+}
@@ -0,0 +1,56 @@
+#ifndef VIDEOPLAYER_TEXTRENDERER_H
+#define VIDEOPLAYER_TEXTRENDERER_H
+
+#include <string>
+#include <vector>
+#include "SDL.h"
+#include <SDL2/SDL_ttf.h>
+
+/*!
+ * Printable ASCII glyphs rasterized once into a single texture.
+ */
+class GlyphAtlas {
+public:
+  GlyphAtlas() = default;
+  ~GlyphAtlas();
+  bool init(SDL_Renderer* renderer, TTF_Font* font);
+  void clear();
+
+  bool isLoaded() { return _texture != nullptr; }
+  SDL_Texture* getTexture() { return _texture; }
+  int getHeight() { return _height; }
+
+  const SDL_Rect& getGlyph(char c) {
+    if(c < firstChar || c > lastChar) c = '?';
+    return _glyphs[c - firstChar];
+  }
+
+private:
+  static const char firstChar = ' ';
+  static const char lastChar = '~';
+
+  SDL_Texture* _texture = nullptr;
+  SDL_Rect _glyphs[lastChar - firstChar + 1];
+  int _height = 0;
+};
+
+
+/*!
+ * A line of text drawn from a GlyphAtlas as one textured quad per character.  The quads are only laid
+ * out again when the text changes, so drawing unchanged text is just the copies.
+ */
+class TextLine {
+public:
+  void draw(SDL_Renderer* renderer, GlyphAtlas& atlas, const char* text, int x, int y);
+  int getWidth() { return _width; }
+
+private:
+  void layout(GlyphAtlas& atlas, const char* text);
+
+  std::string _text;
+  std::vector<const SDL_Rect*> _src; // glyph of each character in the atlas
+  std::vector<SDL_Rect> _dst;        // where it goes, relative to the start of the line
+  int _width = 0;
+};
+
+#endif //VIDEOPLAYER_TEXTRENDERER_H
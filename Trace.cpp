@@ -0,0 +1,246 @@
+#include "Trace.h"
+
+#ifdef VIDEOPLAYER_TRACE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+static const char* stageNames[TRACE_STAGE_COUNT] = {
+  "playback", "upload", "text", "present", "seekTo", "consecutive", "seekForward", "seekBackward",
+  "seekIndexed", "av_seek_frame", "demux", "decode", "convert", "spillRead",
+  "readahead"
+};
+
+// events kept per thread, older ones are overwritten
+static const size_t traceRingSize = 16384;
+
+struct TraceEvent {
+  uint64_t startNs;
+  uint32_t durationNs;
+  uint32_t stage;
+};
+
+/*!
+ * One thread's events and histograms.  Only the owning thread writes to it, so the counters are
+ * updated with plain relaxed stores and readers see a slightly stale but consistent enough view.
+ * Buffers are never freed, a new thread takes over the buffer of one which has exited, with a new tid
+ * and empty histograms.
+ */
+struct TraceBuffer {
+  int tid;
+  char name[32] = "thread";
+  bool inUse = true;
+  TraceEvent events[traceRingSize];
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> count[TRACE_STAGE_COUNT] = {};
+  std::atomic<uint64_t> totalNs[TRACE_STAGE_COUNT] = {};
+  std::atomic<uint64_t> maxNs[TRACE_STAGE_COUNT] = {};
+  std::atomic<uint64_t> buckets[TRACE_STAGE_COUNT][traceBuckets] = {};
+};
+
+// protected by buffersMutex, along with the buffers' tid, name and inUse
+static std::mutex buffersMutex;
+static std::vector<TraceBuffer*> buffers;
+static int nextTid = 1;
+static TraceHistogram exited[TRACE_STAGE_COUNT]; // histograms of threads whose buffers were taken over
+
+static void bump(std::atomic<uint64_t>& counter, uint64_t add) {
+  counter.store(counter.load(std::memory_order_relaxed) + add, std::memory_order_relaxed);
+}
+
+/*!
+ * Hands the thread's buffer back when the thread exits
+ */
+struct TraceBufferOwner {
+  TraceBuffer* buffer = nullptr;
+
+  ~TraceBufferOwner() {
+    if(!buffer) return;
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buffer->inUse = false;
+  }
+
+  TraceBuffer* get() {
+    if(buffer) return buffer;
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    for(TraceBuffer* unused : buffers) {
+      if(!unused->inUse) {
+        reuse(unused);
+        buffer = unused;
+        return buffer;
+      }
+    }
+    buffer = new TraceBuffer;
+    buffer->tid = nextTid++;
+    buffers.push_back(buffer);
+    return buffer;
+  }
+
+  /*!
+   * Take over an exited thread's buffer as a new thread, keeping its histograms in the totals.  Must
+   * hold buffersMutex.
+   */
+  static void reuse(TraceBuffer* buffer) {
+    for(int stage = 0; stage < TRACE_STAGE_COUNT; stage++) {
+      TraceHistogram& histogram = exited[stage];
+      histogram.count += buffer->count[stage].exchange(0, std::memory_order_relaxed);
+      histogram.totalNs += buffer->totalNs[stage].exchange(0, std::memory_order_relaxed);
+      histogram.maxNs = std::max(histogram.maxNs, buffer->maxNs[stage].exchange(0, std::memory_order_relaxed));
+      for(int i = 0; i < traceBuckets; i++) {
+        histogram.buckets[i] += buffer->buckets[stage][i].exchange(0, std::memory_order_relaxed);
+      }
+    }
+    buffer->written.store(0, std::memory_order_release);
+    buffer->tid = nextTid++;
+    snprintf(buffer->name, sizeof(buffer->name), "thread");
+    buffer->inUse = true;
+  }
+};
+
+static thread_local TraceBufferOwner threadBuffer;
+
+uint64_t Trace::now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void Trace::record(TraceStage stage, uint64_t startNs, uint64_t endNs) {
+  TraceBuffer* buffer = threadBuffer.get();
+  uint64_t duration = endNs - startNs;
+
+  uint64_t written = buffer->written.load(std::memory_order_relaxed);
+  TraceEvent& event = buffer->events[written % traceRingSize];
+  event.startNs = startNs;
+  event.durationNs = (uint32_t)std::min<uint64_t>(duration, UINT32_MAX);
+  event.stage = stage;
+  buffer->written.store(written + 1, std::memory_order_release);
+
+  uint64_t us = duration / 1000;
+  int bucket = us ? 64 - __builtin_clzll(us) : 0;
+  if(bucket >= traceBuckets) bucket = traceBuckets - 1;
+  bump(buffer->count[stage], 1);
+  bump(buffer->totalNs[stage], duration);
+  bump(buffer->buckets[stage][bucket], 1);
+  if(duration > buffer->maxNs[stage].load(std::memory_order_relaxed)) {
+    buffer->maxNs[stage].store(duration, std::memory_order_relaxed);
+  }
+}
+
+/*!
+ * Name the calling thread in the trace
+ */
+void Trace::setThreadName(const char *name) {
+  TraceBuffer* buffer = threadBuffer.get();
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+}
+
+const char* Trace::getStageName(TraceStage stage) {
+  return stageNames[stage];
+}
+
+/*!
+ * Combine a stage's histograms from every thread, including those which have exited
+ */
+TraceHistogram Trace::getHistogram(TraceStage stage) {
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  TraceHistogram histogram = exited[stage];
+  for(TraceBuffer* buffer : buffers) {
+    histogram.count += buffer->count[stage].load(std::memory_order_relaxed);
+    histogram.totalNs += buffer->totalNs[stage].load(std::memory_order_relaxed);
+    histogram.maxNs = std::max(histogram.maxNs, buffer->maxNs[stage].load(std::memory_order_relaxed));
+    for(int i = 0; i < traceBuckets; i++) {
+      histogram.buckets[i] += buffer->buckets[stage][i].load(std::memory_order_relaxed);
+    }
+  }
+  return histogram;
+}
+
+/*!
+ * Estimate a percentile from the buckets, as the upper edge of the bucket it falls in
+ */
+double TraceHistogram::getPercentileMs(double p) {
+  uint64_t want = (uint64_t)(p * count);
+  uint64_t seen = 0;
+  for(int i = 0; i < traceBuckets; i++) {
+    seen += buckets[i];
+    if(seen > want) return std::min((double)(1ull << i) / 1000., maxNs / 1.e6);
+  }
+  return maxNs / 1.e6;
+}
+
+/*!
+ * Write the events still in every thread's ring as Chrome trace-event JSON, for chrome://tracing or
+ * Perfetto.  Threads carry on recording while this runs.
+ * @return false if the file couldn't be written
+ */
+bool Trace::writeChromeTrace(const std::string &fileName) {
+  FILE* file = fopen(fileName.c_str(), "w");
+  if(!file) {
+    printf("can't write trace %s\n", fileName.c_str());
+    return false;
+  }
+
+  // a thread taking over a buffer changes its tid and name, so they're copied with the list
+  struct Thread {
+    TraceBuffer* buffer;
+    int tid;
+    char name[sizeof(TraceBuffer::name)];
+  };
+  std::vector<Thread> copy;
+  {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    for(TraceBuffer* buffer : buffers) {
+      Thread thread;
+      thread.buffer = buffer;
+      thread.tid = buffer->tid;
+      memcpy(thread.name, buffer->name, sizeof(thread.name));
+      copy.push_back(thread);
+    }
+  }
+
+  // timestamps start from the oldest event we still have
+  uint64_t start = UINT64_MAX;
+  for(Thread& thread : copy) {
+    TraceBuffer* buffer = thread.buffer;
+    uint64_t written = std::min<uint64_t>(buffer->written.load(std::memory_order_acquire), traceRingSize);
+    for(uint64_t i = 0; i < written; i++) {
+      start = std::min(start, buffer->events[i].startNs);
+    }
+  }
+
+  fprintf(file, "{\"traceEvents\": [\n");
+  bool first = true;
+  size_t events = 0;
+  for(Thread& thread : copy) {
+    TraceBuffer* buffer = thread.buffer;
+    fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+            first ? "" : ",\n", thread.tid, thread.name);
+    first = false;
+
+    uint64_t written = buffer->written.load(std::memory_order_acquire);
+    uint64_t from = written > traceRingSize ? written - traceRingSize : 0;
+    for(uint64_t i = from; i < written; i++) {
+      TraceEvent event = buffer->events[i % traceRingSize];
+      if(event.startNs < start) continue;
+      fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+              stageNames[event.stage], thread.tid, (event.startNs - start) / 1000., event.durationNs / 1000.);
+      events++;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+
+  printf("wrote %zu trace events to %s\n", events, fileName.c_str());
+  return true;
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef VIDEOPLAYER_TRACE_H
+#define VIDEOPLAYER_TRACE_H
+
+/*!
+ * Scoped timers for the stages of the hot path.
+ * Build with VIDEOPLAYER_TRACE defined to record them, otherwise TRACE_SCOPE() and TRACE_THREAD()
+ * compile to nothing.  Each thread records into its own ring, so recording never takes a lock.
+ */
+
+enum TraceStage {
+  TRACE_PLAYBACK,     // one pass of VideoPlayer::playback()
+  TRACE_UPLOAD,       // copying a frame into the texture
+  TRACE_TEXT,         // rendering the status bar text
+  TRACE_PRESENT,      // SDL_RenderPresent, including the vsync wait
+  TRACE_SEEK_TO,      // VideoDecoder::seekTo()
+  TRACE_CONSECUTIVE,
+  TRACE_SEEK_FORWARD,
+  TRACE_SEEK_BACKWARD,
+  TRACE_SEEK_INDEXED,
+  TRACE_AV_SEEK,      // av_seek_frame
+  TRACE_DEMUX,        // av_read_frame
+  TRACE_DECODE,       // avcodec_decode_video2
+  TRACE_CONVERT,      // sws_scale or the plane copy into the cache
+  TRACE_SPILL_READ,
+  TRACE_READAHEAD,    // one chunk read ahead by a FileReader
+  TRACE_STAGE_COUNT
+};
+
+#ifdef VIDEOPLAYER_TRACE
+
+#include <stdint.h>
+#include <string>
+
+// log2 buckets of microseconds, the last one takes everything longer
+static const int traceBuckets = 24;
+
+struct TraceHistogram {
+  uint64_t count = 0;
+  uint64_t totalNs = 0;
+  uint64_t maxNs = 0;
+  uint64_t buckets[traceBuckets] = {};
+
+  double getPercentileMs(double p);
+};
+
+class Trace {
+public:
+  static uint64_t now();
+  static void record(TraceStage stage, uint64_t startNs, uint64_t endNs);
+  static void setThreadName(const char* name);
+  static bool writeChromeTrace(const std::string& fileName);
+  static TraceHistogram getHistogram(TraceStage stage);
+  static const char* getStageName(TraceStage stage);
+};
+
+class TraceScope {
+public:
+  explicit TraceScope(TraceStage stage) : _stage(stage), _start(Trace::now()) { }
+  ~TraceScope() { Trace::record(_stage, _start, Trace::now()); }
+
+private:
+  TraceStage _stage;
+  uint64_t _start;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(stage) TraceScope TRACE_CONCAT(traceScope, __LINE__)(stage)
+#define TRACE_THREAD(name) Trace::setThreadName(name)
+
+#else
+
+#define TRACE_SCOPE(stage)
+#define TRACE_THREAD(name)
+
+#endif
+
+#endif //VIDEOPLAYER_TRACE_H
@@ -0,0 +1,867 @@
+#include "VideoCache.h"
+#include "EvictionPolicy.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "Timer.h"
+#include "Trace.h"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+// cleaned frames allowed to wait for the spill thread before we start dropping them
+static const size_t maxSpillQueue = 16;
+
+// slab slots beyond the budget, for frames waiting for the spill thread and new frames which haven't
+// been inserted yet, both of which are outside the budget for a while
+static const int slabSpareFrames = maxSpillQueue + 8;
+
+VideoCache::VideoCache(uint64_t maxMemory) : _maxMemory(maxMemory * 1024l * 1024l), _policy(new LruPolicy) { }
+
+VideoCache::~VideoCache() {
+  if(_spill) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _spillRunning = false;
+    }
+    _spillCv.notify_one();
+    _spillThread.join();
+    std::vector<FrameRecord*> queued(_spillQueue.begin(), _spillQueue.end());
+    freeRecords(queued);
+    delete _spill;
+  }
+
+  std::vector<FrameRecord*> cleaned;
+  for(auto& kv : _frameMap) {
+    cleaned.push_back(kv.second);
+  }
+  _frameMap.clear();
+  freeRecords(cleaned);
+}
+
+/*!
+ * Add a frame to the cache.
+ * @param data : pointer to frame data
+ * @param size : size of data
+ * @param frame : frame number
+ */
+void VideoCache::addFrame(uint8_t *data, uint64_t size, int frame) {
+  // don't cache frames we already have
+  if(hasFrame(frame)) return;
+
+  // build new record and copy the data into it before taking the lock
+  FrameRecord* rec = _allocator.alloc(frame, size, 0);
+  rec->pins = 0;
+  memcpy(rec->data, data, size);
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    rec->width = _width;
+    rec->height = _height;
+  }
+
+  std::vector<FrameRecord*> cleaned;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(insertRecord(rec, cleaned) && _analytics.decoded(frame)) _stats.redecodes++;
+  }
+
+  finishCleaning(cleaned);
+}
+
+/*!
+ * Allocate a pinned record for a frame, so the caller can write the frame straight into it and then
+ * insertFrame() it without another copy.
+ * @param frame : frame number
+ * @param width, height : size of the YUV420P picture
+ */
+FrameRecord* VideoCache::allocFrame(int frame, int width, int height) {
+  FrameRecord* rec = _allocator.alloc(frame, getFrameBytes(width, height), 0);
+  rec->pins = 1;
+  rec->width = width;
+  rec->height = height;
+  return rec;
+}
+
+/*!
+ * Add a record from allocFrame() to the cache.  If the frame was cached in the meantime, the record is
+ * freed and the cached one is pinned instead.  A record of another size than the cache's isn't cached,
+ * but is still returned for the caller to show, and freed when it's released.
+ * @return the cached record, still pinned.  Give it back with releaseFrame().
+ */
+FrameRecord* VideoCache::insertFrame(FrameRecord *rec) {
+  std::vector<FrameRecord*> cleaned;
+  FrameRecord* result = rec;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(!matchesSize(rec)) {
+      // decoded for the size before the last setFrameSize()
+      rec->detached = true;
+    } else if(!insertRecord(rec, cleaned)) {
+      result = _frameMap[rec->frame];
+      result->pins++;
+    } else if(rec->level == 0 && _analytics.decoded(rec->frame)) {
+      _stats.redecodes++;
+    }
+  }
+
+  finishCleaning(cleaned);
+  return result;
+}
+
+/*!
+ * Add a new record to the map and use list, and clean frames if that puts us over budget.
+ * A proxy or stale copy of the frame is replaced.  Must hold the lock.
+ * @param cleaned : records to finish with once the lock is released
+ * @return false if the frame was already cached, in which case rec is added to cleaned
+ */
+bool VideoCache::insertRecord(FrameRecord *rec, std::vector<FrameRecord*>& cleaned) {
+  auto kv = _frameMap.find(rec->frame);
+  if(kv != _frameMap.end()) {
+    // someone else may have added it while we were copying
+    if(!kv->second->stale && kv->second->level <= rec->level) {
+      cleaned.push_back(rec);
+      return false;
+    }
+    removeRecord(kv->second, cleaned);
+  }
+
+  // track memory usage of cache
+  account(rec, 1);
+  _stats.inserts++;
+  rec->use_id = _useCount++;
+  pushNewest(rec);
+
+  // add to map
+  _frameMap[rec->frame] = rec;
+  assert(_frameMap.find(rec->frame) != _frameMap.end());
+
+  // make sure we aren't over the memory budget
+  cleanToBudget(cleaned);
+  return true;
+}
+
+/*!
+ * Take a record out of the map and use list.  If someone is still reading it, it is freed when they
+ * release it instead.  Must hold the lock.
+ * @param cleaned : the record is appended here to be freed once the lock is released
+ */
+void VideoCache::removeRecord(FrameRecord *rec, std::vector<FrameRecord*>& cleaned) {
+  unlink(rec);
+  _frameMap.erase(rec->frame);
+  account(rec, -1);
+  if(rec->pins) rec->detached = true;
+  else cleaned.push_back(rec);
+}
+
+/*!
+ * Add a record's memory to the totals, or take it off with a sign of -1.  Must hold the lock.
+ */
+void VideoCache::account(FrameRecord *rec, int sign) {
+  _totalMemUse += sign * (int64_t)(sizeof(FrameRecord) + rec->size);
+  if(rec->stale) _staleCount += sign;
+  _stats.levelFrames[rec->level] += sign;
+  _stats.levelBytes[rec->level] += sign * (int64_t)rec->size;
+  if(rec->stale) return;
+  if(sign > 0) {
+    _policy->added(rec);
+    _analytics.cached(rec->frame, rec->level);
+  } else {
+    _policy->removed(rec);
+    _analytics.uncached(rec->frame);
+  }
+}
+
+/*!
+ * Check if a record is the size of its level at the cache's frame size.  Must hold the lock.
+ */
+bool VideoCache::matchesSize(const FrameRecord *rec) {
+  if(!_width) return true;
+  int width = _width;
+  int height = _height;
+  getLevelSize(rec->level, width, height);
+  return rec->width == width && rec->height == height;
+}
+
+/*!
+ * Remove a frame which nobody is still reading from the map and use list.  Stale frames go first, then
+ * the smallest proxies, full resolution frames only once there are none.  Within a level the eviction
+ * policy picks.  Must hold the lock.  The record is returned so it can be freed after the lock is released.
+ * @return the removed record, or null if every frame is pinned
+ */
+FrameRecord* VideoCache::cleanFrame() {
+  FrameRecord* rec = findStale();
+  for(int level = cacheLevels - 1; !rec && level >= 0; level--) {
+    rec = _policy->pick(level, _oldest[level], -1);
+  }
+  if(!rec) return nullptr;
+
+  unlink(rec);
+  _frameMap.erase(rec->frame);
+  account(rec, -1);
+  _stats.evictions++;
+  _analytics.evicted(rec->frame, rec->level, _useCount - rec->use_id);
+  return rec;
+}
+
+/*!
+ * Find the least recently used stale frame nobody is reading.  Only pinned ones are passed over, and
+ * the few frames being read are pinned, so this doesn't walk the cache.  Must hold the lock.
+ * @return the record, or null if there isn't one
+ */
+FrameRecord* VideoCache::findStale() {
+  for(int level = cacheLevels - 1; _staleCount && level >= 0; level--) {
+    for(FrameRecord* rec = _staleOldest[level]; rec; rec = rec->prev) {
+      if(!rec->pins) return rec;
+    }
+  }
+  return nullptr;
+}
+
+/*!
+ * Find a frame we can scale down instead of cleaning: a full resolution frame away from the playhead, or
+ * failing that a half resolution one.  The eviction policy picks which.  Must hold the lock.
+ * @return the record, or null if there isn't one or proxies are off
+ */
+FrameRecord* VideoCache::findDemotable() {
+  if(!_proxies) return nullptr;
+
+  for(int level = 0; level < cacheLevels - 1; level++) {
+    if(FrameRecord* rec = _policy->pick(level, _oldest[level], level == 0 ? _fullRadius : -1)) return rec;
+  }
+  return nullptr;
+}
+
+/*!
+ * Clean frames until we're under budget.  Must hold the lock.
+ * Frames to scale down are pinned and marked demoting, the scaling is done once the lock is released.
+ * @param cleaned : removed and demoting records are appended here for finishCleaning()
+ */
+void VideoCache::cleanToBudget(std::vector<FrameRecord*>& cleaned) {
+  while(_totalMemUse - _demotingBytes > _maxMemory) {
+    if(FrameRecord* rec = findDemotable()) {
+      int width = rec->width;
+      int height = rec->height;
+      getLevelSize(1, width, height);
+      rec->demoting = true;
+      rec->pins++;
+      _demotingBytes += rec->size - getFrameBytes(width, height);
+      cleaned.push_back(rec);
+      continue;
+    }
+
+    // clean!
+    FrameRecord* rec = cleanFrame();
+    if(!rec) break;
+
+    // proxies aren't worth writing out
+    if(_spill && rec->level == 0 && rec->size == _spill->getFrameSize()) {
+      queueSpill(rec, cleaned);
+    } else {
+      cleaned.push_back(rec);
+    }
+  }
+}
+
+/*!
+ * Hand a full resolution frame to the spill thread, which frees it once it's written.  If it's falling
+ * behind, drop the oldest instead.  Must hold the lock.
+ */
+void VideoCache::queueSpill(FrameRecord *rec, std::vector<FrameRecord*>& cleaned) {
+  _spillQueue.push_back(rec);
+  if(_spillQueue.size() > maxSpillQueue) {
+    cleaned.push_back(_spillQueue.front());
+    _spillQueue.pop_front();
+    _stats.spillDrops++;
+  }
+  _spillCv.notify_one();
+}
+
+/*!
+ * Free the records cleanToBudget() removed and scale down the ones it picked.  Call without the lock.
+ */
+void VideoCache::finishCleaning(std::vector<FrameRecord*>& cleaned) {
+  std::vector<FrameRecord*> freed;
+  for(auto* rec : cleaned) {
+    if(rec->demoting) demote(rec);
+    else freed.push_back(rec);
+  }
+  cleaned.clear();
+  freeRecords(freed);
+}
+
+/*!
+ * Replace a record with a copy at the next level down.  The record is pinned while it is scaled
+ * outside of the lock.  If it was replaced, went stale or somebody pinned it meanwhile, it is kept and
+ * the copy is thrown away.  A full resolution frame still goes to the spill tier.
+ */
+void VideoCache::demote(FrameRecord *rec) {
+  int width = rec->width;
+  int height = rec->height;
+  getLevelSize(1, width, height);
+  FrameRecord* proxy = _allocator.alloc(rec->frame, getFrameBytes(width, height), rec->level + 1);
+  proxy->pins = 0;
+  proxy->width = width;
+  proxy->height = height;
+  proxy->redecodeMs = rec->redecodeMs;
+  downscale(rec->data, rec->width, rec->height, proxy->data);
+
+  std::vector<FrameRecord*> cleaned;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _demotingBytes -= rec->size - proxy->size;
+    rec->demoting = false;
+    rec->pins--;
+
+    if(rec->detached || rec->pins || rec->stale) {
+      cleaned.push_back(proxy);
+      if(rec->detached && !rec->pins) cleaned.push_back(rec);
+    } else {
+      unlink(rec);
+      account(rec, -1);
+      proxy->use_id = rec->use_id;
+      pushNewest(proxy);
+      account(proxy, 1);
+      _frameMap[proxy->frame] = proxy;
+      _stats.demotions++;
+      _analytics.evicted(rec->frame, rec->level, _useCount - rec->use_id, true);
+
+      if(_spill && rec->level == 0 && rec->size == _spill->getFrameSize()) {
+        queueSpill(rec, cleaned);
+      } else {
+        cleaned.push_back(rec);
+      }
+    }
+  }
+  freeRecords(cleaned);
+}
+
+/*!
+ * Get the size of a level from the full resolution size.  Odd sizes round up.
+ */
+void VideoCache::getLevelSize(int level, int &width, int &height) {
+  for(int i = 0; i < level; i++) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+  }
+}
+
+/*!
+ * Size of a YUV420P frame
+ */
+uint64_t VideoCache::getFrameBytes(int width, int height) {
+  return (uint64_t)width * height + 2 * (uint64_t)((width + 1) / 2) * ((height + 1) / 2);
+}
+
+/*!
+ * Size of a YUV420P frame at a level of the cache's frame size
+ */
+uint64_t VideoCache::getLevelBytes(int level) {
+  int width = _width;
+  int height = _height;
+  getLevelSize(level, width, height);
+  return getFrameBytes(width, height);
+}
+
+/*!
+ * Halve a YUV420P frame into the next level down
+ */
+void VideoCache::downscale(const uint8_t *src, int width, int height, uint8_t *dst) {
+  int chromaWidth = (width + 1) / 2;
+  int chromaHeight = (height + 1) / 2;
+  const int widths[3] = {width, chromaWidth, chromaWidth};
+  const int heights[3] = {height, chromaHeight, chromaHeight};
+  for(int plane = 0; plane < 3; plane++) {
+    int dstWidth = (widths[plane] + 1) / 2;
+    _converter.halve(src, widths[plane], dst, dstWidth, widths[plane], heights[plane]);
+    src += widths[plane] * heights[plane];
+    dst += dstWidth * ((heights[plane] + 1) / 2);
+  }
+}
+
+/*!
+ * Scale frames away from the playhead down instead of cleaning them.  Needs the frame size set.
+ */
+void VideoCache::enableProxies() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _proxies = true;
+}
+
+/*!
+ * Set the size full resolution frames are cached at, which is the decoders' output size.  Frames cached
+ * at another size go stale, and a frame of this size replaces its stale copy when it's inserted.
+ */
+void VideoCache::setFrameSize(int width, int height) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if(width == _width && height == _height) return;
+  _width = width;
+  _height = height;
+  // oldest first, so records moved to the other list keep their order
+  for(int level = 0; level < cacheLevels; level++) {
+    for(FrameRecord* rec : {_oldest[level], _staleOldest[level]}) {
+      while(rec) {
+        FrameRecord* newer = rec->prev;
+        setStale(rec, !matchesSize(rec));
+        rec = newer;
+      }
+    }
+  }
+}
+
+/*!
+ * Mark a record stale or not, moving it between its level's use list and stale list.  Must hold the lock.
+ */
+void VideoCache::setStale(FrameRecord *rec, bool stale) {
+  if(stale == rec->stale) return;
+  unlink(rec);
+  _staleCount += stale ? 1 : -1;
+  if(stale) {
+    _policy->removed(rec);
+    _analytics.uncached(rec->frame);
+  } else {
+    _policy->added(rec);
+    _analytics.cached(rec->frame, rec->level);
+  }
+  rec->stale = stale;
+  pushNewest(rec);
+}
+
+/*!
+ * Scale stale full resolution frames in a range to the frame size, so they don't have to be decoded
+ * again.  Only frames at least as big as the new size are scaled, a smaller frame would look soft.  The
+ * stale frame is pinned while it's scaled outside of the lock.
+ * @return the number of frames scaled
+ */
+int VideoCache::rescaleStale(int first, int last) {
+  SwsContext* scaler = nullptr;
+  int rescaled = 0;
+  for(int frame = first; frame <= last; frame++) {
+    FrameRecord* stale;
+    int width, height;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if(!_staleCount) break;
+      auto kv = _frameMap.find(frame);
+      if(kv == _frameMap.end()) continue;
+      stale = kv->second;
+      if(!stale->stale || stale->level || stale->width < _width || stale->height < _height) continue;
+      stale->pins++;
+      width = _width;
+      height = _height;
+    }
+
+    FrameRecord* rec = _allocator.alloc(frame, getFrameBytes(width, height), 0);
+    rec->pins = 0;
+    rec->width = width;
+    rec->height = height;
+    rec->redecodeMs = stale->redecodeMs;
+    scaler = sws_getCachedContext(scaler, stale->width, stale->height, AV_PIX_FMT_YUV420P, width, height,
+                                  AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if(scaler) {
+      int srcChroma = (stale->width + 1) / 2;
+      int dstChroma = (width + 1) / 2;
+      const uint8_t* src[3] = {stale->data, stale->data + stale->width * stale->height,
+                               stale->data + stale->width * stale->height + srcChroma * ((stale->height + 1) / 2)};
+      uint8_t* dst[3] = {rec->data, rec->data + width * height,
+                         rec->data + width * height + dstChroma * ((height + 1) / 2)};
+      const int srcStrides[3] = {stale->width, srcChroma, srcChroma};
+      const int dstStrides[3] = {width, dstChroma, dstChroma};
+      sws_scale(scaler, src, srcStrides, 0, stale->height, dst, dstStrides);
+    }
+
+    std::vector<FrameRecord*> cleaned;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      stale->pins--;
+      if(stale->detached && !stale->pins) cleaned.push_back(stale);
+      if(!scaler || !matchesSize(rec)) {
+        cleaned.push_back(rec);
+      } else if(insertRecord(rec, cleaned)) {
+        _stats.rescaled++;
+        rescaled++;
+      }
+    }
+    finishCleaning(cleaned);
+  }
+  sws_freeContext(scaler);
+  return rescaled;
+}
+
+/*!
+ * Tell the cache where the playhead is, for picking which frames to keep at full resolution and which
+ * to clean
+ * @param radius : frames on each side of the playhead to keep at full resolution
+ * @param direction : 1 or -1 as the playhead is moving, 0 if it's paused
+ */
+void VideoCache::setPlayhead(int frame, int radius, int direction) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _playhead = frame;
+  _fullRadius = radius;
+  _policy->setPlayhead(frame, direction);
+}
+
+/*!
+ * Change how frames are picked to be cleaned.  The cache takes the policy over.
+ */
+void VideoCache::setEvictionPolicy(EvictionPolicy *policy) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  policy->setPlayhead(_playhead, 0);
+  _policy.reset(policy);
+  for(auto& kv : _frameMap) {
+    if(!kv.second->stale) _policy->added(kv.second);
+  }
+}
+
+const char* VideoCache::getEvictionPolicyName() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _policy->getName();
+}
+
+void VideoCache::freeRecords(std::vector<FrameRecord*>& records) {
+  for(auto* rec : records) {
+    _allocator.free(rec);
+  }
+  records.clear();
+}
+
+/*!
+ * Set aside memory for the whole budget up front, as slots for frames of a fixed size, so caching a frame
+ * doesn't go to the heap.  Call after setFrameSize() and enableProxies(), so the slots are split for the
+ * frames we'll cache first.
+ * @param slotSize : size of a slot, the biggest frame the cache will be given, normally the source's
+ * @return false if the memory couldn't be reserved, in which case frames come from the heap
+ */
+bool VideoCache::reserveFrames(uint64_t slotSize) {
+  std::vector<uint64_t> levelSizes = {slotSize};
+  int slotCount;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(int level = 0; _width && level < (_proxies ? cacheLevels : 1); level++) {
+      if(getLevelBytes(level) < slotSize) levelSizes.push_back(getLevelBytes(level));
+    }
+    slotCount = (int)(_maxMemory / (slotSize + sizeof(FrameRecord))) + slabSpareFrames;
+  }
+  return _allocator.reserve(slotCount, levelSizes);
+}
+
+/*!
+ * Give back the pages of free slab slots the budget no longer needs, after it was cut
+ * @param maxBytes : release at most about this much
+ * @return bytes released
+ */
+uint64_t VideoCache::releaseMemory(uint64_t maxBytes) {
+  FrameAllocatorStats stats = _allocator.getStats();
+  uint64_t resident = (uint64_t)(stats.slots - stats.releasedSlots) * stats.slotSize;
+  uint64_t needed = getMaxBytes() + slabSpareFrames * stats.slotSize;
+  if(resident <= needed) return 0;
+  return _allocator.releaseFree(std::min(maxBytes, resident - needed));
+}
+
+/*!
+ * Change the memory budget, cleaning frames if we are now over it.
+ * @param maxBytes : new budget, in bytes
+ */
+void VideoCache::setMaxBytes(uint64_t maxBytes) {
+  std::vector<FrameRecord*> cleaned;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _maxMemory = maxBytes;
+    cleanToBudget(cleaned);
+  }
+  finishCleaning(cleaned);
+}
+
+/*!
+ * Check if a frame is in the cache without changing its age
+ * @param maxLevel : lowest resolution that counts, full resolution only by default
+ */
+bool VideoCache::hasFrame(int frame, int maxLevel) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto kv = _frameMap.find(frame);
+  return kv != _frameMap.end() && kv->second->level <= maxLevel && !kv->second->stale;
+}
+
+/*!
+ * Get the numbers of all cached frames, in no particular order
+ */
+std::vector<int> VideoCache::getCachedFrames() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::vector<int> frames;
+  frames.reserve(_frameMap.size());
+  for(auto& kv : _frameMap) {
+    if(!kv.second->stale) frames.push_back(kv.first);
+  }
+  return frames;
+}
+
+/*!
+ * get a frame from the cache and update is age. null if it isn't in the cache.
+ * The frame is pinned, and won't be cleaned until it is given back with releaseFrame().
+ */
+FrameRecord* VideoCache::getFrame(int frame) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto kv = _frameMap.find(frame);
+  if(kv != _frameMap.end() && kv->second->level == 0 && !kv->second->stale) {
+    FrameRecord* rec = kv->second;
+    _analytics.reuse(_useCount - rec->use_id);
+    rec->use_id = _useCount++;
+    rec->pins++;
+    _stats.ramHits++;
+    if(rec != _newest[0]) {
+      unlink(rec);
+      pushNewest(rec);
+    }
+    return rec;
+  }
+  _stats.ramMisses++;
+  return nullptr;
+}
+
+/*!
+ * Get whatever copy of a frame we have, after getFrame() missed.  Pinned like getFrame().
+ * @return the record, check its level for the resolution, or null if there's no copy at all
+ */
+FrameRecord* VideoCache::getProxy(int frame) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto kv = _frameMap.find(frame);
+  if(kv == _frameMap.end() || kv->second->stale) {
+    _stats.proxyMisses++;
+    return nullptr;
+  }
+
+  FrameRecord* rec = kv->second;
+  rec->use_id = _useCount++;
+  rec->pins++;
+  if(rec->level) _stats.proxyHits++;
+  unlink(rec);
+  pushNewest(rec);
+  return rec;
+}
+
+/*!
+ * Pin a full resolution frame like getFrame() does, without counting it as a hit or miss
+ * @return the record, or null if it isn't in the cache
+ */
+FrameRecord* VideoCache::pinFrame(int frame) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto kv = _frameMap.find(frame);
+  if(kv == _frameMap.end() || kv->second->level || kv->second->stale) return nullptr;
+  kv->second->pins++;
+  return kv->second;
+}
+
+/*!
+ * Pin a record which is already pinned, so it can be handed to someone else who releases it separately
+ */
+void VideoCache::pinFrame(FrameRecord *rec) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  rec->pins++;
+}
+
+/*!
+ * Release a frame returned by getFrame(), getProxy(), pinFrame() or insertFrame()
+ */
+void VideoCache::releaseFrame(FrameRecord *rec) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    rec->pins--;
+    if(!rec->detached || rec->pins) return;
+  }
+
+  // it was replaced while we had it
+  _allocator.free(rec);
+}
+
+/*!
+ * Remove a record from its level's use list, or stale list if it's stale
+ */
+void VideoCache::unlink(FrameRecord *rec) {
+  if(rec->prev) rec->prev->next = rec->next;
+  else (rec->stale ? _staleNewest : _newest)[rec->level] = rec->next;
+
+  if(rec->next) rec->next->prev = rec->prev;
+  else (rec->stale ? _staleOldest : _oldest)[rec->level] = rec->prev;
+
+  rec->prev = nullptr;
+  rec->next = nullptr;
+}
+
+/*!
+ * Put a record at the front of its level's use list, or stale list if it's stale
+ */
+void VideoCache::pushNewest(FrameRecord *rec) {
+  FrameRecord*& newest = (rec->stale ? _staleNewest : _newest)[rec->level];
+  FrameRecord*& oldest = (rec->stale ? _staleOldest : _oldest)[rec->level];
+  rec->prev = nullptr;
+  rec->next = newest;
+  if(newest) newest->prev = rec;
+  newest = rec;
+  if(!oldest) oldest = rec;
+}
+
+/*!
+ * Add a spill tier below this cache, with a thread to write cleaned frames to it.
+ * @param path : scratch file to create
+ * @param maxBytes : size of the scratch file
+ * @param frameSize : size of each frame
+ * @return false if the scratch file couldn't be set up, in which case cleaned frames are just freed
+ */
+bool VideoCache::enableSpill(const std::string &path, uint64_t maxBytes, uint64_t frameSize) {
+  auto* spill = new SpillCache;
+  if(!spill->open(path, maxBytes, frameSize)) {
+    delete spill;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _spill = spill;
+  _spillRunning = true;
+  _spillThread = std::thread(&VideoCache::spillLoop, this);
+  return true;
+}
+
+/*!
+ * Write cleaned frames to the spill tier, then free them
+ */
+void VideoCache::spillLoop() {
+  TRACE_THREAD("spill");
+  std::unique_lock<std::mutex> lock(_mutex);
+  while(true) {
+    _spillCv.wait(lock, [this] { return !_spillRunning || !_spillQueue.empty(); });
+    if(!_spillRunning) return;
+
+    FrameRecord* rec = _spillQueue.front();
+    _spillQueue.pop_front();
+
+    lock.unlock();
+    _spill->write(rec->frame, rec->data);
+    _allocator.free(rec);
+    lock.lock();
+
+    _stats.spillWrites++;
+  }
+}
+
+/*!
+ * Bring a frame back into RAM from the spill tier.  Call this on a RAM miss, before decoding the frame.
+ * @return true if the frame is now in RAM
+ */
+bool VideoCache::loadFromSpill(int frame) {
+  std::vector<FrameRecord*> cleaned;
+  bool reclaimed = false;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // the spill tier only has frames of the size it was opened for
+    if(!_spill || (_width && getLevelBytes(0) != _spill->getFrameSize())) return false;
+    auto kv = _frameMap.find(frame);
+    if(kv != _frameMap.end() && kv->second->level == 0 && !kv->second->stale) return true;
+
+    // it may still be waiting to be written, in which case we can just take it back
+    for(auto it = _spillQueue.begin(); it != _spillQueue.end(); ++it) {
+      if((*it)->frame == frame && matchesSize(*it)) {
+        FrameRecord* rec = *it;
+        _spillQueue.erase(it);
+        insertRecord(rec, cleaned);
+        _stats.spillHits++;
+        reclaimed = true;
+        break;
+      }
+    }
+  }
+  if(reclaimed) {
+    finishCleaning(cleaned);
+    return true;
+  }
+
+  if(!_spill->hasFrame(frame)) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.spillMisses++;
+    return false;
+  }
+
+  // read it into a new record outside of the lock
+  FrameRecord* rec = _allocator.alloc(frame, _spill->getFrameSize(), 0);
+  rec->pins = 0;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    rec->width = _width;
+    rec->height = _height;
+  }
+
+  Timer readTimer;
+  bool found;
+  {
+    TRACE_SCOPE(TRACE_SPILL_READ);
+    found = _spill->read(frame, rec->data);
+  }
+  double readMs = readTimer.getMs();
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(found && !matchesSize(rec)) {
+      // the frame size changed while we were reading
+      cleaned.push_back(rec);
+      found = false;
+    } else if(found) {
+      _stats.spillHits++;
+      _stats.spillReadMs += readMs;
+      insertRecord(rec, cleaned);
+    } else {
+      // it was replaced between checking and reading
+      _stats.spillMisses++;
+      cleaned.push_back(rec);
+    }
+  }
+  finishCleaning(cleaned);
+  return found;
+}
+
+CacheTierStats VideoCache::getStats() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+/*!
+ * Add the counters to the analytics timeline.  Call about once a second.
+ */
+void VideoCache::sampleAnalytics() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  CacheSample sample;
+  sample.hits = _stats.ramHits;
+  sample.misses = _stats.ramMisses;
+  sample.inserts = _stats.inserts;
+  sample.evictions = _stats.evictions;
+  sample.redecodes = _stats.redecodes;
+  _analytics.sample(sample);
+}
+
+/*!
+ * Write the counters and analytics as a JSON object.  They're copied under the lock and written outside
+ * of it, leaving out the per frame history so the copy doesn't grow with the clip.
+ */
+void VideoCache::writeAnalytics(FILE *out) {
+  CacheSample totals;
+  CacheAnalytics analytics;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    totals.seconds = _analytics.getSeconds();
+    totals.hits = _stats.ramHits;
+    totals.misses = _stats.ramMisses;
+    totals.inserts = _stats.inserts;
+    totals.evictions = _stats.evictions;
+    totals.redecodes = _stats.redecodes;
+    analytics.copyLogs(_analytics);
+  }
+  analytics.writeJson(out, totals);
+}
+
+/*!
+ * Get what the cache timeline shows for each frame: cached at full resolution or as a proxy, evicted,
+ * or neither.  Covers every frame the cache has seen.  The states are kept as frames come and go, so
+ * this only copies them.
+ * @param states : set to a TimelineState for each frame
+ */
+void VideoCache::getFrameStates(std::vector<uint8_t> &states) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  states = _analytics.getStates();
+}
@@ -0,0 +1,221 @@
+#ifndef VIDEOPLAYER_VIDEOCACHE_H
+#define VIDEOPLAYER_VIDEOCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "CacheAnalytics.h"
+#include "FrameAllocator.h"
+#include "PixelConverter.h"
+#include "SpillCache.h"
+
+// resolutions a frame can be cached at: full, half and quarter
+static const int cacheLevels = 3;
+
+class EvictionPolicy;
+
+/*!
+ * A record of a frame which is cached.
+ * Records are also linked into a list ordered by most recent use, so the least recently used frame
+ * can be found without searching the map.  There is a list for each level.
+ */
+struct FrameRecord {
+  uint8_t* data;
+  int frame;
+  int pins; // number of getFrame() users which haven't released it yet, pinned frames aren't cleaned
+  int level = 0;         // 0 for full resolution, each level halves the width and height
+  int width = 0;         // size of the picture in data
+  int height = 0;
+  bool demoting = false; // being replaced with a copy a level down, pinned until that's done
+  bool detached = false; // replaced while pinned, freed by the last releaseFrame()
+  bool stale = false;    // made for a frame size the cache has since moved away from
+  float redecodeMs = 0;  // time it took to decode from its GOP's keyframe, 0 if we don't know
+  uint64_t use_id;
+  uint64_t size;
+  FrameRecord* prev; // more recently used neighbor
+  FrameRecord* next; // less recently used neighbor
+};
+
+
+/*!
+ * Hit counts and read latency for each cache tier
+ */
+struct CacheTierStats {
+  uint64_t ramHits = 0;
+  uint64_t ramMisses = 0;
+  uint64_t spillHits = 0;   // RAM misses found in the spill tier
+  uint64_t spillMisses = 0; // RAM misses which had to be decoded
+  uint64_t spillWrites = 0;
+  uint64_t spillDrops = 0;  // frames cleaned while the spill thread was behind, so never written
+  double spillReadMs = 0;   // total time spent reading from the spill tier
+  uint64_t proxyHits = 0;   // RAM misses shown from a smaller copy of the frame
+  uint64_t proxyMisses = 0;
+  uint64_t demotions = 0;   // frames replaced with a smaller copy instead of being cleaned
+  uint64_t inserts = 0;
+  uint64_t evictions = 0;   // frames cleaned from RAM, proxies included
+  uint64_t redecodes = 0;   // frames decoded again after their full resolution copy was evicted or demoted
+  uint64_t rescaled = 0;    // stale frames scaled to a new frame size instead of being decoded again
+  uint64_t levelFrames[cacheLevels] = {};
+  uint64_t levelBytes[cacheLevels] = {};
+
+  void add(const CacheTierStats& other) {
+    ramHits += other.ramHits;
+    ramMisses += other.ramMisses;
+    spillHits += other.spillHits;
+    spillMisses += other.spillMisses;
+    spillWrites += other.spillWrites;
+    spillDrops += other.spillDrops;
+    spillReadMs += other.spillReadMs;
+    proxyHits += other.proxyHits;
+    proxyMisses += other.proxyMisses;
+    demotions += other.demotions;
+    inserts += other.inserts;
+    evictions += other.evictions;
+    redecodes += other.redecodes;
+    rescaled += other.rescaled;
+    for(int level = 0; level < cacheLevels; level++) {
+      levelFrames[level] += other.levelFrames[level];
+      levelBytes[level] += other.levelBytes[level];
+    }
+  }
+
+  double getSpillReadAvgMs() { return spillHits ? spillReadMs / spillHits : 0; }
+  double getProxyHitRate() { return (double)proxyHits / std::max<uint64_t>(1, proxyHits + proxyMisses); }
+};
+
+
+/*!
+ * A collection of decoded frames.
+ * The cache is shared between the decode thread, which adds frames, and the render thread, which reads
+ * them.  Frame data is copied and freed outside of the lock, so the lock is only held for bookkeeping.
+ *
+ * Optionally, frames cleaned from RAM are handed to a spill thread, which writes them to a SpillCache
+ * on disk.  loadFromSpill() brings them back on a RAM miss, which is much cheaper than decoding them.
+ *
+ * With proxies enabled, frames away from the playhead are scaled down to half and then quarter
+ * resolution instead of being cleaned, and only the quarter size proxies are ever cleaned, unless
+ * nothing else is left.  A proxy can be shown while the full frame is decoded again.  Only full
+ * resolution frames count for hasFrame(), getFrame() and pinFrame(), so the decoders don't skip frames
+ * we only have proxies of.
+ *
+ * Alongside the hit counts, a CacheAnalytics records reuse distances, evictions and re-decodes, and
+ * samples the counters into a timeline with sampleAnalytics().
+ *
+ * Frames are cached at the decoders' output size, which follows the window.  When setFrameSize() changes
+ * it, the frames already cached go stale: they are never hits, and are cleaned before anything else.
+ * rescaleStale() scales the ones the decoders are about to need down to the new size, so the cache is
+ * rebuilt a GOP at a time around the playhead rather than decoded again.  Frames only spill while they
+ * are the size the spill tier was opened for.
+ *
+ * Which frame goes when the cache is over budget is up to an EvictionPolicy, the least recently used
+ * one unless setEvictionPolicy() says otherwise.
+ */
+class VideoCache {
+public:
+  explicit VideoCache(uint64_t maxMemory);
+  ~VideoCache();
+  void addFrame(uint8_t* data, uint64_t size, int frame);
+  FrameRecord* allocFrame(int frame, int width, int height);
+  FrameRecord* insertFrame(FrameRecord* rec);
+  bool enableSpill(const std::string& path, uint64_t maxBytes, uint64_t frameSize);
+  bool loadFromSpill(int frame);
+  void enableProxies();
+  void setFrameSize(int width, int height);
+  int rescaleStale(int first, int last);
+  bool reserveFrames(uint64_t slotSize);
+  FrameAllocatorStats getAllocatorStats() { return _allocator.getStats(); }
+  uint64_t releaseMemory(uint64_t maxBytes);
+  void setPlayhead(int frame, int radius, int direction = 0);
+  void setEvictionPolicy(EvictionPolicy* policy);
+  const char* getEvictionPolicyName();
+  static void getLevelSize(int level, int& width, int& height);
+  static uint64_t getFrameBytes(int width, int height);
+  CacheTierStats getStats();
+  void sampleAnalytics();
+  void writeAnalytics(FILE* out);
+  void getFrameStates(std::vector<uint8_t>& states);
+  void setMaxBytes(uint64_t maxBytes);
+  bool hasFrame(int frame, int maxLevel = 0);
+  std::vector<int> getCachedFrames();
+
+  double getMB() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _totalMemUse / (1024. * 1024.);
+  }
+
+  uint64_t getMaxBytes() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _maxMemory;
+  }
+
+  size_t getFrameCount() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _frameMap.size();
+  }
+
+  FrameRecord* getFrame(int frame);
+  FrameRecord* getProxy(int frame);
+  FrameRecord* pinFrame(int frame);
+  void pinFrame(FrameRecord* rec);
+  void releaseFrame(FrameRecord* rec);
+private:
+  bool insertRecord(FrameRecord* rec, std::vector<FrameRecord*>& cleaned);
+  void removeRecord(FrameRecord* rec, std::vector<FrameRecord*>& cleaned);
+  void account(FrameRecord* rec, int sign);
+  bool matchesSize(const FrameRecord* rec);
+  FrameRecord* cleanFrame();
+  FrameRecord* findStale();
+  FrameRecord* findDemotable();
+  void cleanToBudget(std::vector<FrameRecord*>& cleaned);
+  void queueSpill(FrameRecord* rec, std::vector<FrameRecord*>& cleaned);
+  void finishCleaning(std::vector<FrameRecord*>& cleaned);
+  void demote(FrameRecord* rec);
+  void downscale(const uint8_t* src, int width, int height, uint8_t* dst);
+  uint64_t getLevelBytes(int level);
+  void freeRecords(std::vector<FrameRecord*>& records);
+  void unlink(FrameRecord* rec);
+  void pushNewest(FrameRecord* rec);
+  void setStale(FrameRecord* rec, bool stale);
+  void spillLoop();
+
+  std::mutex _mutex;
+  FrameAllocator _allocator; // has its own lock, so records are allocated and freed outside of ours
+  std::unordered_map<int, FrameRecord*> _frameMap;
+  FrameRecord* _newest[cacheLevels] = {}; // heads of the use lists
+  FrameRecord* _oldest[cacheLevels] = {}; // tails of the use lists, next to be cleaned
+  FrameRecord* _staleNewest[cacheLevels] = {}; // stale records are moved off the use lists to these
+  FrameRecord* _staleOldest[cacheLevels] = {}; // tails of the stale lists, cleaned before the use lists
+  uint64_t _totalMemUse = 0;
+  uint64_t _demotingBytes = 0; // what the demotions in progress will save
+  uint64_t _useCount = 0;
+  uint64_t _maxMemory; // in bytes
+  int _staleCount = 0; // records in the map which are stale
+
+  // spill tier, _spillQueue and stats are protected by _mutex
+  SpillCache* _spill = nullptr;
+  std::thread _spillThread;
+  std::condition_variable _spillCv;
+  std::deque<FrameRecord*> _spillQueue; // cleaned frames waiting to be written
+  bool _spillRunning = false;
+  CacheTierStats _stats;
+  CacheAnalytics _analytics;
+
+  // frame size and proxies, protected by _mutex except the converter, which doesn't change
+  bool _proxies = false;
+  int _width = 0;        // full resolution frame size, 0 until it's set, when frames of any size go
+  int _height = 0;
+  int _playhead = 0;
+  int _fullRadius = 0;   // frames within this of the playhead are kept at full resolution
+  std::unique_ptr<EvictionPolicy> _policy; // picks the frames to clean
+  PixelConverter _converter;
+};
+
+#endif //VIDEOPLAYER_VIDEOCACHE_H
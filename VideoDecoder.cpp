@@ -0,0 +1,665 @@
+#include "VideoDecoder.h"
+#include "Timer.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <algorithm>
+
+/*!
+ * construct a new decoder.  Call open() before using it.
+ * @param fileName : name of file to open
+ * @param cache : cache to add decoded frames to
+ */
+VideoDecoder::VideoDecoder(const std::string &fileName, VideoCache &cache) : _name(fileName), _cache(cache) {
+
+}
+
+VideoDecoder::~VideoDecoder() {
+  if(_convertedRecord) _cache.releaseFrame(_convertedRecord);
+  if(_convert) sws_freeContext(_convert);
+  if(_frame) av_frame_free(&_frame);
+  if(_codecContext) avcodec_close(_codecContext);
+  if(_context) avformat_close_input(&_context);
+}
+
+/*!
+ * Open the file and set up the codec
+ * @return false if the file can't be decoded
+ */
+bool VideoDecoder::open() {
+
+  // setup libs
+  av_register_all();
+  avformat_network_init(); // todo remove me?
+  _context = avformat_alloc_context();
+
+  // read through our own mapping and readahead thread if we can, otherwise FFmpeg opens the file
+  if(_readMode == READ_MMAP && _reader.open(_name)) {
+    _context->pb = _reader.getContext();
+  }
+
+  // open and set up codec
+  if(avformat_open_input(&_context, _name.c_str(), nullptr, nullptr)) {
+    printf("failed to open file\n");
+    return false;
+  }
+
+  if(avformat_find_stream_info(_context, nullptr) < 0) {
+    printf("Invalid file\n");
+    return false;
+  }
+
+  for(unsigned int i = 0; i < _context->nb_streams; i++) {
+    if(_context->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+      _videoStreamIdx = i;
+      break;
+    }
+  }
+
+  if(_videoStreamIdx == -1) {
+    printf("Failed to find video data\n");
+    return false;
+  }
+
+  printf("Stream %d contains video data\n", _videoStreamIdx);
+
+  // the index gives exact frame numbers and keyframe positions, so seeks land first time
+  if(_useIndex && _index.open(_name, _videoStreamIdx)) {
+    _lastFrame = _index.getFrameCount() - 1;
+  }
+
+  _codecContext = _context->streams[_videoStreamIdx]->codec;
+  _codec = avcodec_find_decoder(_codecContext->codec_id);
+
+  if(!_codec) {
+    printf("Failed to find codec\n");
+    return false;
+  }
+
+  if(avcodec_open2(_codecContext, _codec, nullptr) < 0) {
+    printf("failed to open codec\n");
+    _codecContext = nullptr;
+    return false;
+  }
+
+  // allocate output frame
+  _frame = av_frame_alloc();
+
+  printf("codec w: %d h: %d\n", _codecContext->width, _codecContext->height);
+
+  _sourceWidth = _width = _codecContext->width;
+  _sourceHeight = _height = _codecContext->height;
+  _frameDataSize = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, _width, _height, 1);
+
+  printf("frame size: %ld bytes (%.3f MB)\n", _frameDataSize, _frameDataSize / (1024. * 1024.));
+
+
+  printf("info-------\n");
+  av_dump_format(_context, 0, _name.c_str(), 0);
+  printf("-----------\n\n\n");
+
+  _timeBase = (int64_t(_codecContext->time_base.num) * AV_TIME_BASE) / int64_t(_codecContext->time_base.den);
+
+  return true;
+}
+
+int64_t VideoDecoder::ptsToFrame(int64_t pts) {
+  if(_index.isLoaded()) return _index.getFrameForPts(pts);
+  return (pts - _ptsZero) / _seekTimeBase;
+}
+
+int64_t VideoDecoder::frameToPts(int frame) {
+  if(_index.isLoaded()) return _index.getPts(std::max(0, std::min(frame, _index.getFrameCount() - 1)));
+  return _ptsZero + (frame * _seekTimeBase);
+}
+
+/*!
+ * Get the closest keyframe at or before a frame.  Without an index, we only know the keyframes we've
+ * decoded so far.
+ * @return the keyframe, or -1 if we don't know of one
+ */
+int VideoDecoder::getKeyframeBefore(int frame) {
+  if(_index.isLoaded()) return _index.getKeyframeBefore(frame);
+  auto it = _keyframes.upper_bound(frame);
+  if(it == _keyframes.begin()) return -1;
+  return *(--it);
+}
+
+/*!
+ * Get the first keyframe after a frame.  Without an index, we only know the keyframes we've decoded so far.
+ * @return the keyframe, or -1 if we don't know of one
+ */
+int VideoDecoder::getKeyframeAfter(int frame) {
+  if(_index.isLoaded()) return _index.getKeyframeAfter(frame);
+  auto it = _keyframes.upper_bound(frame);
+  if(it == _keyframes.end()) return -1;
+  return *it;
+}
+
+/*!
+ * Start reading the GOP a frame is in, ahead of the demuxer, so seeking there doesn't wait on the disk.
+ * Does nothing without the index, which has the GOP's byte range, or when FFmpeg reads the file.
+ */
+void VideoDecoder::prefetch(int frame) {
+  if(!_index.isLoaded() || !_reader.getContext()) return;
+
+  int keyframe = _index.getKeyframeBefore(std::max(0, std::min(frame, _index.getFrameCount() - 1)));
+  if(keyframe < 0 || _index.getPos(keyframe) < 0) return;
+  int nextKeyframe = _index.getKeyframeAfter(keyframe);
+  int64_t start = _index.getPos(keyframe);
+  int64_t end = nextKeyframe >= 0 ? _index.getPos(nextKeyframe) : INT64_MAX;
+  if(end <= start) return;
+  _reader.prefetch(start, end - start);
+}
+
+/*!
+ * Change which frames the decoder skips.  Takes effect from the next packet.
+ */
+void VideoDecoder::setSkip(DecodeSkip skip) {
+  if(skip == _skip) return;
+
+  // frames after the skipped ones refer to pictures we never decoded, so they'd come out wrong
+  if(_skip == DECODE_KEYFRAMES) _mustSeek = true;
+
+  _skip = skip;
+  switch(skip) {
+    case DECODE_ALL:
+      _codecContext->skip_frame = AVDISCARD_DEFAULT;
+      break;
+    case DECODE_REFERENCE:
+      _codecContext->skip_frame = AVDISCARD_NONREF;
+      break;
+    case DECODE_KEYFRAMES:
+      _codecContext->skip_frame = AVDISCARD_NONKEY;
+      break;
+  }
+}
+
+/*!
+ * Let a seek be given up on part way, for when whoever asked for the frame wants another one now.  Seeks
+ * check between frames, and stop with the decoder where it got to.  Every frame decoded on the way is
+ * cached as usual.
+ * @param generation : counter which moves on when the frame is no longer wanted, null never to give up
+ * @param current : its value while the frame is still wanted
+ */
+void VideoDecoder::setCancel(const std::atomic<uint32_t> *generation, uint32_t current) {
+  _cancelGeneration = generation;
+  _cancelCurrent = current;
+}
+
+/*!
+ * Set the size frames are converted to, for showing them smaller than the source.  The codec decodes at
+ * the smallest fraction of the source (lowres) which still covers the output, if it can, and skips the
+ * loop filter on frames nothing refers to once the output is half the source or less.  Changing lowres
+ * reopens the codec, so the next frame starts again from a keyframe.
+ * @param width, height : output size, keeping the source's aspect.  0 or anything bigger than the source
+ *                        is the source's size.
+ */
+void VideoDecoder::setOutputSize(int width, int height) {
+  if(width <= 0 || height <= 0 || width > _sourceWidth || height > _sourceHeight) {
+    width = _sourceWidth;
+    height = _sourceHeight;
+  }
+  if(width == _width && height == _height) return;
+  _width = width;
+  _height = height;
+  _frameDataSize = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
+
+  // the frame we have was converted at the old size
+  if(_convertedRecord) _cache.releaseFrame(_convertedRecord);
+  _convertedRecord = nullptr;
+  _convertedFrame = -1;
+
+  int lowres = 0;
+  while(lowres < _codec->max_lowres && (_sourceWidth >> (lowres + 1)) >= width &&
+        (_sourceHeight >> (lowres + 1)) >= height) {
+    lowres++;
+  }
+  if(lowres != _codecContext->lowres) {
+    // the codec only takes lowres when it's opened
+    avcodec_close(_codecContext);
+    _codecContext->lowres = lowres;
+    if(avcodec_open2(_codecContext, _codec, nullptr) < 0) {
+      printf("failed to reopen codec at lowres %d\n", lowres);
+      _codecContext->lowres = 0;
+      avcodec_open2(_codecContext, _codec, nullptr);
+    }
+    _mustSeek = true;
+  }
+  _codecContext->skip_loop_filter = width * 2 <= _sourceWidth ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+}
+
+/*!
+ * Read packets and decode until the decoder has a picture in _frame.
+ * @param frame : set to the number of the decoded frame
+ * @return false if we reached the end of the file
+ */
+bool VideoDecoder::decodeNextFrame(int &frame) {
+  Timer timer;
+  AVPacket packet;
+  int readyToDisplay = 0;
+  int64_t pts = 0, duration = 0;
+
+  while(!readyToDisplay) { // until got picture
+
+    if(!readPacket(packet)) {
+      // drain pictures the decoder is still holding on to for reordering
+      av_init_packet(&packet);
+      packet.data = nullptr;
+      packet.size = 0;
+      TRACE_SCOPE(TRACE_DECODE);
+      avcodec_decode_video2(_codecContext, _frame, &readyToDisplay, &packet);
+      if(!readyToDisplay) return false;
+      pts = av_frame_get_best_effort_timestamp(_frame);
+      break;
+    }
+
+    int result;
+    {
+      TRACE_SCOPE(TRACE_DECODE);
+      result = avcodec_decode_video2(_codecContext, _frame, &readyToDisplay, &packet);
+    }
+
+    // with the index we can use the frame's own timestamp, the packet which completed it may be a later one
+    pts = _index.isLoaded() ? av_frame_get_best_effort_timestamp(_frame) : packet.pts;
+    duration = packet.duration;
+    av_packet_unref(&packet);
+
+    if(result < 0) {
+      printf("decode error\n");
+    }
+  }
+
+  if(!_ptsZeroSet) {
+    _ptsZero = pts;
+    _seekTimeBase = duration;
+    _ptsZeroSet = true;
+  }
+
+  frame = ptsToFrame(pts);
+  uint64_t ns = timer.getNs();
+  _decodedFrames++;
+  _decodeNs += ns;
+  if(_frame->key_frame) _gopDecodeNs = 0;
+  _gopDecodeNs += ns;
+  if(_frame->key_frame && !_index.isLoaded()) {
+    _keyframes.insert(frame);
+  }
+  return true;
+}
+
+/*!
+ * Get the next video packet, from the GOP being replayed if there is one, otherwise from the file.
+ * Replay carries on into the following GOP, from memory if that is cached too.
+ * @return false at the end of the file
+ */
+bool VideoDecoder::readPacket(AVPacket &packet) {
+  while(_replayGop) {
+    if(_replayPos < _replayGop->packets.size()) {
+      av_init_packet(&packet);
+      av_packet_ref(&packet, _replayGop->packets[_replayPos++]);
+      return true;
+    }
+
+    int nextKeyframe = _replayGop->nextKeyframe;
+    _replayGop = nullptr;
+    if(nextKeyframe < 0) return false;
+
+    // the decoder isn't flushed, the next GOP follows on from this one
+    seekGop(nextKeyframe);
+  }
+
+  while(true) {
+    TRACE_SCOPE(TRACE_DEMUX);
+    Timer readTimer;
+    int result = av_read_frame(_context, &packet);
+    _ioWaitNs += readTimer.getNs();
+    if(result < 0) {
+      finishRecording(-1);
+      return false;
+    }
+    _fileReads++;
+    _fileBytes += packet.size;
+    if(packet.stream_index == _videoStreamIdx) break;
+    av_packet_unref(&packet);
+  }
+
+  recordPacket(packet);
+  return true;
+}
+
+/*!
+ * Keep a packet read from the file for the packet cache.  A GOP is only cached once we've read it all,
+ * from its keyframe up to the next keyframe.
+ */
+void VideoDecoder::recordPacket(AVPacket &packet) {
+  if(!_packetCache || !_index.isLoaded()) return;
+
+  if(packet.flags & AV_PKT_FLAG_KEY) {
+    int keyframe = _index.getFrameForPts(packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts);
+    finishRecording(keyframe);
+    if(!_packetCache->hasGop(keyframe)) {
+      _recordGop = std::make_shared<PacketGop>();
+      _recordGop->keyframe = keyframe;
+    }
+  }
+
+  if(_recordGop) {
+    _recordGop->packets.push_back(av_packet_clone(&packet));
+    _recordGop->size += sizeof(AVPacket) + packet.size;
+  }
+}
+
+/*!
+ * Add the GOP we've been recording to the packet cache
+ * @param nextKeyframe : keyframe of the GOP after it, -1 at the end of the file
+ */
+void VideoDecoder::finishRecording(int nextKeyframe) {
+  if(!_recordGop) return;
+  _recordGop->nextKeyframe = nextKeyframe;
+  _packetCache->addGop(_recordGop);
+  _recordGop = nullptr;
+}
+
+/*!
+ * Move to the start of a GOP.  If its packets are cached they're replayed, otherwise we seek the file.
+ * @param keyframe : frame number of the GOP's keyframe
+ */
+void VideoDecoder::seekGop(int keyframe) {
+  std::shared_ptr<PacketGop> gop = _packetCache ? _packetCache->getGop(keyframe) : nullptr;
+  if(!gop) {
+    seekFile(_index.getPts(keyframe), AVSEEK_FLAG_BACKWARD);
+    return;
+  }
+
+  _replayGop = gop;
+  _replayPos = 0;
+  _recordGop = nullptr;
+  _mustSeek = false;
+}
+
+/*!
+ * Seek the demuxer, dropping any GOP being replayed or recorded
+ */
+void VideoDecoder::seekFile(int64_t pts, int flags) {
+  TRACE_SCOPE(TRACE_AV_SEEK);
+  av_seek_frame(_context, _videoStreamIdx, pts, flags);
+  _seeks++;
+  _replayGop = nullptr;
+  _recordGop = nullptr;
+  _mustSeek = false;
+}
+
+void VideoDecoder::displayConsecutive() {
+  TRACE_SCOPE(TRACE_CONSECUTIVE);
+  int frame;
+
+  if(!decodeNextFrame(frame)) {
+    printf("couldn't read frame!\n");
+    _lastFrame = _currentDecoderFrame;
+    return;
+  }
+
+  _currentDecoderFrame = frame;
+
+  updateCacheIfNeeded(_currentDecoderFrame);
+}
+
+void VideoDecoder::displaySeekBackward() {
+  TRACE_SCOPE(TRACE_SEEK_BACKWARD);
+  printf("SEEK: %d\n", _decodeFrame);
+
+  int seekTarget = _decodeFrame;   // where we try to seek to
+  int lastSeekTarget = _currentDecoderFrame;   // last place we tried to seek to
+  int seekResult = _decodeFrame + 1; // the result of our most recent seek
+  bool seekZero = false; // if we've tried seeking to zero yet
+
+  while(seekResult > _decodeFrame) { // we want to get a frame before/equal to the desired
+
+    if(seekTarget != _decodeFrame) _seekRetries++;
+    if(seekTarget < 0) {
+      seekTarget = 0;
+      if(seekZero) {
+        printf("warning seek 0 when backward seeking, giving up\n");
+        return;
+      }
+      seekZero = true;
+    }
+
+    // seek to target
+    // printf("  target: %d (last %d)\n", seekTarget, lastSeekTarget);
+    avcodec_flush_buffers(_codecContext);
+    seekFile(frameToPts(seekTarget), lastSeekTarget > seekTarget ? AVSEEK_FLAG_BACKWARD : 0);
+    avcodec_flush_buffers(_codecContext);
+
+    // get packet
+    if(!decodeNextFrame(seekResult)) {
+      // seeked past the end, try further back
+      seekResult = _decodeFrame + 1;
+      lastSeekTarget = seekTarget;
+      seekTarget -= 30;
+      continue;
+    }
+
+    updateCacheIfNeeded(seekResult);
+    // printf("  result: %d\n", seekResult);
+
+    // nobody wants the frame any more, stay where we landed rather than look further back
+    if(seekResult > _decodeFrame && isCancelled()) {
+      _currentDecoderFrame = seekResult;
+      return;
+    }
+
+
+    lastSeekTarget = seekTarget;
+    seekTarget -= 30;
+  }
+
+  // seek forward
+  while(seekResult < _decodeFrame && !isCancelled()) {
+    int frame;
+    if(!decodeNextFrame(frame)) {
+      _lastFrame = seekResult;
+      break;
+    }
+    seekResult = frame;
+    updateCacheIfNeeded(seekResult);
+  }
+
+
+  _currentDecoderFrame = seekResult;
+  // printf("BWD: f %d, f_des %d\n", _currentDecoderFrame, _decodeFrame);
+}
+
+void VideoDecoder::displaySeekForward() {
+  TRACE_SCOPE(TRACE_SEEK_FORWARD);
+  // printf("SEEK: %d\n", _decodeFrame);
+
+  int seekTarget = _decodeFrame;
+  int lastSeekTarget = _currentDecoderFrame;
+  int seekResult = _decodeFrame + 1;
+
+  bool seekZero = false;
+  int landed = _currentDecoderFrame; // frame the decoder is really at
+
+  // seek to keyframe before desired frame
+  while(seekResult > _decodeFrame) {
+    if(seekTarget != _decodeFrame) _seekRetries++;
+    if(seekTarget < 0) {
+      seekTarget = 0;
+      if(seekZero) {
+        // this runs on a decode thread, leave it to the caller to cope with another frame
+        printf("warning seek 0 when forward seeking, giving up\n");
+        _currentDecoderFrame = landed;
+        _mustSeek = true;
+        return;
+      }
+      seekZero = true;
+    }
+
+    // seek to target
+    // printf("  target: %d (last %d)\n", seekTarget, lastSeekTarget);
+    avcodec_flush_buffers(_codecContext);
+    seekFile(frameToPts(seekTarget), lastSeekTarget > seekTarget ? AVSEEK_FLAG_BACKWARD : 0);
+    avcodec_flush_buffers(_codecContext);
+
+
+    // get packet
+    if(!decodeNextFrame(seekResult)) {
+      // seeked past the end, try further back
+      seekResult = _decodeFrame + 1;
+      lastSeekTarget = seekTarget;
+      seekTarget -= 30;
+      continue;
+    }
+    landed = seekResult;
+
+
+    //updateCacheIfNeeded(seekResult);
+    // printf("  result: %d\n", seekResult);
+
+    if(seekResult > _decodeFrame && isCancelled()) {
+      _currentDecoderFrame = seekResult;
+      return;
+    }
+
+
+    lastSeekTarget = seekTarget;
+    seekTarget -= 30;
+  }
+
+  // seek forward
+  while(seekResult < _decodeFrame && !isCancelled()) {
+    int frame;
+    if(!decodeNextFrame(frame)) {
+      _lastFrame = seekResult;
+      break;
+    }
+    seekResult = frame;
+    updateCacheIfNeeded(seekResult);
+  }
+
+
+  _currentDecoderFrame = seekResult;
+  // printf("FWD: f %d, f_des %d\n", _currentDecoderFrame, _decodeFrame);
+}
+
+/*!
+ * Seek using the index: one seek straight to the keyframe before the frame, then decode up to it.  If
+ * the decoder is already in front of the frame in the same GOP, we don't need to seek at all.  If the
+ * GOP's packets are cached, the file isn't touched.
+ */
+void VideoDecoder::displaySeekIndexed() {
+  TRACE_SCOPE(TRACE_SEEK_INDEXED);
+  int keyframe = _index.getKeyframeBefore(_decodeFrame);
+  if(keyframe < 0) keyframe = 0;
+
+  bool seek = _mustSeek || _currentDecoderFrame < keyframe || _currentDecoderFrame >= _decodeFrame;
+  if(seek) {
+    avcodec_flush_buffers(_codecContext);
+    seekGop(keyframe);
+    avcodec_flush_buffers(_codecContext);
+  }
+
+  int frame = _currentDecoderFrame;
+  bool first = true;
+  do {
+    if(!decodeNextFrame(frame)) return;
+
+    // the demuxer put us after the frame, fall back to searching for a keyframe
+    if(seek && first && frame > _decodeFrame) {
+      printf("indexed seek to %d landed on %d\n", _decodeFrame, frame);
+      _seekRetries++;
+      displaySeekBackward();
+      return;
+    }
+    first = false;
+
+    _currentDecoderFrame = frame;
+    updateCacheIfNeeded(frame);
+  } while(frame < _decodeFrame && !isCancelled());
+}
+
+/*!
+ * Decode a frame.  Afterward getCurrentFrame() is the frame we got, which is normally the one asked for,
+ * or where the decoder stopped if the seek was cancelled (see setCancel()).
+ */
+void VideoDecoder::seekTo(int frame) {
+  TRACE_SCOPE(TRACE_SEEK_TO);
+  _decodeFrame = frame;
+
+  // the first frame tells us how timestamps map to frame numbers, which seeking needs
+  if(!_ptsZeroSet && !_index.isLoaded()) {
+    displayConsecutive();
+    if(!_ptsZeroSet || _currentDecoderFrame == frame) return;
+  }
+
+  if(frame == _currentDecoderFrame + 1 && !_mustSeek) {
+    displayConsecutive();
+  } else if(_index.isLoaded()) {
+    displaySeekIndexed();
+  } else if(frame > _currentDecoderFrame) {
+    displaySeekForward();
+  } else {
+    displaySeekBackward();
+  }
+  if(_currentDecoderFrame != frame && isCancelled()) _cancelledSeeks++;
+}
+
+/*!
+ * Get the current frame converted to YUV420P.  The record is pinned by the decoder until it converts
+ * another frame, pin it again to keep it longer.
+ */
+FrameRecord* VideoDecoder::getConvertedFrame() {
+  if(_convertedFrame != _currentDecoderFrame) {
+    updateCacheIfNeeded(_currentDecoderFrame);
+  }
+  return _convertedRecord;
+}
+
+/*!
+ * What decoding a frame again from its GOP's keyframe would cost.  That's the decoding since the keyframe
+ * when every frame was decoded.  Skipping frames leaves most of that uncounted, so then it's estimated
+ * from how far into the GOP the frame is, at the average time a frame has taken.
+ */
+float VideoDecoder::getRedecodeMs(int frame) {
+  int keyframe = getKeyframeBefore(frame);
+  uint64_t decodedFrames = _decodedFrames;
+  if(_skip == DECODE_ALL || keyframe < 0 || !decodedFrames) return _gopDecodeNs / 1.e6f;
+  return (frame - keyframe + 1) * (_decodeNs / (float)decodedFrames) / 1.e6f;
+}
+
+/*!
+ * Convert the frame in _frame to YUV420P at the output size, writing it straight into a new cache record.
+ * Formats the PixelConverter has kernels for skip swscale when the frame is already the output size.
+ * Otherwise swscale converts and scales in one pass.  Frames which are already cached aren't converted
+ * at all.
+ */
+void VideoDecoder::updateCacheIfNeeded(int frame) {
+  if(_convertedRecord) _cache.releaseFrame(_convertedRecord);
+  _convertedFrame = frame;
+
+  _convertedRecord = _cache.pinFrame(frame);
+  if(_convertedRecord) return;
+
+  // the decoded size, which is smaller than the source's with lowres
+  int decodedWidth = _frame->width;
+  int decodedHeight = _frame->height;
+  bool scaled = decodedWidth != _width || decodedHeight != _height;
+  TRACE_SCOPE(TRACE_CONVERT);
+  FrameRecord* rec = _cache.allocFrame(frame, _width, _height);
+  rec->redecodeMs = getRedecodeMs(frame);
+  uint8_t* planes[4];
+  int linesizes[4];
+  av_image_fill_arrays(planes, linesizes, rec->data, AV_PIX_FMT_YUV420P, _width, _height, 1);
+
+  if(!scaled && PixelConverter::isSupported(_codecContext->pix_fmt)) {
+    _pixelConverter.convert(_codecContext->pix_fmt, _frame->data, _frame->linesize, planes, linesizes, _width, _height);
+  } else {
+    _convert = sws_getCachedContext(_convert, decodedWidth, decodedHeight, _codecContext->pix_fmt, _width, _height,
+                                    AV_PIX_FMT_YUV420P, scaled ? SWS_BILINEAR : SWS_BICUBIC, nullptr, nullptr, nullptr);
+    sws_scale(_convert, (const unsigned char* const*)_frame->data, _frame->linesize, 0, decodedHeight, planes, linesizes);
+  }
+  _bytesCopied += _frameDataSize;
+
+  _convertedRecord = _cache.insertFrame(rec);
+}
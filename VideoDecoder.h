@@ -0,0 +1,156 @@
+#ifndef VIDEOPLAYER_VIDEODECODER_H
+#define VIDEOPLAYER_VIDEODECODER_H
+
+#include <string>
+#include <atomic>
+#include <set>
+#include <memory>
+#include <limits.h>
+#include "FileReader.h"
+#include "PacketCache.h"
+#include "PacketIndex.h"
+#include "PixelConverter.h"
+#include "VideoCache.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+};
+
+/*!
+ * Frames the decoder may leave out, for trick play.  Frames which are skipped are never output, so
+ * asking for one gives the next frame which wasn't.
+ */
+enum DecodeSkip {
+  DECODE_ALL,
+  DECODE_REFERENCE, // skip frames no other frame refers to, usually the B frames
+  DECODE_KEYFRAMES  // only keyframes
+};
+
+/*!
+ * Decodes frames of a video by frame number.
+ * Every frame decoded on the way to the requested one is converted to YUV420P and added to the cache.
+ * With an index and a PacketCache, the packets of each GOP read from the file are kept, and GOPs which
+ * are cached are decoded again straight from memory.
+ * The file is read through a FileReader unless FFmpeg is asked to read it, and with the index, prefetch()
+ * starts reading a GOP before the demuxer needs it.
+ * Frames can be converted to a smaller output size than the source's, scaled in the same pass, in which
+ * case codecs which can decode at a fraction of the size are told to.
+ * A decoder is used by one thread at a time, only getLastFrame(), prefetch() and the counters may be used
+ * from others.
+ */
+class VideoDecoder {
+public:
+  VideoDecoder(const std::string& fileName, VideoCache& cache);
+  ~VideoDecoder();
+  bool open();
+  void setUseIndex(bool useIndex) { _useIndex = useIndex; }
+  void setPacketCache(PacketCache* packetCache) { _packetCache = packetCache; }
+  void setReadMode(FileReadMode readMode) { _readMode = readMode; }
+  void seekTo(int frame);
+  FrameRecord* getConvertedFrame();
+  int getKeyframeBefore(int frame);
+  int getKeyframeAfter(int frame);
+  void prefetch(int frame);
+  void setSkip(DecodeSkip skip);
+  DecodeSkip getSkip() { return _skip; }
+  void setOutputSize(int width, int height);
+  void setCancel(const std::atomic<uint32_t>* generation, uint32_t current);
+  bool isCancelled() { return _cancelGeneration && _cancelGeneration->load() != _cancelCurrent; }
+
+  int getCurrentFrame() { return _currentDecoderFrame; }
+  int getLastFrame() { return _lastFrame; }
+  int getWidth() { return _width; }
+  int getHeight() { return _height; }
+  int getSourceWidth() { return _sourceWidth; }
+  int getSourceHeight() { return _sourceHeight; }
+  int getLowres() { return _codecContext->lowres; }
+  uint64_t getFrameDataSize() { return _frameDataSize; }
+  uint64_t getDecodedFrames() { return _decodedFrames; }
+  uint64_t getDecodeNs() { return _decodeNs; }
+  uint64_t getSeeks() { return _seeks; }
+  uint64_t getSeekRetries() { return _seekRetries; }
+  uint64_t getCancelledSeeks() { return _cancelledSeeks; }
+  uint64_t getFileReads() { return _fileReads; }
+  uint64_t getFileBytes() { return _fileBytes; }
+  uint64_t getIoWaitNs() { return _ioWaitNs; }
+  uint64_t getReadaheadBytes() { return _reader.getReadaheadBytes(); }
+  uint64_t getBytesCopied() { return _bytesCopied; }
+  PacketIndex& getIndex() { return _index; }
+  int getStreamIndex() { return _videoStreamIdx; }
+  AVRational getTimeBase() { return _context->streams[_videoStreamIdx]->time_base; }
+
+private:
+  bool decodeNextFrame(int& frame);
+  bool readPacket(AVPacket& packet);
+  void recordPacket(AVPacket& packet);
+  void finishRecording(int nextKeyframe);
+  void seekGop(int keyframe);
+  void seekFile(int64_t pts, int flags);
+  void displayConsecutive();
+  void displaySeekForward();
+  void displaySeekBackward();
+  void displaySeekIndexed();
+  void updateCacheIfNeeded(int frame);
+  float getRedecodeMs(int frame);
+  int64_t ptsToFrame(int64_t pts);
+  int64_t frameToPts(int frame);
+
+  std::string _name;
+  VideoCache& _cache;
+  FileReadMode _readMode = READ_MMAP;
+  FileReader _reader;
+  AVFormatContext* _context = nullptr;
+  AVCodecContext* _codecContext = nullptr;
+  AVCodec* _codec = nullptr;
+  AVFrame* _frame = nullptr;
+  int _videoStreamIdx = -1;
+
+  int _sourceWidth = 0;
+  int _sourceHeight = 0;
+  int _width = 0;  // output size, frames are converted to this
+  int _height = 0;
+  uint64_t _frameDataSize = 0;
+
+  PixelConverter _pixelConverter;
+  SwsContext* _convert = nullptr; // for scaling, and formats _pixelConverter doesn't handle
+
+  int _currentDecoderFrame = -1;
+  int _decodeFrame = 0;      // frame we are trying to decode
+  int _convertedFrame = -1;  // frame in _convertedRecord
+  DecodeSkip _skip = DECODE_ALL;
+  bool _mustSeek = false;    // the decoder's references are missing frames, start again from a keyframe
+  FrameRecord* _convertedRecord = nullptr; // pinned in the cache until the next frame is converted
+  const std::atomic<uint32_t>* _cancelGeneration = nullptr; // seeks give up once it moves on from _cancelCurrent
+  uint32_t _cancelCurrent = 0;
+
+  int64_t _timeBase;
+  int64_t _seekTimeBase;
+
+  bool _ptsZeroSet = false;
+  int64_t _ptsZero;
+
+  PacketIndex _index;
+  bool _useIndex = true;
+  std::set<int> _keyframes; // keyframes we have decoded so far, used when there is no index
+  std::atomic<int> _lastFrame{INT_MAX}; // last frame of the file, once we've found it
+  std::atomic<uint64_t> _decodedFrames{0};
+  std::atomic<uint64_t> _decodeNs{0};   // reading and decoding the packets of each frame
+  uint64_t _gopDecodeNs = 0;            // decoding since the last keyframe, see getRedecodeMs()
+  std::atomic<uint64_t> _seeks{0};
+  std::atomic<uint64_t> _seekRetries{0}; // seeks which landed after the frame and had to try again
+  std::atomic<uint64_t> _cancelledSeeks{0}; // seeks given up on before reaching the frame
+
+  PacketCache* _packetCache = nullptr;
+  std::shared_ptr<PacketGop> _replayGop; // GOP we're handing out packets from instead of the file
+  size_t _replayPos = 0;
+  std::shared_ptr<PacketGop> _recordGop; // GOP being read from the file, cached once we reach the next one
+  std::atomic<uint64_t> _fileReads{0};   // packets read from the file, of any stream
+  std::atomic<uint64_t> _fileBytes{0};
+  std::atomic<uint64_t> _ioWaitNs{0};    // in av_read_frame, which is mostly waiting on the file when it isn't cached
+  std::atomic<uint64_t> _bytesCopied{0}; // frame data written into the cache, by swscale or a plain copy
+};
+
+#endif //VIDEOPLAYER_VIDEODECODER_H
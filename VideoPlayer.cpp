@@ -1,6 +1,34 @@
 #include "VideoPlayer.h"
+#include "EvictionPolicy.h"
+#include "Trace.h"
 #include <stdio.h>
 #include <assert.h>
+#include <algorithm>
+#include <new>
+
+// number of decoded frames the decode thread can get ahead of the render thread
+static const size_t ringFrames = 8;
+
+// frames each stream's frame server holds for its clients
+static const int serverFrames = 8;
+
+// playback rate at 1x, and the fastest the shuttle goes
+static const double framesPerSecond = 60;
+static const int maxShuttleSpeed = 16;
+
+// frames the e and r keys jump
+static const int jumpFrames = 100;
+
+// the most a memory budget cut takes off, and the most slab memory given back, each frame, so a cut
+// never cleans more at once than a frame has time for
+static const uint64_t maxShrinkPerFrame = 32l * 1024 * 1024;
+
+// the cache timeline zooms in as far as this many frames across the window
+static const int minTimelineFrames = 32;
+
+// the window has to keep its size this long before the streams are decoded at the new size, so
+// dragging its edge doesn't rebuild the caches on every step
+static const double resizeSettleMs = 250;
 
 static const char* modeNames[] = {
   "  PLAY",
@@ -17,195 +45,255 @@ static const char* getModeName(PlaybackMode mode) {
   return modeNames[(int)mode];
 }
 
-/*!
- * construct a new video player
- * @param fileName : name of file to open
- * @param maxMemory : maximum memory to be used by cache
- */
-VideoPlayer::VideoPlayer(const std::string &fileName, uint64_t maxMemory) :_name(fileName) , _cache(maxMemory){
-  setup();
-}
+static const char* skipNames[] = {
+  "all",
+  "ref",
+  "key"
+};
 
 /*!
- * Add a frame to the cache.
- * @param data : pointer to frame data
- * @param size : size of data
- * @param frame : frame number
+ * Fit a picture into a box, keeping its aspect and never making it bigger.  A picture which has to be
+ * shrunk is rounded down to an even size, which YUV420P scales to cleanly.
  */
-void VideoCache::addFrame(uint8_t *data, uint64_t size, int frame) {
-  // don't cache frames we already have
-  if(_frameMap.find(frame) != _frameMap.end()) return;
-
-  // track memory usage of cache
-  _totalMemUse += sizeof(FrameRecord) + size;
-
-  // build new record
-  auto* rec = new FrameRecord;
-  rec->data = new uint8_t[size];
-  rec->frame = frame;
-  rec->use_id = _useCount++;
-  rec->size = size;
-  //next, prev.
-
-  // copy the data into the cache
-  memcpy(rec->data, data, size);
-
-  // add to map
-  _frameMap[frame] = rec;
-  assert(_frameMap.find(frame) != _frameMap.end());
-
-  // make sure we aren't over the memory budget
-  while(_totalMemUse > 1024l * 1024l * _maxMemory) {
-    // clean!
-    cleanFrame();
+static void fitSize(int sourceWidth, int sourceHeight, int boxWidth, int boxHeight, int& width, int& height) {
+  width = sourceWidth;
+  height = sourceHeight;
+  if(width <= boxWidth && height <= boxHeight) return;
+  if((int64_t)width * boxHeight > (int64_t)height * boxWidth) {
+    height = (int)((int64_t)height * boxWidth / width);
+    width = boxWidth;
+  } else {
+    width = (int)((int64_t)width * boxHeight / height);
+    height = boxHeight;
   }
-
+  width = std::max(2, width & ~1);
+  height = std::max(2, height & ~1);
 }
 
 /*!
- * Remove the most likely to be useless frame (this heuristic is currently bad, and means I have to
- * add a workaround to make playback smooth, though I don't quite understand why).
+ * Open a video for playing alongside the others
+ * @param streamCount : number of videos being played, which share the packet cache budget evenly
  */
-void VideoCache::cleanFrame() {
-  // find oldest frame in cache
-  int frame = -1;
-  uint64_t minAge = UINT64_MAX;
-  for(auto& rec : _frameMap) {
-    if(rec.second->use_id < minAge) {
-      frame = rec.second->frame;
-      minAge = rec.second->use_id;
-    }
-  }
+VideoStream::VideoStream(const std::string &fileName, const PlayerOptions &options, int streamCount) :
+  name(fileName), cache(options.cacheMB), packets(options.packetMB / streamCount),
+  decoder(fileName, cache), producer(decoder, cache) {
+  if(options.packetMB) decoder.setPacketCache(&packets);
+  if(!options.mmap) decoder.setReadMode(READ_FFMPEG);
+}
 
-  // and kill it
-  if(frame != -1) {
-    auto& rec = _frameMap[frame];
-    _totalMemUse -= (sizeof(FrameRecord) + rec->size);
-    delete[] rec->data;
-    delete rec;
-    _frameMap.erase(frame);
-  }
+VideoStream::~VideoStream() {
+  if(pending) cache.releaseFrame(pending);
+}
+
+void* VideoStream::operator new(size_t size) {
+  void* stream;
+  if(posix_memalign(&stream, alignof(VideoStream), size)) throw std::bad_alloc();
+  return stream;
 }
 
 /*!
- * get a frame from the cache and update is age. null if it isn't in the cache
+ * construct a new video player
+ * @param fileNames : files to open, played together
+ * @param options : cache sizes
  */
-FrameRecord* VideoCache::getFrame(int frame) {
-  auto kv = _frameMap.find(frame);
-  if(kv != _frameMap.end()) {
-    kv->second->use_id = _useCount++;
-    return kv->second;
+VideoPlayer::VideoPlayer(const std::vector<std::string> &fileNames, const PlayerOptions& options) :
+  _options(options), _budget(options.cacheMB) {
+  for(auto& fileName : fileNames) {
+    _streams.emplace_back(new VideoStream(fileName, options, (int)fileNames.size()));
   }
-  return nullptr;
+  setup();
 }
 
-
 /*!
  * Setup video player
  */
 void VideoPlayer::setup() {
+  TRACE_THREAD("render");
 
-  // setup libs
-  av_register_all();
-  avformat_network_init(); // todo remove me?
-  _context = avformat_alloc_context();
+  for(auto& stream : _streams) {
+    if(!stream->decoder.open()) {
+      return;
+    }
+  }
 
-  // open and set up codec
-  if(avformat_open_input(&_context, _name.c_str(), nullptr, nullptr)) {
-    printf("failed to open file\n");
-    return;
+  // SDL setup
+
+  // headless runs need no display or GPU, but SDL_VIDEODRIVER can still pick another driver
+  Uint32 initFlags = SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER;
+  Uint32 windowFlags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
+  Uint32 rendererFlags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC;
+  if(_options.headless) {
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+    initFlags = SDL_INIT_VIDEO | SDL_INIT_TIMER;
+    windowFlags = SDL_WINDOW_HIDDEN;
+    rendererFlags = SDL_RENDERER_SOFTWARE;
   }
 
-  if(avformat_find_stream_info(_context, nullptr) < 0) {
-    printf("Invalid file\n");
+  if(SDL_Init(initFlags)) {
+    printf("SDL init error: %s\n", SDL_GetError());
     return;
   }
+  TTF_Init();
 
-  for(int i = 0; i < _context->nb_streams; i++) {
-    if(_context->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
-      _videoStreamIdx = i;
-      break;
+  // the size asked for, or the first video's shrunk to fit the screen.  The others are tiled over it
+  int windowWidth = _options.windowWidth;
+  int windowHeight = _options.windowHeight;
+  if(!windowWidth || !windowHeight) {
+    windowWidth = _streams[0]->decoder.getSourceWidth();
+    windowHeight = _streams[0]->decoder.getSourceHeight();
+    SDL_DisplayMode display;
+    if(!_options.headless && !SDL_GetDesktopDisplayMode(0, &display)) {
+      fitSize(windowWidth, windowHeight, display.w, display.h, windowWidth, windowHeight);
     }
   }
+  _window = SDL_CreateWindow("Video Player", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                             windowWidth, windowHeight, windowFlags);
 
-  if(_videoStreamIdx == -1) {
-    printf("Failed to find video data\n");
+  if(!_window) {
+    printf("SDL window error: %s\n", SDL_GetError());
     return;
   }
 
-  printf("Stream %d contains video data\n", _videoStreamIdx);
-
-  _codecContext = _context->streams[_videoStreamIdx]->codec;
-  _codec = avcodec_find_decoder(_codecContext->codec_id);
+  _renderer = SDL_CreateRenderer(_window, -1, rendererFlags);
 
-  if(!_codec) {
-    printf("Failed to find codec\n");
-    return;
+  _font = TTF_OpenFont("../font.ttf", 24);
+  _glyphs.init(_renderer, _font);
+
+  // frames are decoded and cached at the size of the tile they're shown in
+  int streamCount = (int)_streams.size();
+  for(int i = 0; i < streamCount; i++) {
+    VideoStream& stream = *_streams[i];
+    getOutputSize(stream, getTile(i, streamCount), stream.outputWidth, stream.outputHeight);
+    stream.cache.setFrameSize(stream.outputWidth, stream.outputHeight);
+    stream.producer.setOutputSize(stream.outputWidth, stream.outputHeight);
+    printf("%s: decoding at %dx%d\n", stream.name.c_str(), stream.outputWidth, stream.outputHeight);
+
+    uint64_t frameSize = VideoCache::getFrameBytes(stream.outputWidth, stream.outputHeight);
+    if(_options.spillMB) {
+      // each stream gets an equal part of the spill tier
+      stream.cache.enableSpill(_options.spillFile, _options.spillMB * 1024l * 1024l / streamCount, frameSize);
+    }
+    if(_options.proxies) {
+      stream.cache.enableProxies();
+    }
+    if(EvictionPolicy* policy = EvictionPolicy::create(_options.eviction)) {
+      stream.cache.setEvictionPolicy(policy);
+    } else {
+      printf("no eviction policy %s, using %s\n", _options.eviction.c_str(), stream.cache.getEvictionPolicyName());
+    }
+    _budget.addStream(stream.cache, frameSize);
+    _workers.addStream(stream.name, stream.cache, _options.packetMB ? &stream.packets : nullptr);
+    _workers.setOutputSize(i, stream.outputWidth, stream.outputHeight);
+
+    // a slot holds a frame at the source's size, like the slab's
+    if(!_options.serveName.empty()) {
+      std::string name = streamCount > 1 ? _options.serveName + "-" + std::to_string(i) : _options.serveName;
+      AVRational timeBase = stream.decoder.getTimeBase();
+      stream.server.open(name, serverFrames, VideoCache::getFrameBytes(stream.decoder.getSourceWidth(),
+                                                                       stream.decoder.getSourceHeight()),
+                         &stream.decoder.getIndex(), timeBase.num, timeBase.den);
+    }
   }
 
-  if(avcodec_open2(_codecContext, _codec, nullptr) < 0) {
-    printf("failed to open codec\n");
-    return;
+  // the cgroup's headroom may not cover the budget asked for.  Nothing is cached yet, so it can be cut
+  // all at once
+  if(_options.adaptive) {
+    _memory.start(_budget.getMaxBytes(), _options.psiFile);
+    _budget.setMaxBytes(_memory.getTargetBytes());
   }
 
-  // allocate output frame
-  _frame = av_frame_alloc();
-  _frameYUV = av_frame_alloc();
-
-  printf("codec w: %d h: %d\n", _codecContext->width, _codecContext->height);
-
-  _frameSize = av_image_get_buffer_size(AV_PIX_FMT_YUV420P,
-                                        _codecContext->width, _codecContext->height, 1);
-
-  printf("frame size: %ld bytes (%.3f MB)\n", _frameSize, _frameSize / (1024. * 1024.));
-
-
-  _frameData = (uint8_t*)av_malloc(_frameSize);
-
-  av_image_fill_arrays(_frameYUV->data, _frameYUV->linesize, _frameData, AV_PIX_FMT_YUV420P, _codecContext->width, _codecContext->height, 1);
-
-
-  printf("info-------\n");
-  av_dump_format(_context, 0, _name.c_str(), 0);
-  printf("-----------\n\n\n");
-
-
-  // SDL setup
-
-  if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) {
-    printf("SDL init error: %s\n", SDL_GetError());
-    return;
+  // nothing has been decoded yet, so this splits the budget by focus alone
+  shareBudget();
+  if(_options.slab) {
+    // sized to the first share, anything a stream is given beyond that comes from the heap.  A slot holds
+    // a frame at the source's size, so whatever size the window is given later still fits
+    for(auto& stream : _streams) {
+      stream->cache.reserveFrames(VideoCache::getFrameBytes(stream->decoder.getSourceWidth(),
+                                                            stream->decoder.getSourceHeight()));
+    }
   }
-  TTF_Init();
-
-  _window = SDL_CreateWindow("Video Player", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                             _codecContext->width, _codecContext->height, SDL_WINDOW_OPENGL);
 
-  if(!_window) {
-    printf("SDL window error: %s\n", SDL_GetError());
-    return;
+  // start decoding
+  for(auto& stream : _streams) {
+    stream->producer.start(ringFrames);
   }
 
-  _renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-  _texture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, _codecContext->width, _codecContext->height);
+  int workers = _options.workers;
+  if(workers < 0) workers = std::max(1, (int)std::thread::hardware_concurrency() / 2);
+  _workers.setReadMode(_options.mmap ? READ_MMAP : READ_FFMPEG);
+  _workers.setJumpDistance(jumpFrames);
+  if(workers) _workers.start(workers);
+  _open = true;
+}
 
-  _convert = sws_getContext(_codecContext->width, _codecContext->height, _codecContext->pix_fmt,
-                            _codecContext->width, _codecContext->height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, nullptr, nullptr, nullptr);
+VideoPlayer::~VideoPlayer() {
+  for(auto& stream : _streams) {
+    stream->producer.stop();
+  }
+  _workers.stop();
 
-  _timeBase = (int64_t(_codecContext->time_base.num) * AV_TIME_BASE) / int64_t(_codecContext->time_base.den);
+  _glyphs.clear();
+  if(_font) TTF_CloseFont(_font);
+  for(auto& stream : _streams) {
+    for(auto* texture : stream->textures) {
+      if(texture) SDL_DestroyTexture(texture);
+    }
+  }
+  if(_renderer) SDL_DestroyRenderer(_renderer);
+  if(_window) SDL_DestroyWindow(_window);
+}
 
-  _font = TTF_OpenFont("../font.ttf", 24);
+/*!
+ * Last frame we can play, which is the end of the shortest video
+ */
+int VideoPlayer::getLastFrame() {
+  int last = INT_MAX;
+  for(auto& stream : _streams) {
+    last = std::min(last, stream->decoder.getLastFrame());
+  }
+  return last;
+}
 
-  _frameDataSize = _codecContext->width *  _codecContext->height * 12 / 8;
+/*!
+ * Frames decoded by the producers of all the streams
+ */
+uint64_t VideoPlayer::getDecodedFrames() {
+  uint64_t decoded = 0;
+  for(auto& stream : _streams) {
+    decoded += stream->decoder.getDecodedFrames();
+  }
+  return decoded;
+}
 
+/*!
+ * Time the producers of all the streams have spent waiting on reads
+ */
+uint64_t VideoPlayer::getIoWaitNs() {
+  uint64_t ns = 0;
+  for(auto& stream : _streams) {
+    ns += stream->decoder.getIoWaitNs();
+  }
+  return ns;
 }
 
-int64_t VideoPlayer::ptsToFrame(int64_t pts) {
-  return (pts - _ptsZero) / _seekTimeBase;
+/*!
+ * Cache stats of all the streams added together
+ */
+CacheTierStats VideoPlayer::getCacheStats() {
+  CacheTierStats stats;
+  for(auto& stream : _streams) {
+    stats.add(stream->cache.getStats());
+  }
+  return stats;
 }
 
-int64_t VideoPlayer::frameToPts(int frame) {
-  return _ptsZero + (frame * _seekTimeBase);
+/*!
+ * Jump to a frame and pause there
+ */
+void VideoPlayer::seek(int frame) {
+  _workers.preempt();
+  _desiredNextFrame = std::max(0, std::min(frame, getLastFrame()));
+  _mode = PAUSE;
 }
 
 void VideoPlayer::exitIfNeeded() {
@@ -214,37 +302,69 @@ void VideoPlayer::exitIfNeeded() {
   while(SDL_PollEvent(&event)) {
     switch(event.type) {
       case SDL_QUIT:
+        for(auto& stream : _streams) {
+          stream->producer.stop();
+        }
+        _workers.stop();
+        printStats();
+        if(_options.analyticsAtExit) writeAnalytics(_options.analyticsFile);
+#ifdef VIDEOPLAYER_TRACE
+        if(_options.traceAtExit) Trace::writeChromeTrace(_options.traceFile);
+#endif
         exit(0);
         break;
+      case SDL_WINDOWEVENT:
+        if(event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+          _resizePending = true;
+          _resizeClock.start();
+        }
+        break;
       case SDL_KEYDOWN:
       {
         switch(event.key.keysym.sym) {
           case SDLK_l:
-            _mode = PLAY;
+            _workers.preempt();
+            shuttle(1);
             break;
           case SDLK_k:
+            _workers.preempt();
             _mode = PAUSE;
+            _speed = 1;
             break;
           case SDLK_j:
-            _mode = REWIND;
+            _workers.preempt();
+            shuttle(-1);
             break;
           case SDLK_f:
+            _workers.preempt();
             _mode = FRAME_FORWARD;
             break;
           case SDLK_d:
+            _workers.preempt();
             _mode = FRAME_BACKWARD;
             break;
           case SDLK_c:
             _cacheDebug = !_cacheDebug;
             break;
+          case SDLK_a:
+            writeAnalytics(_options.analyticsFile);
+            break;
+          case SDLK_EQUALS:
+            _timelineZoom *= 2;
+            break;
+          case SDLK_MINUS:
+            _timelineZoom = std::max(1, _timelineZoom / 2);
+            break;
           case SDLK_r:
-            _frameDisplayed += 100;
+            _workers.preempt();
+            _desiredNextFrame += jumpFrames;
             _mode = PAUSE;
             break;
 
           case SDLK_e:
-            _frameDisplayed -= 100;
-            if(_frameDisplayed < 0) _frameDisplayed = 0;
+            _workers.preempt();
+            _desiredNextFrame -= jumpFrames;
+            if(_desiredNextFrame < 0) _desiredNextFrame = 0;
             _mode = PAUSE;
             break;
 
@@ -252,6 +372,20 @@ void VideoPlayer::exitIfNeeded() {
           case SDLK_h:
             _helpOpen = !_helpOpen;
             break;
+
+          case SDLK_TAB:
+            setFocus((_budget.getFocus() + 1) % (int)_streams.size());
+            break;
+          case SDLK_v:
+            _solo = !_solo;
+            setFocus(_budget.getFocus());
+            break;
+
+#ifdef VIDEOPLAYER_TRACE
+          case SDLK_t:
+            Trace::writeChromeTrace(_options.traceFile);
+            break;
+#endif
         }
       }
         break;
@@ -259,364 +393,787 @@ void VideoPlayer::exitIfNeeded() {
   }
 }
 
+/*!
+ * Start playing in a direction, or if we're already going that way, double the speed
+ * @param direction : 1 for l, -1 for j
+ */
+void VideoPlayer::shuttle(int direction) {
+  PlaybackMode mode = direction > 0 ? PLAY : REWIND;
+  if(_mode == mode) {
+    _speed = std::min(_speed * 2, maxShuttleSpeed);
+  } else {
+    _mode = mode;
+    _speed = 1;
+  }
+  _shuttleOrigin = _desiredNextFrame;
+  _shuttleClock.start();
+}
+
+/*!
+ * Frame the shuttle clock is at.  Above 1x the playhead follows the wall clock instead of waiting for
+ * each frame to be shown.
+ */
+int VideoPlayer::getShuttleFrame() {
+  int moved = (int)(_shuttleClock.getSeconds() * framesPerSecond * _speed);
+  return _shuttleOrigin + getDirection() * moved;
+}
+
+/*!
+ * Pick the frame to show next.  _desiredNextFrame is the playhead, and only moves on once the frame it
+ * points at has been displayed, so a slow decode delays playback instead of skipping frames.
+ * Shuttling is the exception, there the playhead follows the clock and frames are skipped.
+ */
 int VideoPlayer::determineNextFrame() {
+  bool caughtUp = _frameDisplayed == _desiredNextFrame;
   switch(_mode) {
     case PLAY:
-      return _frameDisplayed + 1;
+      if(_speed > 1) return getShuttleFrame();
+      return caughtUp ? _desiredNextFrame + 1 : _desiredNextFrame;
 
     case REWIND:
-      if(_frameDisplayed - 1 < 0) return 0;
-      return _frameDisplayed - 1;
+      if(_speed > 1) return std::max(0, getShuttleFrame());
+      if(_desiredNextFrame - 1 < 0) return 0;
+      return caughtUp ? _desiredNextFrame - 1 : _desiredNextFrame;
 
     case PAUSE:
-      return _frameDisplayed;
+      return _desiredNextFrame;
 
     case FRAME_FORWARD:
       _mode = PAUSE;
-      return _frameDisplayed + 1;
+      return _desiredNextFrame + 1;
 
     case FRAME_BACKWARD:
       _mode = PAUSE;
-      return _frameDisplayed - 1;
+      if(_desiredNextFrame - 1 < 0) return 0;
+      return _desiredNextFrame - 1;
   }
 
   return 0;
 }
 
-void VideoPlayer::displayConsecutive() {
-  AVPacket packet;
-  int readyToDisplay = 0;
-
-  while(!readyToDisplay) { // until got picture
-
-    //avcodec_flush_buffers(_codecContext);
-    //av_seek_frame(_context, -1, int64_t(_frameCount) * _timeBase, AVSEEK_FLAG_BACKWARD);
-
-    bool gotVideoPacket = false;
-    while(!gotVideoPacket) { // until got video stream
-      if(av_read_frame(_context, &packet) < 0) {
-        printf("couldn't read frame!\n");
-        _mode = PAUSE;
-        return;
-      }
-      if(packet.stream_index == _videoStreamIdx) gotVideoPacket = true;
-    }
-
-    if (avcodec_decode_video2(_codecContext, _frame, &readyToDisplay, &packet) < 0) {
-      printf("decode error\n");
-      return;
-    }
+/*!
+ * Direction the decode thread should work ahead in for the current mode, or 0 to decode only the
+ * frame at the playhead.
+ */
+int VideoPlayer::getDirection() {
+  switch(_mode) {
+    case PLAY:
+    case FRAME_FORWARD:
+      return 1;
+    case REWIND:
+    case FRAME_BACKWARD:
+      return -1;
+    case PAUSE:
+      return 0;
   }
+  return 0;
+}
 
-
-
-  if(!_ptsZeroSet) {
-    _ptsZero = packet.pts;
-    _seekTimeBase = packet.duration;
-    _ptsZeroSet = true;
+/*!
+ * Focus a stream, which gets the biggest part of the budget and the status bar, and is the only one
+ * shown in solo mode
+ */
+void VideoPlayer::setFocus(int stream) {
+  _budget.setFocus(stream);
+  for(size_t i = 0; i < _streams.size(); i++) {
+    _streams[i]->visible = !_solo || (int)i == stream;
   }
 
-  _currentDecoderFrame = ptsToFrame(packet.pts);
+  // the tiles may have changed size
+  _resizePending = true;
+}
 
-  updateCacheIfNeeded(_currentDecoderFrame, _frame->data[0]);
+/*!
+ * Split the cache budget and the workers between the streams by what's on screen and how long their
+ * frames have taken to decode so far
+ */
+void VideoPlayer::shareBudget() {
+  for(size_t i = 0; i < _streams.size(); i++) {
+    VideoStream& stream = *_streams[i];
+    uint64_t frames = stream.decoder.getDecodedFrames() + _workers.getDecodedFrames((int)i);
+    uint64_t ns = stream.decoder.getDecodeNs() + _workers.getDecodeNs((int)i);
+    if(frames) _budget.setDecodeMs((int)i, ns / 1.e6 / frames);
+    _budget.setVisible((int)i, stream.visible);
+  }
+  _budget.rebalance();
+  for(size_t i = 0; i < _streams.size(); i++) {
+    _workers.setWeight((int)i, _budget.getShare((int)i).weight);
+  }
+}
 
+/*!
+ * Move the cache budget toward the memory monitor's.  Cuts are made a step at a time, and while the
+ * budget is cut, the slab memory it frees is given back to the kernel a step at a time too.
+ */
+void VideoPlayer::followMemory() {
+  if(!_options.adaptive) return;
+  uint64_t target = _memory.getTargetBytes();
+  uint64_t current = _budget.getMaxBytes();
+  if(target < current) {
+    _budget.setMaxBytes(std::max(target, current - std::min(current, maxShrinkPerFrame)));
+  } else if(target > current) {
+    _budget.setMaxBytes(target);
+  }
 
-//  if(packet.flags && AV_PKT_FLAG_KEY) printf("[KEY] "); else printf("      ");
-//  printf("CONSECUTIVE: f %d, f_des %d", _currentDecoderFrame, _desiredNextFrame);
-//  if(packet.flags && AV_PKT_FLAG_KEY)
-//    printf(" @ %ld\n", packet.pts);
-//  else printf("\n");
+  if(_budget.getMaxBytes() >= _options.cacheMB * 1024l * 1024l) return;
+  uint64_t released = 0;
+  for(auto& stream : _streams) {
+    if(released >= maxShrinkPerFrame) break;
+    released += stream->cache.releaseMemory(maxShrinkPerFrame - released);
+  }
+}
 
-  if(packet.flags && AV_PKT_FLAG_KEY) {
-    printf("[KEY] ");
-    printf("CONSECUTIVE: f %d, f_des %d", _currentDecoderFrame, _desiredNextFrame);
-    if(packet.flags && AV_PKT_FLAG_KEY)
-      printf(" @ %ld\n", packet.pts);
-    else printf("\n");
+/*!
+ * Only let the workers have the cores the producers can spare.  While playing at 1x they're held off
+ * whenever a visible stream's ring runs low, until it's half full again.  Paused or stepping, the
+ * producers have nothing to do between frames, so the workers always run.
+ */
+void VideoPlayer::spareWorkers() {
+  bool playing = (_mode == PLAY || _mode == REWIND) && _speed == 1;
+  bool low = false;
+  bool refilled = true;
+  for(auto& stream : _streams) {
+    if(!stream->visible) continue;
+    size_t depth = stream->producer.getRingDepth();
+    size_t capacity = stream->producer.getRingCapacity();
+    if(depth < capacity / 4) low = true;
+    if(depth < capacity / 2) refilled = false;
   }
 
+  if(!playing || (_workersHeld && refilled)) _workersHeld = false;
+  else if(low) _workersHeld = true;
+  _workers.setPaused(_workersHeld);
 }
 
-void VideoPlayer::displaySeekBackward() {
-  AVPacket packet;
-  printf("SEEK: %d\n", _desiredNextFrame);
+/*!
+ * Once the window has kept a new size for a moment, or the tiles changed, move each visible stream's
+ * decoders and cache to the size of its tile.  Hidden streams keep the size they had.
+ */
+void VideoPlayer::followWindow() {
+  if(!_resizePending || _resizeClock.getMs() < resizeSettleMs) return;
+  _resizePending = false;
 
-  int seekTarget = _desiredNextFrame;   // where we try to seek to
-  int lastSeekTarget = _currentDecoderFrame;   // last place we tried to seek to
-  int seekResult = _desiredNextFrame + 1; // the result of our most recent seek
-  bool seekZero = false; // if we've tried seeking to zero yet
+  int tiles = 0;
+  for(auto& stream : _streams) {
+    if(stream->visible) tiles++;
+  }
+  int tile = 0;
+  for(size_t i = 0; i < _streams.size(); i++) {
+    VideoStream& stream = *_streams[i];
+    if(!stream.visible) continue;
+    int width, height;
+    getOutputSize(stream, getTile(tile++, tiles), width, height);
+    if(width != stream.outputWidth || height != stream.outputHeight) setOutputSize((int)i, width, height);
+  }
+}
 
-  while(seekResult > _desiredNextFrame) { // we want to get a frame before/equal to the desired
+/*!
+ * Size to decode and cache a stream's frames at to show them in a tile: the source's, fitted inside
+ * the tile
+ */
+void VideoPlayer::getOutputSize(VideoStream &stream, const SDL_Rect &tile, int &width, int &height) {
+  width = stream.decoder.getSourceWidth();
+  height = stream.decoder.getSourceHeight();
+  if(_options.fitOutput) fitSize(width, height, std::max(2, tile.w), std::max(2, tile.h), width, height);
+}
 
-    if(seekTarget < 0) {
-      seekTarget = 0;
-      if(seekZero) {
-        printf("warning seek 0 when backward seeking, pausing\n");
-        _mode = PAUSE;
-        _desiredNextFrame = 0;
-        return;
-      }
-      seekZero = true;
-    }
+/*!
+ * Decode and cache a stream's frames at a new size.  Its producer starts again at the playhead, and
+ * the frames cached at the old size go stale, to be scaled or decoded again as the playhead needs them.
+ */
+void VideoPlayer::setOutputSize(int index, int width, int height) {
+  VideoStream& stream = *_streams[index];
+  stream.outputWidth = width;
+  stream.outputHeight = height;
+  stream.cache.setFrameSize(width, height);
+  stream.producer.setOutputSize(width, height);
+  _workers.setOutputSize(index, width, height);
+  _budget.setFrameSize(index, VideoCache::getFrameBytes(width, height));
+  printf("%s: decoding at %dx%d\n", stream.name.c_str(), width, height);
+}
 
-    // seek to target
-    // printf("  target: %d (last %d)\n", seekTarget, lastSeekTarget);
-    avcodec_flush_buffers(_codecContext);
-    av_seek_frame(_context, _videoStreamIdx, frameToPts(seekTarget), lastSeekTarget > seekTarget ? AVSEEK_FLAG_BACKWARD : 0);
-    avcodec_flush_buffers(_codecContext);
-
-    // get packet
-    int readyToDisplay = 0;
-    while(!readyToDisplay) { // until got picture
-
-      bool gotVideoPacket = false;
-      while(!gotVideoPacket) { // until got video stream
-        if(av_read_frame(_context, &packet) < 0) {
-          //printf("couldn't read frame!\n");
-          continue;
-        }
-        if(packet.stream_index == _videoStreamIdx) gotVideoPacket = true;
-      }
+/*!
+ * Where a visible stream is drawn.  They're tiled in a grid over the window, in order.
+ * @param tile : the stream's place among the visible streams
+ * @param tiles : number of visible streams
+ */
+SDL_Rect VideoPlayer::getTile(int tile, int tiles) {
+  int width, height;
+  SDL_GetRendererOutputSize(_renderer, &width, &height);
+  int columns = 1;
+  while(columns * columns < tiles) columns++;
+  int rows = (tiles + columns - 1) / columns;
+
+  SDL_Rect rect = {tile % columns * width / columns, tile / columns * height / rows, width / columns, height / rows};
+  return rect;
+}
 
-      if (avcodec_decode_video2(_codecContext, _frame, &readyToDisplay, &packet) < 0) {
-        printf("decode error\n");
-        return;
-      }
+/*!
+ * Show the frame at the playhead on every visible stream at once.  Each stream's frame is held pinned
+ * until they all have one, so the streams never show different frames.  A proxy on screen is replaced
+ * once the full frame turns up, without waiting for the others.
+ * @param usedCache : set if the focused stream's frame came from the cache
+ * @return true if the streams moved on to a new frame
+ */
+bool VideoPlayer::showLockedFrame(bool& usedCache) {
+  bool allReady = true;
+  for(auto& s : _streams) {
+    VideoStream& stream = *s;
+    if(!stream.visible) {
+      dropFrames(stream);
+      continue;
     }
 
+    bool newFrame = stream.frameDisplayed != _desiredNextFrame;
+    if(!newFrame && !stream.displayedLevel) continue;
+    if(!fetchFrame(stream, _desiredNextFrame, newFrame) && newFrame) allReady = false;
+  }
 
-    seekResult = ptsToFrame(packet.pts);
-    updateCacheIfNeeded(seekResult, _frame->data[0]);
-    // printf("  result: %d\n", seekResult);
-
-
-    lastSeekTarget = seekTarget;
-    seekTarget -= 30;
+  for(auto& s : _streams) {
+    VideoStream& stream = *s;
+    if(!stream.pending || (stream.frameDisplayed != _desiredNextFrame && !allReady)) continue;
+    if(&stream == &getFocused()) usedCache = stream.pendingFromCache;
+    showPending(stream);
   }
 
-  // seek forward
-  while(seekResult < _desiredNextFrame) {
-    int readyToDisplay = 0;
-    while(!readyToDisplay) { // until got picture
+  if(!allReady || _frameDisplayed == _desiredNextFrame) return false;
+  _frameDisplayed = _desiredNextFrame;
+  return true;
+}
 
-      bool gotVideoPacket = false;
-      while(!gotVideoPacket) { // until got video stream
-        if(av_read_frame(_context, &packet) < 0) {
-          //printf("couldn't read frame!\n");
-          continue;
-        }
-        if(packet.stream_index == _videoStreamIdx) gotVideoPacket = true;
-      }
+/*!
+ * Get a stream's frame ready to show, from its producer's ring or from the cache, and hold it pinned
+ * until showPending().  A proxy already held is swapped for the full frame if that turns up.
+ * @param allowProxy : take a scaled down copy if we don't have it at full resolution
+ * @return true if the frame, or a proxy of it, is held
+ */
+bool VideoPlayer::fetchFrame(VideoStream &stream, int frame, bool allowProxy) {
+  if(stream.pending && stream.pendingFrame != frame) releasePending(stream);
+  if(stream.pending && !stream.pending->level) return true;
+
+  FrameRecord* rec = nullptr;
+  bool fromCache = false;
+  if(FrameSlot* slot = stream.producer.peekFrame(frame)) {
+    // the ring's pin goes with the slot, so take our own
+    rec = slot->record;
+    stream.cache.pinFrame(rec);
+    stream.producer.popFrame();
+  } else {
+    rec = stream.cache.getFrame(frame);
+    if(!rec && allowProxy && !stream.pending && _options.proxies) rec = stream.cache.getProxy(frame);
+    fromCache = rec != nullptr;
+  }
 
-      if (avcodec_decode_video2(_codecContext, _frame, &readyToDisplay, &packet) < 0) {
-        printf("decode error\n");
-        return;
-      }
+  if(!rec) {
+    // the decode thread skipped over this frame because it was cached, but it has been cleaned since
+    if(stream.producer.hasPassed(frame)) {
+      stream.producer.restart();
     }
-    seekResult = ptsToFrame(packet.pts);
-    updateCacheIfNeeded(seekResult, _frame->data[0]);
+    return stream.pending != nullptr;
   }
 
-
-  _currentDecoderFrame = ptsToFrame(packet.pts);
-  // printf("BWD: f %d, f_des %d\n", _currentDecoderFrame, _desiredNextFrame);
+  releasePending(stream);
+  stream.pending = rec;
+  stream.pendingFrame = frame;
+  stream.pendingFromCache = fromCache;
+  return true;
 }
 
-void VideoPlayer::displaySeekForward() {
-  AVPacket packet;
-
-  // printf("SEEK: %d\n", _desiredNextFrame);
-
-  int seekTarget = _desiredNextFrame;
-  int lastSeekTarget = _currentDecoderFrame;
-  int seekResult = _desiredNextFrame + 1;
-
-  bool seekZero = false;
-
-  // seek to keyframe before desired frame
-  while(seekResult > _desiredNextFrame) {
-    if(seekTarget < 0) {
-      seekTarget = 0;
-      if(seekZero) {
-        printf("warning seek 0\n");
-        exit(0);
-      }
-      seekZero = true;
-    }
-
-    // seek to target
-    // printf("  target: %d (last %d)\n", seekTarget, lastSeekTarget);
-    avcodec_flush_buffers(_codecContext);
-    av_seek_frame(_context, _videoStreamIdx, frameToPts(seekTarget), lastSeekTarget > seekTarget ? AVSEEK_FLAG_BACKWARD : 0);
-    avcodec_flush_buffers(_codecContext);
+/*!
+ * Upload the frame fetchFrame() is holding for a stream
+ */
+void VideoPlayer::showPending(VideoStream &stream) {
+  uploadFrame(stream, stream.pending);
+  stream.frameDisplayed = stream.pendingFrame;
+  releasePending(stream);
+}
 
+void VideoPlayer::releasePending(VideoStream &stream) {
+  if(!stream.pending) return;
+  stream.cache.releaseFrame(stream.pending);
+  stream.pending = nullptr;
+}
 
-    // get packet
-    int readyToDisplay = 0;
-    while(!readyToDisplay) { // until got picture
+/*!
+ * Throw away what a hidden stream's producer has queued up to the playhead, so it carries on decoding
+ * and keeps its cache filled for when it's shown again
+ */
+void VideoPlayer::dropFrames(VideoStream &stream) {
+  releasePending(stream);
+  if(stream.producer.peekLatest(_desiredNextFrame)) stream.producer.popFrame();
+}
 
-      bool gotVideoPacket = false;
-      while(!gotVideoPacket) { // until got video stream
-        if(av_read_frame(_context, &packet) < 0) {
-          //printf("couldn't read frame!\n");
-          continue;
-        }
-        if(packet.stream_index == _videoStreamIdx) gotVideoPacket = true;
-      }
+/*!
+ * Show the newest frame between the one on screen and the shuttle clock.  Cached frames are preferred
+ * to the ring's if they are as close to the clock, and frames nobody has decoded are skipped instead of
+ * waited for.
+ * @param usedCache : set if the frame came from the cache
+ * @return true if a new frame was shown
+ */
+bool VideoPlayer::showShuttleFrame(VideoStream& stream, bool& usedCache) {
+  int direction = getDirection();
+  FrameSlot* slot = stream.producer.peekLatest(_desiredNextFrame);
+
+  // showing it would go backward
+  if(slot && (slot->frame - stream.frameDisplayed) * direction <= 0) {
+    stream.producer.popFrame();
+    slot = nullptr;
+  }
 
-      if (avcodec_decode_video2(_codecContext, _frame, &readyToDisplay, &packet) < 0) {
-        printf("decode error\n");
-        return;
-      }
+  // look back from the clock as far as the ring's frame, or one displayed frame's worth
+  int ringFrame = slot ? slot->frame : stream.frameDisplayed;
+  int oldest = _desiredNextFrame - direction * _speed;
+  for(int frame = _desiredNextFrame; (frame - ringFrame) * direction > 0 && (frame - oldest) * direction >= 0;
+      frame -= direction) {
+    if(stream.cache.hasFrame(frame, cacheLevels - 1) && tryCache(stream, frame, true)) {
+      usedCache = true;
+      stream.frameDisplayed = frame;
+      return true;
     }
-
-
-    seekResult = ptsToFrame(packet.pts);
-    //updateCacheIfNeeded(seekResult, _frame->data[0]);
-    // printf("  result: %d\n", seekResult);
-
-
-    lastSeekTarget = seekTarget;
-    seekTarget -= 30;
   }
 
-  // seek forward
-  while(seekResult < _desiredNextFrame) {
-    int readyToDisplay = 0;
-    while(!readyToDisplay) { // until got picture
-
-      bool gotVideoPacket = false;
-      while(!gotVideoPacket) { // until got video stream
-        if(av_read_frame(_context, &packet) < 0) {
-          //printf("couldn't read frame!\n");
-          continue;
-        }
-        if(packet.stream_index == _videoStreamIdx) gotVideoPacket = true;
-      }
+  if(!slot) return false;
+  uploadFrame(stream, slot->record);
+  stream.frameDisplayed = slot->frame;
+  stream.producer.popFrame();
+  return true;
+}
 
-      if (avcodec_decode_video2(_codecContext, _frame, &readyToDisplay, &packet) < 0) {
-        printf("decode error\n");
-        return;
-      }
-    }
-    seekResult = ptsToFrame(packet.pts);
-    updateCacheIfNeeded(seekResult, _frame->data[0]);
+/*!
+ * Show the frame the focused stream is showing while shuttling, if this stream has it.  Its producer
+ * steps from the same playhead, so it has mostly the same frames unless the keyframes differ.
+ */
+bool VideoPlayer::followFrame(VideoStream &stream, int frame) {
+  FrameSlot* slot = stream.producer.peekLatest(frame);
+  if(slot && slot->frame == frame) {
+    uploadFrame(stream, slot->record);
+    stream.frameDisplayed = frame;
+    stream.producer.popFrame();
+    return true;
   }
 
-
-  _currentDecoderFrame = ptsToFrame(packet.pts);
-  // printf("FWD: f %d, f_des %d\n", _currentDecoderFrame, _desiredNextFrame);
+  if(stream.cache.hasFrame(frame, cacheLevels - 1) && tryCache(stream, frame, true)) {
+    stream.frameDisplayed = frame;
+    return true;
+  }
+  return false;
 }
 
-void VideoPlayer::seekTo(int frame) {
-  if(frame == _currentDecoderFrame + 1) {
-    displayConsecutive();
-  } else if(frame > _currentDecoderFrame) {
-    displaySeekForward();
-  } else {
-    displaySeekBackward();
+/*!
+ * Copy a YUV420P frame into a stream's texture for its level, straight from wherever it is.  This is the
+ * only copy made to show a frame, apart from the frame server's.  The texture is made again if the frame
+ * is another size, which it is for a while after the window is resized.
+ */
+void VideoPlayer::uploadFrame(VideoStream& stream, const FrameRecord *rec) {
+  TRACE_SCOPE(TRACE_UPLOAD);
+  int level = rec->level;
+  int width = rec->width;
+  int height = rec->height;
+  SDL_Texture*& texture = stream.textures[level];
+  if(!texture || width != stream.textureWidths[level] || height != stream.textureHeights[level]) {
+    // drawn stretched to the tile, whatever its size
+    if(texture) SDL_DestroyTexture(texture);
+    texture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, width, height);
+    stream.textureWidths[level] = width;
+    stream.textureHeights[level] = height;
   }
+
+  uint8_t* planes[4];
+  int linesizes[4];
+  av_image_fill_arrays(planes, linesizes, rec->data, AV_PIX_FMT_YUV420P, width, height, 1);
+  SDL_UpdateYUVTexture(texture, nullptr, planes[0], linesizes[0], planes[1], linesizes[1], planes[2], linesizes[2]);
+  stream.bytesUploaded += av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
+  stream.displayedLevel = level;
+  if(stream.server.isOpen()) stream.server.publish(rec);
 }
 
 void VideoPlayer::playback() {
+  TRACE_SCOPE(TRACE_PLAYBACK);
 
   exitIfNeeded();
+  int direction = getDirection();
   _desiredNextFrame = determineNextFrame();
-  // printf("next %d\n", _desiredNextFrame);
-
-  bool usedCache = true;
-  if(!tryCache(_desiredNextFrame)) {
-    seekTo(_desiredNextFrame);
-    usedCache = false;
-    _frameDisplayed = _currentDecoderFrame;
+  if(_desiredNextFrame > getLastFrame()) {
+    _desiredNextFrame = getLastFrame();
+    _mode = PAUSE;
+    _speed = 1;
+  }
+  bool shuttling = getSpeed() > 1;
+  if(direction) _lastDirection = direction;
+  followMemory();
+  followWindow();
+  shareBudget();
+  spareWorkers();
+  if(_analyticsClock.getSeconds() >= 1) {
+    for(auto& stream : _streams) {
+      stream->cache.sampleAnalytics();
+    }
+    _analyticsClock.start();
   }
 
+  for(size_t i = 0; i < _streams.size(); i++) {
+    VideoStream& stream = *_streams[i];
+    stream.producer.request(_desiredNextFrame, direction, getSpeed());
+    stream.server.serveRequests(stream.cache);
+
+    // don't let the workers fill more than a quarter of the cache, or they'd clean frames we still want.
+    // The cache keeps the same frames at full resolution.
+    uint64_t frameSize = VideoCache::getFrameBytes(stream.outputWidth, stream.outputHeight);
+    int maxRadius = (int)(stream.cache.getMaxBytes() / std::max<uint64_t>(1, frameSize) / 8);
+    int fillRadius = std::min(_options.fillRadius, maxRadius);
+    stream.cache.setPlayhead(_desiredNextFrame, fillRadius, direction);
+
+    // filling around a playhead moving this fast would only decode frames we're about to pass
+    if(!shuttling) {
+      _workers.setCenter((int)i, _desiredNextFrame, fillRadius, _lastDirection);
+    }
+  }
+  // printf("next %d\n", _desiredNextFrame);
 
-  if(_desiredNextFrame != _frameDisplayed) {
-    printf("[ERROR] wanted frame %d, got %d instead!\n", _desiredNextFrame, _currentDecoderFrame);
+  // pick up the frame if it's ready, otherwise keep showing the last one
+  bool usedCache = false;
+  bool gotFrame;
+  VideoStream& focused = getFocused();
+  if(shuttling) {
+    releasePending(focused);
+    gotFrame = showShuttleFrame(focused, usedCache);
+    if(gotFrame) _frameDisplayed = focused.frameDisplayed;
+
+    for(auto& stream : _streams) {
+      if(stream.get() == &focused) continue;
+      releasePending(*stream);
+      if(!stream->visible) dropFrames(*stream);
+      else if(stream->frameDisplayed != _frameDisplayed) followFrame(*stream, _frameDisplayed);
+    }
+  } else {
+    gotFrame = showLockedFrame(usedCache);
+  }
+  if(gotFrame) {
+    _displayedFrames++;
   }
 
-  SDL_Color fontColor = {255, 255, 255};
+  // the focused stream's pipeline, with decode and copy rates for all of them
   char status_bar[1024];
 
-  _ftAvg = 0.9 * _ftAvg + 0.1 * _frameTimer.getMs();
-  sprintf(status_bar, "f %05d, c %05.0f MB, t %02d:%02d, ft %05.2f, m %s %c", _frameDisplayed, _cache.getMB(), _frameDisplayed/60, _frameDisplayed%60, _ftAvg, getModeName(_mode), usedCache ? 'C':' ');
+  int lead = (focused.producer.getDecodeNext() - _frameDisplayed) * focused.producer.getLastDirection();
+  if(lead < 0) lead = 0;
 
-  if(_helpOpen) {
-    char* ptr = status_bar;
-    while(*ptr) ptr++;
-    sprintf(ptr, " h: help | d: < | f: > | e: << | r: >> | j: rewind | k: pause | l: play | c: debug");
+  uint64_t bytesCopied = 0;
+  for(auto& stream : _streams) {
+    bytesCopied += stream->decoder.getBytesCopied() + stream->bytesUploaded;
+  }
+  double decodesPerFrame = _displayedFrames ? (double)getDecodedFrames() / _displayedFrames : 0;
+  double copiedPerFrame = _displayedFrames ? bytesCopied / (1024. * 1024.) / _displayedFrames : 0;
+  CacheTierStats stats = focused.cache.getStats();
+  double ramHitRate = 100. * stats.ramHits / std::max<uint64_t>(1, stats.ramHits + stats.ramMisses);
+
+  // decode load, which is what the shuttle's skipping keeps down
+  double frameMs = _frameTimer.getMs();
+  uint64_t decoded = getDecodedFrames();
+  _decodeRate = 0.9 * _decodeRate + 0.1 * (decoded - _lastDecoded) * 1000. / std::max(frameMs, 0.001);
+
+  // read stalls on the decode threads, which readahead keeps off the frame loop
+  uint64_t ioWaitNs = getIoWaitNs();
+  if(decoded != _lastDecoded) {
+    _ioWaitMs = 0.9 * _ioWaitMs + 0.1 * (ioWaitNs - _lastIoWaitNs) / 1.e6 / (decoded - _lastDecoded);
   }
+  _lastIoWaitNs = ioWaitNs;
+  _lastDecoded = decoded;
+
+  _ftAvg = 0.9 * _ftAvg + 0.1 * frameMs;
+  sprintf(status_bar, "f %05d, c %05.0f MB %02.0f%%, px %04lu/%04lu %02.0f%%, spill %lu %4.2f ms, pkt %04.1f MB, rd %06lu, t %02d:%02d, ft %05.2f, q %zu/%zu, lead %04.0f ms, dec/f %4.2f, dec %03.0f/s %s, io %5.2f ms/f, cp %05.1f MB/f, m %s %2dx %c",
+          _frameDisplayed, focused.cache.getMB(), ramHitRate, stats.levelFrames[1], stats.levelFrames[2],
+          100. * stats.getProxyHitRate(), stats.spillHits, stats.getSpillReadAvgMs(),
+          focused.packets.getMB(), focused.decoder.getFileReads(), _frameDisplayed/60, _frameDisplayed%60, _ftAvg,
+          focused.producer.getRingDepth(), focused.producer.getRingCapacity(), lead * 1000. / 60., decodesPerFrame,
+          _decodeRate, skipNames[focused.producer.getSkip()], _ioWaitMs, copiedPerFrame, getModeName(_mode), getSpeed(),
+          focused.displayedLevel ? 'P' : usedCache ? 'C' : (gotFrame || _frameDisplayed == _desiredNextFrame ? ' ' : 'W'));
+
   _frameTimer.start();
-  SDL_Surface* fontSurface = TTF_RenderText_Solid(_font, status_bar, fontColor);
-  SDL_Texture* fontTexture = SDL_CreateTextureFromSurface(_renderer, fontSurface);
-  int texW = 0;
-  int texH = 0;
-  SDL_QueryTexture(fontTexture, NULL, NULL, &texW, &texH);
-  SDL_Rect fontRect = { 0, 0, texW, texH };
-
-  if(!usedCache)
-    sws_scale(_convert, (const unsigned char* const*)_frame->data, _frame->linesize, 0, _codecContext->height, _frameYUV->data, _frameYUV->linesize);
-  SDL_UpdateTexture(_texture, nullptr, _frameYUV->data[0], _frameYUV->linesize[0]);
+
   SDL_RenderClear(_renderer);
-  SDL_RenderCopy(_renderer, _texture, nullptr, nullptr);
-  SDL_RenderFillRect(_renderer, &fontRect);
-  SDL_RenderCopy(_renderer, fontTexture, nullptr, &fontRect);
-  if(_cacheDebug)
+  int tiles = 0;
+  for(auto& stream : _streams) {
+    if(stream->visible) tiles++;
+  }
+  int tile = 0;
+  for(auto& stream : _streams) {
+    if(!stream->visible) continue;
+    SDL_Rect rect = getTile(tile++, tiles);
+    SDL_RenderCopy(_renderer, stream->textures[stream->displayedLevel], nullptr, &rect);
+  }
+  {
+    // the help text doesn't change, so only the status line is ever laid out again
+    TRACE_SCOPE(TRACE_TEXT);
+    int width = _statusLine.getWidth() + (_helpOpen ? _helpLine.getWidth() : 0);
+    SDL_Rect textRect = {0, 0, width, _glyphs.getHeight()};
+    SDL_RenderFillRect(_renderer, &textRect);
+    _statusLine.draw(_renderer, _glyphs, status_bar, 0, 0);
+    if(_helpOpen) {
+      _helpLine.draw(_renderer, _glyphs, " h: help | d: < | f: > | e: << | r: >> | j: rewind, faster | k: pause | l: play, faster | tab: focus | v: solo | c: debug | -/=: zoom | a: analytics | t: trace",
+                     _statusLine.getWidth(), 0);
+    }
+    if(_streams.size() > 1) drawStreamLabels();
+  }
+  if(_cacheDebug) {
     debugDrawCache();
-  SDL_RenderPresent(_renderer);
-
-
-  SDL_FreeSurface(fontSurface);
-  SDL_DestroyTexture(fontTexture);
+#ifdef VIDEOPLAYER_TRACE
+    debugDrawTrace();
+#endif
+  }
+  {
+    TRACE_SCOPE(TRACE_PRESENT);
+    SDL_RenderPresent(_renderer);
+  }
 }
 
-void VideoPlayer::debugDrawCache() {
-  int thickness = 50;
-  SDL_Rect rect = {0,thickness,1920,thickness};
+/*!
+ * Label each visible stream with its share of the budget and what it was worked out from, in the
+ * bottom left of its tile.  The focused stream is marked with a '*'.
+ */
+void VideoPlayer::drawStreamLabels() {
+  int tiles = 0;
+  for(auto& stream : _streams) {
+    if(stream->visible) tiles++;
+  }
 
-  SDL_SetRenderDrawColor(_renderer,255,0,0,255);
-  SDL_RenderFillRect(_renderer, &rect);
-  SDL_SetRenderDrawColor(_renderer,0,255,0,255);
+  int tile = 0;
+  for(size_t i = 0; i < _streams.size(); i++) {
+    VideoStream& stream = *_streams[i];
+    if(!stream.visible) continue;
+    SDL_Rect rect = getTile(tile++, tiles);
+
+    StreamShare share = _budget.getShare((int)i);
+    CacheTierStats stats = stream.cache.getStats();
+    char label[256];
+    snprintf(label, sizeof(label), "%zu%c f %05d, c %05.0f/%05.0f MB %02.0f%%, w %4.2f, dec %5.2f ms/f",
+             i + 1, (int)i == _budget.getFocus() ? '*' : ' ', stream.frameDisplayed, stream.cache.getMB(),
+             share.bytes / (1024. * 1024.), 100. * stats.ramHits / std::max<uint64_t>(1, stats.ramHits + stats.ramMisses),
+             share.weight, share.decodeMs);
+
+    int y = rect.y + rect.h - _glyphs.getHeight();
+    SDL_Rect background = {rect.x, y, stream.label.getWidth(), _glyphs.getHeight()};
+    SDL_RenderFillRect(_renderer, &background);
+    stream.label.draw(_renderer, _glyphs, label, rect.x, y);
+  }
+}
 
-  for(auto& kv : _cache._frameMap) {
-    int x = kv.second->frame;
-    if(x >= 1920) continue;
-    int y0 = thickness;
-    int y1 = y0 + thickness;
-    SDL_RenderDrawLine(_renderer,x,y0,x,y1);
+/*!
+ * Print hit rates for each cache tier, for each stream
+ */
+void VideoPlayer::printStats() {
+  for(size_t i = 0; i < _streams.size(); i++) {
+    VideoStream& stream = *_streams[i];
+    if(_streams.size() > 1) {
+      StreamShare share = _budget.getShare((int)i);
+      printf("stream %zu: %s, %.0f of %.0f MB (weight %.2f, %.2f ms/frame to decode)\n", i + 1, stream.name.c_str(),
+             share.bytes / (1024. * 1024.), _budget.getMaxBytes() / (1024. * 1024.), share.weight, share.decodeMs);
+    }
+    CacheTierStats stats = stream.cache.getStats();
+    uint64_t ramLookups = std::max<uint64_t>(1, stats.ramHits + stats.ramMisses);
+    uint64_t spillLookups = std::max<uint64_t>(1, stats.spillHits + stats.spillMisses);
+    printf("ram:   %lu hits, %lu misses (%.1f%% hit), %lu decoded again, %s eviction\n", stats.ramHits,
+           stats.ramMisses, 100. * stats.ramHits / ramLookups, stats.redecodes, stream.cache.getEvictionPolicyName());
+    printf("spill: %lu hits, %lu misses (%.1f%% hit), %.3f ms/read, %lu writes, %lu dropped\n",
+           stats.spillHits, stats.spillMisses, 100. * stats.spillHits / spillLookups, stats.getSpillReadAvgMs(),
+           stats.spillWrites, stats.spillDrops);
+    if(_options.proxies) {
+      printf("proxies: %lu shown for RAM misses, %lu misses (%.1f%% hit), %lu frames scaled down\n",
+             stats.proxyHits, stats.proxyMisses, 100. * stats.getProxyHitRate(), stats.demotions);
+      for(int level = 0; level < cacheLevels; level++) {
+        printf("  level %d (1/%d): %lu frames, %.1f MB\n", level, 1 << level, stats.levelFrames[level],
+               stats.levelBytes[level] / (1024. * 1024.));
+      }
+    }
+    FrameAllocatorStats allocStats = stream.cache.getAllocatorStats();
+    printf("allocator: %lu frames from the slab, %lu from the heap, %d/%d slots free (%d given back), %s\n",
+           allocStats.slabAllocs, allocStats.heapAllocs, allocStats.freeSlots, allocStats.slots,
+           allocStats.releasedSlots, FrameAllocator::getPagesName(allocStats.pages));
+    PacketCacheStats packetStats = stream.packets.getStats();
+    printf("packets: %lu GOP hits, %lu GOP misses, %zu GOPs (%.1f MB) cached\n",
+           packetStats.hits, packetStats.misses, stream.packets.getGopCount(), stream.packets.getMB());
+    printf("decoder: %lu frames decoded, %lu seeks (%lu cancelled) for %lu frames displayed\n",
+           stream.decoder.getDecodedFrames(), stream.decoder.getSeeks(), stream.decoder.getCancelledSeeks(),
+           _displayedFrames);
+    printf("copies: %.2f MB into the cache, %.2f MB uploaded, %.2f MB per displayed frame\n",
+           stream.decoder.getBytesCopied() / (1024. * 1024.), stream.bytesUploaded / (1024. * 1024.),
+           (stream.decoder.getBytesCopied() + stream.bytesUploaded) / (1024. * 1024.) / std::max<uint64_t>(1, _displayedFrames));
+    if(_streams.size() > 1) {
+      printf("workers: %lu GOPs decoded\n", _workers.getGopsDecoded((int)i));
+    }
+    printf("file: %lu packets read (%.1f MB)\n", stream.decoder.getFileReads(), stream.decoder.getFileBytes() / (1024. * 1024.));
+    uint64_t decoded = std::max<uint64_t>(1, stream.decoder.getDecodedFrames());
+    printf("io: %.1f ms waiting on reads (%.3f ms per decoded frame), %.1f MB read ahead, workers %.1f ms\n",
+           stream.decoder.getIoWaitNs() / 1.e6, stream.decoder.getIoWaitNs() / 1.e6 / decoded,
+           stream.decoder.getReadaheadBytes() / (1024. * 1024.), _workers.getIoWaitNs((int)i) / 1.e6);
+    if(stream.server.isOpen()) {
+      FrameServerStats server = stream.server.getStats();
+      printf("frame server %s: %lu frames published, %lu for requests, %lu dropped, %d clients, %.2f ms slowest publish\n",
+             stream.server.getName().c_str(), server.published, server.requests, server.drops, server.consumers,
+             server.maxPublishMs);
+    }
   }
+  printf("workers: %d threads decoded %lu GOPs\n", _workers.getWorkerCount(), _workers.getGopsDecoded());
+  if(_options.adaptive) {
+    MemoryMonitorStats memory = _memory.getStats();
+    printf("memory: budget %.0f of %.0f MB, %lu cuts, %lu grows, %lu pressure triggers, some avg10 %.2f%%",
+           _budget.getMaxBytes() / (1024. * 1024.), memory.maxBytes / (1024. * 1024.), memory.shrinks, memory.grows,
+           memory.triggers, memory.avg10);
+    if(memory.cgroupMax > 0) {
+      printf(", cgroup %.0f of %.0f MB and %.0f MB of page cache", (memory.cgroupCurrent - memory.cgroupFile) / (1024. * 1024.),
+             memory.cgroupMax / (1024. * 1024.), memory.cgroupFile / (1024. * 1024.));
+    }
+    printf("\n");
+  }
+}
 
-  SDL_SetRenderDrawColor(_renderer,0,0,255,255);
-  int x = _frameDisplayed;
-  if(x < 1920) {
-    int y0 = thickness;
-    int y1 = y0 + thickness;
-    SDL_RenderDrawLine(_renderer,x,y0,x,y1);
+/*!
+ * Write each stream's cache analytics to a JSON file: counters, reuse distance histogram, eviction log
+ * and timeline
+ * @return false if the file couldn't be written
+ */
+bool VideoPlayer::writeAnalytics(const std::string &fileName) {
+  FILE* out = fopen(fileName.c_str(), "w");
+  if(!out) {
+    printf("can't write %s\n", fileName.c_str());
+    return false;
   }
+  fprintf(out, "{\"streams\": [");
+  for(size_t i = 0; i < _streams.size(); i++) {
+    fprintf(out, "%s\n{\"clip\": \"%s\", \"cache\": ", i ? "," : "", _streams[i]->name.c_str());
+    _streams[i]->cache.writeAnalytics(out);
+    fprintf(out, "}");
+  }
+  fprintf(out, "]}\n");
+  fclose(out);
+  printf("cache analytics written to %s\n", fileName.c_str());
+  return true;
+}
 
+/*!
+ * Draw the focused stream's cache as a timeline across the window: green for frames cached at full
+ * resolution, yellow for proxies, red for evicted frames and blue for the playhead.  Zoomed in, it
+ * shows the part of the clip around the playhead.
+ */
+void VideoPlayer::debugDrawCache() {
+  const int rowHeight = 50;
+  int windowWidth, windowHeight;
+  SDL_GetRendererOutputSize(_renderer, &windowWidth, &windowHeight);
+
+  VideoStream& stream = getFocused();
+  stream.cache.getFrameStates(_timelineStates);
+  int frames = std::max((int)_timelineStates.size(), stream.frameDisplayed + 1);
+  if(stream.decoder.getIndex().isLoaded()) frames = std::max(frames, stream.decoder.getIndex().getFrameCount());
+  if(stream.decoder.getLastFrame() != INT_MAX) frames = std::max(frames, stream.decoder.getLastFrame() + 1);
+  frames = std::max(frames, 1);
+
+  // the part of the clip around the playhead at this zoom
+  while(_timelineZoom > 1 && frames / _timelineZoom < minTimelineFrames) _timelineZoom /= 2;
+  int span = std::max(1, frames / _timelineZoom);
+  int first = std::max(0, std::min(stream.frameDisplayed - span / 2, frames - span));
+
+  // each column shows the best state of the frames under it, runs of a color are drawn as one rect
+  static const SDL_Color colors[] = {
+    {40, 40, 40, 255},  // TIMELINE_EMPTY
+    {255, 0, 0, 255},   // TIMELINE_EVICTED
+    {255, 200, 0, 255}, // TIMELINE_PROXY
+    {0, 255, 0, 255}    // TIMELINE_CACHED
+  };
+  int y = rowHeight;
+  int runStart = 0;
+  int runState = -1;
+  for(int x = 0; x <= windowWidth; x++) {
+    int state = -1;
+    if(x < windowWidth) {
+      int from = first + (int)((int64_t)x * span / windowWidth);
+      int to = std::max(from + 1, first + (int)((int64_t)(x + 1) * span / windowWidth));
+      state = TIMELINE_EMPTY;
+      for(int frame = from; frame < to && frame < (int)_timelineStates.size(); frame++) {
+        state = std::max(state, (int)_timelineStates[frame]);
+      }
+    }
+    if(state == runState) continue;
+    if(runState >= 0) {
+      const SDL_Color& color = colors[runState];
+      SDL_SetRenderDrawColor(_renderer, color.r, color.g, color.b, color.a);
+      SDL_Rect run = {runStart, y, x - runStart, rowHeight};
+      SDL_RenderFillRect(_renderer, &run);
+    }
+    runStart = x;
+    runState = state;
+  }
 
+  // the playhead, at least a pixel wide however far we're zoomed in
+  if(stream.frameDisplayed >= first && stream.frameDisplayed < first + span) {
+    int x0 = (int)((int64_t)(stream.frameDisplayed - first) * windowWidth / span);
+    int x1 = (int)((int64_t)(stream.frameDisplayed + 1 - first) * windowWidth / span);
+    SDL_SetRenderDrawColor(_renderer, 0, 0, 255, 255);
+    SDL_Rect playhead = {x0, y, std::max(1, x1 - x0), rowHeight};
+    SDL_RenderFillRect(_renderer, &playhead);
+  }
 
-  SDL_SetRenderDrawColor(_renderer,0,0,0,255);
+  CacheTierStats stats = stream.cache.getStats();
+  char label[256];
+  snprintf(label, sizeof(label), "frames %d-%d of %d, zoom %dx | %lu inserts, %lu evictions, %lu re-decodes",
+           first, first + span - 1, frames, _timelineZoom, stats.inserts, stats.evictions, stats.redecodes);
+  SDL_SetRenderDrawColor(_renderer, 0, 0, 0, 255);
+  SDL_Rect background = {0, y + rowHeight, _timelineLine.getWidth(), _glyphs.getHeight()};
+  SDL_RenderFillRect(_renderer, &background);
+  _timelineLine.draw(_renderer, _glyphs, label, 0, y + rowHeight);
 }
 
-void VideoPlayer::updateCacheIfNeeded(int frame, uint8_t *data) {
-  sws_scale(_convert, (const unsigned char* const*)_frame->data, _frame->linesize, 0, _codecContext->height, _frameYUV->data, _frameYUV->linesize);
-  _cache.addFrame(_frameYUV->data[0], _frameDataSize, frame);
+#ifdef VIDEOPLAYER_TRACE
+/*!
+ * Draw a histogram of each traced stage below the cache timeline, with log2 buckets from 1 us on the left
+ */
+void VideoPlayer::debugDrawTrace() {
+  const int rowHeight = 28;
+  const int barWidth = 10;
+  const int labelWidth = 560;
+  int y = 110 + _glyphs.getHeight();
+  _traceLines.resize(TRACE_STAGE_COUNT);
+
+  for(int stage = 0; stage < TRACE_STAGE_COUNT; stage++) {
+    TraceHistogram histogram = Trace::getHistogram((TraceStage)stage);
+    if(!histogram.count) continue;
+
+    char label[128];
+    snprintf(label, sizeof(label), "%-12s p50 %7.3f  p99 %7.3f  max %7.3f ms  n %lu",
+             Trace::getStageName((TraceStage)stage), histogram.getPercentileMs(0.5),
+             histogram.getPercentileMs(0.99), histogram.maxNs / 1.e6, histogram.count);
+
+    SDL_Rect background = {0, y, labelWidth + traceBuckets * barWidth, rowHeight};
+    SDL_SetRenderDrawColor(_renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(_renderer, &background);
+
+    _traceLines[stage].draw(_renderer, _glyphs, label, 0, y);
+
+    uint64_t most = *std::max_element(histogram.buckets, histogram.buckets + traceBuckets);
+    SDL_SetRenderDrawColor(_renderer, 255, 160, 0, 255);
+    for(int i = 0; i < traceBuckets; i++) {
+      int height = (int)(histogram.buckets[i] * (rowHeight - 2) / std::max<uint64_t>(1, most));
+      SDL_Rect bar = {labelWidth + i * barWidth, y + rowHeight - height, barWidth - 1, height};
+      SDL_RenderFillRect(_renderer, &bar);
+    }
+    y += rowHeight;
+  }
+
+  SDL_SetRenderDrawColor(_renderer, 0, 0, 0, 255);
 }
+#endif
 
-bool VideoPlayer::tryCache(int frame) {
+/*!
+ * Upload a frame from a stream's cache, if we have it.
+ * @param allowProxy : show a scaled down copy if we don't have it at full resolution
+ */
+bool VideoPlayer::tryCache(VideoStream& stream, int frame, bool allowProxy) {
 
-  auto* result = _cache.getFrame(frame);
-//  if(_mode == PLAY && !_cache.getFrame(frame + 1)) {
-//    return false;
-//  }
+  auto* result = stream.cache.getFrame(frame);
+  if(!result && allowProxy && _options.proxies) result = stream.cache.getProxy(frame);
   if(result) {
-    _frameDisplayed = frame;
-
     // printf("got cache %d\n", frame);
-    memcpy(_frameYUV->data[0], result->data, result->size);
-    //memset(_frameYUV->data[0], 0, result->size);
+    uploadFrame(stream, result);
+    stream.cache.releaseFrame(result);
     return true;
   }
 
@@ -624,4 +1181,4 @@ bool VideoPlayer::tryCache(int frame) {
 
 
   return false;
-}
\ No newline at end of file
+}
@@ -2,8 +2,19 @@
 #define VIDEOPLAYER_VIDEOPLAYER_H
 
 
+#include <stdlib.h>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <vector>
+#include "CacheManager.h"
+#include "FrameProducer.h"
+#include "FrameServer.h"
+#include "GopWorkers.h"
+#include "MemoryMonitor.h"
+#include "VideoCache.h"
+#include "VideoDecoder.h"
+#include "TextRenderer.h"
+#include "Timer.h"
 
 extern "C" {
 #include "SDL.h"
@@ -16,34 +27,12 @@ extern "C" {
 
 
 
-#include <time.h>
-
-class Timer {
-public:
-  explicit Timer() { start(); }
-
-  void start() { clock_gettime(CLOCK_MONOTONIC, &_startTime); }
-
-  double getMs() { return (double)getNs() / 1.e6; }
-
-  int64_t getNs() {
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    return (int64_t)(now.tv_nsec - _startTime.tv_nsec) +
-           1000000000 * (now.tv_sec - _startTime.tv_sec);
-  }
-
-  double getSeconds() { return (double)getNs() / 1.e9; }
-
-  struct timespec _startTime;
-};
-
 /*!
  * User selectable playback modes
  */
 enum PlaybackMode {
-  PLAY,    // advance at 60 fps
-  REWIND,  // rewind at 60 fps
+  PLAY,    // advance at 60 fps times the shuttle speed
+  REWIND,  // rewind at 60 fps times the shuttle speed
   PAUSE,   // pause the video
   FRAME_FORWARD, // advance a single frame, then pause
   FRAME_BACKWARD // go back a single frame, then pause
@@ -51,94 +40,184 @@ enum PlaybackMode {
 
 
 /*!
- * A record of a frame which is cached.
+ * Settings from the command line
  */
-struct FrameRecord {
-  uint8_t* data;
-  int frame;
-  uint64_t use_id;
-  uint64_t size;
+struct PlayerOptions {
+  uint64_t cacheMB = 2048;   // RAM cache
+  uint64_t spillMB = 0;      // spill tier on disk, 0 to disable it
+  std::string spillFile = "/tmp/videoPlayer.spill";
+  uint64_t packetMB = 256;   // compressed packets, 0 to disable
+  int workers = -1;          // threads filling the cache around the playhead, -1 for half the cores
+  int fillRadius = 120;      // frames on each side of the playhead for the workers to fill
+  bool proxies = true;       // keep scaled down copies of frames away from the playhead
+  std::string eviction = "lru"; // how frames are picked to be cleaned, see EvictionPolicy::create()
+  bool slab = true;          // reserve the whole cache budget up front instead of using the heap
+  bool mmap = true;          // read files through a FileReader instead of FFmpeg's file protocol
+  bool adaptive = true;      // shrink the cache under memory pressure and grow it back after
+  std::string psiFile;       // stands in for the kernel's memory pressure information, for testing
+  bool headless = false;     // SDL dummy video driver and software rendering, for benchmarks
+  int windowWidth = 0;       // starting window size, 0 for the first video's, shrunk to fit the screen
+  int windowHeight = 0;
+  bool fitOutput = true;     // decode and cache frames at the size they're shown, not the source's
+  std::string traceFile = "videoPlayer.trace.json"; // written by 't', when built with VIDEOPLAYER_TRACE
+  bool traceAtExit = false;
+  std::string analyticsFile = "videoPlayer.cache.json"; // cache analytics, written by 'a'
+  bool analyticsAtExit = false;
+  std::string serveName;     // shared memory to publish the frames shown in, for FrameClient.h, empty for none
 };
 
 
 /*!
- * A collection of decoded frames
+ * One of the videos being played: its own cache and decoders, and what it's showing.
  */
-class VideoCache {
-public:
-  VideoCache(uint64_t maxMemory) : _maxMemory(maxMemory) { }
-  void addFrame(uint8_t* data, uint64_t size, int frame);
-  void cleanFrame();
-
-  double getMB() {
-    return _totalMemUse / (1024. * 1024.);
-  }
-
-  FrameRecord* getFrame(int frame);
-  std::unordered_map<int, FrameRecord*> _frameMap;
-private:
-
-  uint64_t _totalMemUse = 0;
-  uint64_t _useCount = 0;
-  uint64_t _maxMemory;
+struct VideoStream {
+  VideoStream(const std::string& fileName, const PlayerOptions& options, int streamCount);
+  ~VideoStream();
+
+  // the producer's ring is aligned to cache lines, which plain new doesn't do before C++17
+  static void* operator new(size_t size);
+  static void operator delete(void* stream) { free(stream); }
+
+  std::string name;
+  VideoCache cache;
+  PacketCache packets;
+  VideoDecoder decoder;
+  FrameProducer producer;
+  FrameServer server;        // open if the frames shown are published
+
+  SDL_Texture* textures[cacheLevels] = {}; // for each level, the size of the last frame uploaded into it
+  int textureWidths[cacheLevels] = {};
+  int textureHeights[cacheLevels] = {};
+  int outputWidth = 0;       // size its frames are decoded and cached at
+  int outputHeight = 0;
+  int frameDisplayed = -1;
+  int displayedLevel = 0;    // 0 if frameDisplayed is at full resolution, otherwise its proxy level
+  bool visible = true;
+  uint64_t bytesUploaded = 0;
+
+  // frame held for showing once every visible stream has its own
+  FrameRecord* pending = nullptr;
+  int pendingFrame = -1;
+  bool pendingFromCache = false;
+
+  TextLine label;
 };
 
 
+/*!
+ * Video player.
+ * Decoding happens on each stream's FrameProducer thread; the player handles input and shows whichever
+ * frames are ready, so it never waits on the decoder.
+ *
+ * Several videos, such as camera angles of the same scene, can be played together, tiled in the window.
+ * They share one playhead, one cache budget split between them by a CacheManager, and one pool of
+ * GopWorkers.  A new frame is only shown once every visible stream has it, so they stay frame-locked.
+ * While shuttling, the focused stream picks the frame and the others show it if they have it.
+ *
+ * With a frame server name, each stream publishes the frames it shows to shared memory through a
+ * FrameServer, so other processes can read them without decoding the video again.
+ *
+ * The window can be resized.  Each stream is decoded and cached at the size of its tile rather than its
+ * source's, and once the window settles on a new size, the streams' decoders and caches move to the
+ * new tile sizes.
+ */
 class VideoPlayer {
 public:
-  explicit VideoPlayer(const std::string& fileName, uint64_t maxMemory);
+  VideoPlayer(const std::vector<std::string>& fileNames, const PlayerOptions& options);
+  ~VideoPlayer();
   void playback();
+  void seek(int frame);
+  void printStats();
+  bool writeAnalytics(const std::string& fileName);
+
+  bool isOpen() { return _open; }
+  int getFrameDisplayed() { return _frameDisplayed; }
+  int getDesiredFrame() { return _desiredNextFrame; }
+  int getLastFrame();
+  PlaybackMode getMode() { return _mode; }
+  int getSpeed() { return _mode == PLAY || _mode == REWIND ? _speed : 1; }
+  uint64_t getDisplayedFrames() { return _displayedFrames; }
+  uint64_t getDecodedFrames();
+  uint64_t getIoWaitNs();
+  CacheTierStats getCacheStats();
+
+  int getStreamCount() { return (int)_streams.size(); }
+  int getStreamFrame(int stream) { return _streams[stream]->frameDisplayed; }
+  bool isStreamVisible(int stream) { return _streams[stream]->visible; }
+  CacheTierStats getCacheStats(int stream) { return _streams[stream]->cache.getStats(); }
+  StreamShare getStreamShare(int stream) { return _budget.getShare(stream); }
+  MemoryMonitorStats getMemoryStats() { return _memory.getStats(); }
+
 private:
   void debugDrawCache();
+  void debugDrawTrace();
+  void drawStreamLabels();
   void setup();
   void exitIfNeeded();
   int determineNextFrame();
-  void seekTo(int frame);
-  void displayConsecutive();
-  void displaySeekForward();
-  void displaySeekBackward();
-  void updateCacheIfNeeded(int frame, uint8_t* data);
-  bool tryCache(int frame);
-  int64_t ptsToFrame(int64_t pts);
-  int64_t frameToPts(int frame);
-
-  std::string _name;
-  AVFormatContext* _context;
-  AVCodecContext* _codecContext;
-  AVCodec* _codec;
-  AVFrame* _frame, * _frameYUV;
-  int _videoStreamIdx = -1;
-
-  uint8_t* _frameData;
-  size_t _frameSize;
-
-  SDL_Window* _window;
-  SDL_Renderer* _renderer;
-  SDL_Texture* _texture;
-
-  SwsContext* _convert;
-
-  int _currentDecoderFrame = 0;
-  int _frameDisplayed = 0;
+  int getDirection();
+  void shuttle(int direction);
+  int getShuttleFrame();
+  void setFocus(int stream);
+  void shareBudget();
+  void followMemory();
+  void spareWorkers();
+  void followWindow();
+  void getOutputSize(VideoStream& stream, const SDL_Rect& tile, int& width, int& height);
+  void setOutputSize(int stream, int width, int height);
+  VideoStream& getFocused() { return *_streams[_budget.getFocus()]; }
+  SDL_Rect getTile(int tile, int tiles);
+  bool showLockedFrame(bool& usedCache);
+  bool fetchFrame(VideoStream& stream, int frame, bool allowProxy);
+  void showPending(VideoStream& stream);
+  void releasePending(VideoStream& stream);
+  void dropFrames(VideoStream& stream);
+  bool showShuttleFrame(VideoStream& stream, bool& usedCache);
+  bool followFrame(VideoStream& stream, int frame);
+  bool tryCache(VideoStream& stream, int frame, bool allowProxy);
+  void uploadFrame(VideoStream& stream, const FrameRecord* rec);
+
+  PlayerOptions _options;
+
+  bool _open = false;
+  SDL_Window* _window = nullptr;
+  SDL_Renderer* _renderer = nullptr;
+
+  int _frameDisplayed = -1;  // frame every visible stream is showing
   int _desiredNextFrame = 0;
-  bool rewind = false;
-
-  int64_t _timeBase;
-  int64_t _seekTimeBase;
-
-  bool _ptsZeroSet = false;
-  int64_t _ptsZero;
+  uint64_t _displayedFrames = 0;
 
-  VideoCache _cache;
-  bool _usedCache = false;
+  std::vector<std::unique_ptr<VideoStream>> _streams;
+  CacheManager _budget;
+  MemoryMonitor _memory;
+  GopWorkers _workers;       // after the streams, so it's stopped before their caches go
+  bool _solo = false;        // only the focused stream is shown
   bool _cacheDebug = false;
   bool _helpOpen = true;
-  TTF_Font* _font;
+  TTF_Font* _font = nullptr;
+  GlyphAtlas _glyphs;
+  TextLine _statusLine;
+  TextLine _helpLine;
+  std::vector<TextLine> _traceLines;
   PlaybackMode _mode = PLAY;
-  uint64_t _frameDataSize;
+  int _speed = 1;             // shuttle speed, doubled by each j or l press in the same direction
+  int _shuttleOrigin = 0;     // frame the shuttle clock started at
+  Timer _shuttleClock;
+  Timer _analyticsClock;      // since the caches' counters were last sampled
+  int _timelineZoom = 1;      // the cache timeline shows this fraction of the clip
+  std::vector<uint8_t> _timelineStates;
+  TextLine _timelineLine;
+  int _lastDirection = 1;     // way the playhead last moved, the workers fill that side first
+  bool _workersHeld = false;  // the workers are paused for the producers to catch up
+  bool _resizePending = false; // the tiles changed size since the output sizes were last fitted to them
+  Timer _resizeClock;         // since the window last changed size
 
   Timer _frameTimer;
   double _ftAvg = 0;
+  double _decodeRate = 0;     // frames per second decoded by the producers
+  uint64_t _lastDecoded = 0;
+  double _ioWaitMs = 0;       // the producers' read wait per decoded frame
+  uint64_t _lastIoWaitNs = 0;
 };
 
 
@@ -0,0 +1,1616 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "ClipGenerator.h"
+#include "EvictionPolicy.h"
+#include "FrameClient.h"
+#include "FrameExtractor.h"
+#include "FrameProducer.h"
+#include "FrameServer.h"
+#include "GopWorkers.h"
+#include "PacketCache.h"
+#include "PixelConverter.h"
+#include "VideoCache.h"
+#include "VideoDecoder.h"
+#include "VideoPlayer.h"
+#include "Timer.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+};
+
+// display rate the player is paced at
+static const double frameMs = 1000. / 60.;
+
+/*!
+ * Sleep until the end of the current display frame
+ */
+static void waitForVsync(Timer& frameTimer) {
+  double left = frameMs - frameTimer.getMs();
+  if(left > 0) std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(left * 1000)));
+  frameTimer.start();
+}
+
+/*!
+ * Measure the cost of inserting into a full cache (one eviction per insert) and of cache hits, for
+ * caches holding different numbers of frames.  Both should stay flat as the cache grows.
+ */
+static int benchCache() {
+  const uint64_t payload = 1024;
+  const int ops = 200000;
+  std::vector<uint8_t> frameData(payload, 0x80);
+  std::mt19937 rng(1234);
+
+  printf("%10s %14s %14s\n", "frames", "insert ns/op", "hit ns/op");
+  for(int frames : {100, 1000, 10000, 100000}) {
+    VideoCache cache(0);
+    cache.setMaxBytes(frames * (payload + sizeof(FrameRecord)));
+
+    // fill the cache so every following insert has to clean a frame
+    int nextFrame = 0;
+    for(; nextFrame < frames; nextFrame++) {
+      cache.addFrame(frameData.data(), payload, nextFrame);
+    }
+
+    Timer insertTimer;
+    for(int i = 0; i < ops; i++) {
+      cache.addFrame(frameData.data(), payload, nextFrame++);
+    }
+    double insertNs = (double)insertTimer.getNs() / ops;
+
+    // hits on frames spread across the whole cache, which moves them to the front of the use list
+    std::uniform_int_distribution<int> dist(nextFrame - frames, nextFrame - 1);
+    std::vector<int> hits(ops);
+    for(auto& h : hits) h = dist(rng);
+
+    int missed = 0;
+    Timer hitTimer;
+    for(int h : hits) {
+      FrameRecord* rec = cache.getFrame(h);
+      if(rec) cache.releaseFrame(rec);
+      else missed++;
+    }
+    double hitNs = (double)hitTimer.getNs() / ops;
+
+    printf("%10zu %14.1f %14.1f%s\n", cache.getFrameCount(), insertNs, hitNs, missed ? " (misses!)" : "");
+  }
+
+  return 0;
+}
+
+/*!
+ * Results of rewinding through a clip
+ */
+struct RewindResult {
+  int displayed = 0;
+  int late = 0;          // display frames where the next frame wasn't ready
+  uint64_t decoded = 0;
+  uint64_t seeks = 0;
+  double seconds = 0;
+};
+
+static void printRewind(const char* name, RewindResult& r) {
+  printf("%-10s displayed %5d  decoded %6lu  dec/f %6.2f  seeks %5lu  late %5d  %6.2f s (ideal %.2f s)\n",
+         name, r.displayed, r.decoded, (double)r.decoded / r.displayed, r.seeks, r.late, r.seconds,
+         r.displayed * frameMs / 1000.);
+}
+
+/*!
+ * Rewind the old way, decoding on the display thread whenever the frame isn't cached
+ */
+static RewindResult rewindOnDemand(const char* fileName, int start, uint64_t cacheMB) {
+  RewindResult r;
+  VideoCache cache(cacheMB);
+  VideoDecoder decoder(fileName, cache);
+  if(!decoder.open()) exit(1);
+  decoder.seekTo(start);
+  uint64_t decoded0 = decoder.getDecodedFrames(), seeks0 = decoder.getSeeks();
+
+  Timer total, frameTimer;
+  for(int frame = start; frame >= 0; frame--) {
+    if(!cache.hasFrame(frame)) decoder.seekTo(frame);
+    if(frameTimer.getMs() > frameMs) r.late++;
+    r.displayed++;
+    waitForVsync(frameTimer);
+  }
+
+  r.seconds = total.getSeconds();
+  r.decoded = decoder.getDecodedFrames() - decoded0;
+  r.seeks = decoder.getSeeks() - seeks0;
+  return r;
+}
+
+/*!
+ * Rewind with the decode thread, which decodes the previous GOP while the current one is shown
+ */
+static RewindResult rewindProducer(const char* fileName, int start, uint64_t cacheMB) {
+  RewindResult r;
+  VideoCache cache(cacheMB);
+  VideoDecoder decoder(fileName, cache);
+  if(!decoder.open()) exit(1);
+  decoder.seekTo(start);
+  uint64_t decoded0 = decoder.getDecodedFrames(), seeks0 = decoder.getSeeks();
+
+  FrameProducer producer(decoder, cache);
+  producer.start(8);
+
+  Timer total, frameTimer;
+  int frame = start;
+  while(frame >= 0) {
+    producer.request(frame, -1);
+
+    bool ready = false;
+    if(producer.peekFrame(frame)) {
+      producer.popFrame();
+      ready = true;
+    } else if(FrameRecord* rec = cache.getFrame(frame)) {
+      cache.releaseFrame(rec);
+      ready = true;
+    } else if(producer.hasPassed(frame)) {
+      producer.restart();
+    }
+
+    if(ready) {
+      r.displayed++;
+      frame--;
+    } else {
+      r.late++;
+    }
+    waitForVsync(frameTimer);
+  }
+
+  r.seconds = total.getSeconds();
+  producer.stop();
+  r.decoded = decoder.getDecodedFrames() - decoded0;
+  r.seeks = decoder.getSeeks() - seeks0;
+  return r;
+}
+
+/*!
+ * Compare decodes per displayed frame and late frames when rewinding from a frame back to the start
+ */
+static int benchRewind(int argc, char** argv) {
+  if(argc < 4) {
+    printf("usage: videoPlayerBench rewind <file> <startFrame> [cacheMB]\n");
+    return 1;
+  }
+  int start = atoi(argv[3]);
+  uint64_t cacheMB = argc > 4 ? atol(argv[4]) : 2048;
+
+  RewindResult onDemand = rewindOnDemand(argv[2], start, cacheMB);
+  RewindResult producer = rewindProducer(argv[2], start, cacheMB);
+  printRewind("on-demand", onDemand);
+  printRewind("gop", producer);
+  return 0;
+}
+
+/*!
+ * Seek to random frames and count how many seeks it took
+ */
+static void seekRandom(const char* fileName, bool useIndex, int frameCount, int seekCount) {
+  VideoCache cache(64);
+  VideoDecoder decoder(fileName, cache);
+  decoder.setUseIndex(useIndex);
+  if(!decoder.open()) exit(1);
+
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> dist(0, frameCount - 1);
+  int missed = 0;
+
+  Timer timer;
+  for(int i = 0; i < seekCount; i++) {
+    int frame = dist(rng);
+    decoder.seekTo(frame);
+    if(decoder.getCurrentFrame() != frame) missed++;
+  }
+  double ms = timer.getMs();
+
+  printf("%-9s %5d seeks: %6lu av_seek_frame calls, %6lu retries, %5d wrong frames, %8.2f ms/seek, dec/seek %.1f\n",
+         useIndex ? "index" : "no index", seekCount, decoder.getSeeks(), decoder.getSeekRetries(), missed,
+         ms / seekCount, (double)decoder.getDecodedFrames() / seekCount);
+}
+
+/*!
+ * Time building and loading the packet index, and compare random seeks with and without it
+ */
+static int benchSeek(int argc, char** argv) {
+  if(argc < 3) {
+    printf("usage: videoPlayerBench seek <file> [seekCount]\n");
+    return 1;
+  }
+  int seekCount = argc > 3 ? atoi(argv[3]) : 200;
+
+  // builds the sidecar if there isn't one yet
+  VideoCache cache(64);
+  VideoDecoder decoder(argv[2], cache);
+  if(!decoder.open()) return 1;
+  int frameCount = decoder.getIndex().getFrameCount();
+  int stream = decoder.getStreamIndex();
+
+  PacketIndex index;
+  Timer buildTimer;
+  index.build(argv[2], stream);
+  double buildMs = buildTimer.getMs();
+  Timer loadTimer;
+  index.load(argv[2], stream);
+  double loadMs = loadTimer.getMs();
+  printf("index: %d frames, %d gops, build %.2f ms, load %.3f ms\n", frameCount, index.getGopCount(), buildMs, loadMs);
+
+  seekRandom(argv[2], false, frameCount, seekCount);
+  seekRandom(argv[2], true, frameCount, seekCount);
+  return 0;
+}
+
+/*!
+ * Compare getting a frame back from the spill tier with decoding it again.
+ * The RAM tier has no budget, so every decoded frame is cleaned straight into the spill tier.
+ */
+static int benchSpill(int argc, char** argv) {
+  if(argc < 3) {
+    printf("usage: videoPlayerBench spill <file> [frames] [spillFile]\n");
+    return 1;
+  }
+  int frames = argc > 3 ? atoi(argv[3]) : 300;
+  const char* spillFile = argc > 4 ? argv[4] : "/tmp/videoPlayerBench.spill";
+
+  VideoCache cache(0);
+  VideoDecoder decoder(argv[2], cache);
+  if(!decoder.open()) return 1;
+  frames = std::min(frames, decoder.getLastFrame() + 1);
+  uint64_t frameSize = decoder.getFrameDataSize();
+  if(!cache.enableSpill(spillFile, frameSize * frames, frameSize)) return 1;
+
+  // decode in order, pacing it so the spill thread never has to drop a frame
+  double decodeMs = 0;
+  for(int frame = 0; frame < frames; frame++) {
+    Timer decodeTimer;
+    decoder.seekTo(frame);
+    decodeMs += decodeTimer.getMs();
+    while(cache.getStats().spillWrites + cache.getStats().spillDrops < (uint64_t)frame) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  // read them back in random order
+  std::vector<int> order(frames);
+  for(int i = 0; i < frames; i++) order[i] = i;
+  std::shuffle(order.begin(), order.end(), std::mt19937(1234));
+  int missed = 0;
+  for(int frame : order) {
+    if(!cache.loadFromSpill(frame)) missed++;
+  }
+
+  CacheTierStats stats = cache.getStats();
+  printf("%d frames of %.2f MB: decode+convert %.3f ms/frame, spill read %.3f ms/frame (%lu dropped, %d missed)\n",
+         frames, frameSize / (1024. * 1024.), decodeMs / frames, stats.getSpillReadAvgMs(), stats.spillDrops, missed);
+  return 0;
+}
+
+/*!
+ * Seek storm over a file which isn't in the page cache, read by FFmpeg and then by a FileReader which is
+ * given each seek target one seek early, the way the producer is told about a jump before it gets there.
+ * The file is dropped from the page cache before each pass.  Run it on a slow or throttled device (a
+ * loop device with a cgroup io.max limit, or a FUSE mount with a delay) to see the stalls it removes.
+ */
+static int benchIo(int argc, char** argv) {
+  if(argc < 3) {
+    printf("usage: videoPlayerBench io <file> [seeks]\n");
+    return 1;
+  }
+  int seeks = argc > 3 ? atoi(argv[3]) : 200;
+
+  for(FileReadMode mode : {READ_FFMPEG, READ_MMAP}) {
+    // so the reads have to go to the device
+    int fd = open(argv[2], O_RDONLY);
+    if(fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+
+    VideoCache cache(256);
+    VideoDecoder decoder(argv[2], cache);
+    decoder.setReadMode(mode);
+    if(!decoder.open()) return 1;
+    if(!decoder.getIndex().isLoaded()) printf("no index, seek targets can't be read ahead\n");
+
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> dist(0, decoder.getLastFrame());
+    std::vector<int> targets(seeks + 1);
+    for(auto& target : targets) target = dist(rng);
+
+    std::vector<double> times;
+    decoder.prefetch(targets[0]);
+    for(int i = 0; i < seeks; i++) {
+      decoder.prefetch(targets[i + 1]);
+      Timer timer;
+      decoder.seekTo(targets[i]);
+      times.push_back(timer.getMs());
+    }
+    std::sort(times.begin(), times.end());
+
+    double total = 0;
+    for(double ms : times) total += ms;
+    uint64_t decoded = std::max<uint64_t>(1, decoder.getDecodedFrames());
+    printf("%-6s %7.2f ms/seek (p50 %7.2f, p95 %7.2f), io wait %6.3f ms/frame over %lu frames, %.1f MB read ahead\n",
+           mode == READ_MMAP ? "mmap" : "ffmpeg", total / seeks, times[times.size() / 2], times[times.size() * 95 / 100],
+           decoder.getIoWaitNs() / 1.e6 / decoded, decoder.getDecodedFrames(),
+           decoder.getReadaheadBytes() / (1024. * 1024.));
+  }
+  return 0;
+}
+
+/*!
+ * Scrub randomly back and forth over the same region a few times.  Decoded frames aren't cached, so
+ * every pass decodes, but after the first pass the packets should all come from the packet cache.
+ */
+static int benchScrub(int argc, char** argv) {
+  if(argc < 3) {
+    printf("usage: videoPlayerBench scrub <file> [startFrame] [frames] [passes]\n");
+    return 1;
+  }
+  int start = argc > 3 ? atoi(argv[3]) : 0;
+  int frames = argc > 4 ? atoi(argv[4]) : 600;
+  int passes = argc > 5 ? atoi(argv[5]) : 4;
+
+  VideoCache cache(0);
+  PacketCache packets(256);
+  VideoDecoder decoder(argv[2], cache);
+  decoder.setPacketCache(&packets);
+  if(!decoder.open()) return 1;
+  if(!decoder.getIndex().isLoaded()) {
+    printf("the packet cache needs the index\n");
+    return 1;
+  }
+  frames = std::min(frames, decoder.getLastFrame() + 1 - start);
+
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> dist(start, start + frames - 1);
+  for(int pass = 0; pass < passes; pass++) {
+    uint64_t reads = decoder.getFileReads();
+    uint64_t bytes = decoder.getFileBytes();
+    uint64_t seeks = decoder.getSeeks();
+    PacketCacheStats before = packets.getStats();
+
+    Timer timer;
+    for(int i = 0; i < 100; i++) {
+      decoder.seekTo(dist(rng));
+    }
+    double ms = timer.getMs();
+
+    PacketCacheStats after = packets.getStats();
+    printf("pass %d: %6.2f ms/seek, %5lu file packets (%7.2f MB), %4lu file seeks, %4lu GOP hits, %4lu GOP misses\n",
+           pass, ms / 100, decoder.getFileReads() - reads, (decoder.getFileBytes() - bytes) / (1024. * 1024.),
+           decoder.getSeeks() - seeks, after.hits - before.hits, after.misses - before.misses);
+  }
+  printf("packet cache: %zu GOPs, %.2f MB\n", packets.getGopCount(), packets.getMB());
+  return 0;
+}
+
+/*!
+ * Time filling the cache around a frame with different numbers of gop workers
+ */
+static int benchFill(int argc, char** argv) {
+  if(argc < 4) {
+    printf("usage: videoPlayerBench fill <file> <frame> [radius] [maxWorkers]\n");
+    return 1;
+  }
+  int center = atoi(argv[3]);
+  int radius = argc > 4 ? atoi(argv[4]) : 120;
+  int maxWorkers = argc > 5 ? atoi(argv[5]) : (int)std::thread::hardware_concurrency();
+
+  double oneWorkerMs = 0;
+  for(int workers = 1; workers <= maxWorkers; workers *= 2) {
+    // big enough that nothing is cleaned, and fresh each time so every run decodes everything
+    VideoCache cache(64 * 1024);
+    GopWorkers pool;
+    pool.addStream(argv[2], cache, nullptr);
+    if(!pool.start(workers)) return 1;
+
+    Timer timer;
+    pool.setCenter(0, center, radius);
+    while(!pool.isIdle()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    double ms = timer.getMs();
+    if(workers == 1) oneWorkerMs = ms;
+
+    printf("%3d workers: %5zu frames, %4lu gops in %8.2f ms, %5.2fx\n",
+           workers, cache.getFrameCount(), pool.getGopsDecoded(), ms, oneWorkerMs / ms);
+    if(workers < maxWorkers && workers * 2 > maxWorkers) workers = maxWorkers / 2;
+  }
+  return 0;
+}
+
+/*!
+ * Convert to YUV420P a pixel at a time, the slow and obvious way, as the reference the converter's
+ * kernels are checked against.  Chroma is a rounded box filter, repeating the last row or column of odd
+ * sizes.
+ * @param out : packed YUV420P planes
+ */
+static void convertReference(AVPixelFormat format, uint8_t* const src[], const int srcLinesize[], int width,
+                             int height, std::vector<uint8_t>& out) {
+  int chromaWidth = (width + 1) / 2;
+  int chromaHeight = (height + 1) / 2;
+  out.resize(width * height + 2 * chromaWidth * chromaHeight);
+  for(int y = 0; y < height; y++) {
+    for(int x = 0; x < width; x++) {
+      out[y * width + x] = src[0][y * srcLinesize[0] + x];
+    }
+  }
+
+  uint8_t* planes[2] = {&out[width * height], &out[width * height + chromaWidth * chromaHeight]};
+  for(int plane = 0; plane < 2; plane++) {
+    const uint8_t* in = src[plane + 1];
+    int linesize = srcLinesize[plane + 1];
+    for(int y = 0; y < chromaHeight; y++) {
+      int top = y * 2;
+      int bottom = std::min(top + 1, height - 1);
+      for(int x = 0; x < chromaWidth; x++) {
+        int left = x * 2;
+        int right = std::min(left + 1, width - 1);
+        int value = 0;
+        switch(format) {
+          case AV_PIX_FMT_YUV420P:
+            value = in[y * linesize + x];
+            break;
+          case AV_PIX_FMT_NV12:
+            value = src[1][y * srcLinesize[1] + x * 2 + plane];
+            break;
+          case AV_PIX_FMT_YUV422P:
+            value = (in[top * linesize + x] + in[bottom * linesize + x] + 1) >> 1;
+            break;
+          case AV_PIX_FMT_YUV444P:
+            value = (in[top * linesize + left] + in[top * linesize + right] + in[bottom * linesize + left] +
+                     in[bottom * linesize + right] + 2) >> 2;
+            break;
+          default:
+            break;
+        }
+        planes[plane][y * chromaWidth + x] = (uint8_t)value;
+      }
+    }
+  }
+}
+
+/*!
+ * Check that every PixelConverter level, and the banded path, give exactly what a per pixel reference
+ * conversion does, then time them against the swscale conversion they replace at 1080p and 4K.  The
+ * output is filled with a sentinel before each run, so bytes a kernel doesn't write show up too.
+ * The odd size is only there to check the tails.
+ */
+static int benchConvert(int argc, char** argv) {
+  int frames = argc > 2 ? atoi(argv[2]) : 50;
+  int bands = (int)std::thread::hardware_concurrency();
+  const int sizes[][2] = {{1920, 1080}, {3840, 2160}, {1917, 1079}};
+  const AVPixelFormat formats[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV444P};
+  const ConvertLevel levels[] = {CONVERT_SCALAR, CONVERT_SSE41, CONVERT_AVX2};
+  std::mt19937 rng(1234);
+  bool exact = true;
+
+  printf("best level: %s, %d bands, ms per frame\n", PixelConverter::getLevelName(PixelConverter::getBestLevel()), bands);
+  printf("%-8s %10s %8s %8s %8s %8s %8s %9s\n", "format", "size", "sws", "scalar", "sse4.1", "avx2", "bands", "sws diff");
+  for(auto& size : sizes) {
+    int width = size[0];
+    int height = size[1];
+    for(AVPixelFormat format : formats) {
+      std::vector<uint8_t> srcData(av_image_get_buffer_size(format, width, height, 1));
+      for(auto& b : srcData) b = (uint8_t)rng();
+      uint8_t* src[4];
+      int srcLinesize[4];
+      av_image_fill_arrays(src, srcLinesize, srcData.data(), format, width, height, 1);
+
+      int dstSize = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
+      std::vector<uint8_t> reference, out(dstSize);
+      convertReference(format, src, srcLinesize, width, height, reference);
+      uint8_t* dst[4];
+      int dstLinesize[4];
+      av_image_fill_arrays(dst, dstLinesize, out.data(), AV_PIX_FMT_YUV420P, width, height, 1);
+
+      PixelConverter converter;
+      auto time = [&](int useBands) {
+        std::fill(out.begin(), out.end(), 0xAA);
+        Timer timer;
+        for(int i = 0; i < frames; i++) {
+          converter.convert(format, src, srcLinesize, dst, dstLinesize, width, height, useBands);
+        }
+        return timer.getMs() / frames;
+      };
+
+      char sizeName[32];
+      snprintf(sizeName, sizeof(sizeName), "%dx%d", width, height);
+      printf("%-8s %10s", av_get_pix_fmt_name(format), sizeName);
+
+      SwsContext* sws = sws_getContext(width, height, format, width, height, AV_PIX_FMT_YUV420P,
+                                       SWS_BICUBIC, nullptr, nullptr, nullptr);
+      Timer swsTimer;
+      for(int i = 0; i < frames; i++) {
+        sws_scale(sws, (const uint8_t* const*)src, srcLinesize, 0, height, dst, dstLinesize);
+      }
+      printf(" %8.3f", swsTimer.getMs() / frames);
+      sws_freeContext(sws);
+      std::vector<uint8_t> swsOut = out;
+
+      for(ConvertLevel level : levels) {
+        converter.setLevel(level);
+        if(converter.getLevel() != level) {
+          printf(" %8s", "-");
+          continue;
+        }
+        double ms = time(1);
+        bool same = out == reference;
+        exact = exact && same;
+        printf(" %8.3f%s", ms, same ? "" : "!");
+      }
+
+      converter.setLevel(PixelConverter::getBestLevel());
+      double bandMs = time(bands);
+      bool same = out == reference;
+      exact = exact && same;
+      printf(" %8.3f%s", bandMs, same ? "" : "!");
+
+      // swscale filters differently, this is just to show how far apart they are
+      int maxDiff = 0;
+      for(int i = 0; i < dstSize; i++) {
+        maxDiff = std::max(maxDiff, abs(swsOut[i] - reference[i]));
+      }
+      printf(" %9d\n", maxDiff);
+    }
+  }
+
+  printf(exact ? "all levels match the reference\n" : "MISMATCH: results marked ! differ from the reference\n");
+  return exact ? 0 : 1;
+}
+
+/*!
+ * Resident set size of this process
+ */
+static double getRssMB() {
+  long pages = 0;
+  if(FILE* statm = fopen("/proc/self/statm", "r")) {
+    long size;
+    if(fscanf(statm, "%ld %ld", &size, &pages) != 2) pages = 0;
+    fclose(statm);
+  }
+  return pages * (double)sysconf(_SC_PAGESIZE) / (1024. * 1024.);
+}
+
+/*!
+ * Churn a full cache the way playback does, writing each frame into a new record and cleaning the oldest,
+ * first with frames on the heap and then from the slab.  Reports time spent allocating and cleaning,
+ * page faults, and RSS, which should stay flat at the budget with the slab.
+ */
+static int benchAlloc(int argc, char** argv) {
+  uint64_t cacheMB = argc > 2 ? atol(argv[2]) : 1024;
+  int frames = argc > 3 ? atoi(argv[3]) : 1000;
+  ClipSpec spec;
+  spec.width = 3840;
+  spec.height = 2160;
+  if(argc > 4 && !parseClipSize(argv[4], spec)) return 1;
+  uint64_t frameSize = VideoCache::getFrameBytes(spec.width, spec.height);
+
+  printf("%d %dx%d frames through a %lu MB cache\n", frames, spec.width, spec.height, cacheMB);
+  printf("%-6s %10s %14s %12s %10s %10s %10s %10s\n", "", "reserve ms", "alloc ms/frame", "faults/frame",
+         "rss start", "rss min", "rss max", "rss end");
+  for(bool slab : {false, true}) {
+    VideoCache cache(cacheMB);
+    Timer reserveTimer;
+    if(slab && !cache.reserveFrames(frameSize)) return 1;
+    double reserveMs = reserveTimer.getMs();
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    double rssStart = getRssMB();
+    double rssMin = rssStart, rssMax = rssStart;
+    double allocMs = 0;
+
+    for(int frame = 0; frame < frames; frame++) {
+      Timer allocTimer;
+      FrameRecord* rec = cache.allocFrame(frame, spec.width, spec.height);
+      allocMs += allocTimer.getMs();
+
+      // the decoder writes the whole frame
+      memset(rec->data, frame, frameSize);
+
+      allocTimer.start();
+      cache.releaseFrame(cache.insertFrame(rec));
+      allocMs += allocTimer.getMs();
+
+      double rss = getRssMB();
+      rssMin = std::min(rssMin, rss);
+      rssMax = std::max(rssMax, rss);
+    }
+    getrusage(RUSAGE_SELF, &after);
+    long faults = (after.ru_minflt - before.ru_minflt) + (after.ru_majflt - before.ru_majflt);
+
+    FrameAllocatorStats stats = cache.getAllocatorStats();
+    printf("%-6s %10.1f %14.3f %12.1f %10.0f %10.0f %10.0f %10.0f  %s, %lu from the heap\n", slab ? "slab" : "heap",
+           reserveMs, allocMs / frames, (double)faults / frames, rssStart, rssMin, rssMax, getRssMB(),
+           FrameAllocator::getPagesName(stats.pages), stats.heapAllocs);
+  }
+  return 0;
+}
+
+/*!
+ * Read the settings for a generated clip from the command line
+ * @param i : index of the flag, moved past its value if it was one of ours
+ * @return false if it wasn't a clip flag
+ */
+static bool parseClipFlag(int argc, char** argv, int& i, ClipSpec& spec) {
+  if(!strcmp(argv[i], "--closed-gop")) {
+    spec.closedGop = true;
+    return true;
+  }
+  if(i + 1 >= argc) return false;
+  if(!strcmp(argv[i], "--size")) return parseClipSize(argv[++i], spec);
+  if(!strcmp(argv[i], "--gop")) spec.gop = atoi(argv[++i]);
+  else if(!strcmp(argv[i], "--bframes")) spec.bFrames = atoi(argv[++i]);
+  else if(!strcmp(argv[i], "--frames")) spec.frames = atoi(argv[++i]);
+  else if(!strcmp(argv[i], "--codec")) spec.codec = argv[++i];
+  else return false;
+  return true;
+}
+
+static const char* clipFlagsUsage = "[--size WxH] [--gop N] [--bframes N] [--closed-gop] [--frames N] [--codec name]";
+
+/*!
+ * Generate a test clip
+ */
+static int benchGen(int argc, char** argv) {
+  if(argc < 3) {
+    printf("usage: videoPlayerBench gen <out.mkv> %s\n", clipFlagsUsage);
+    return 1;
+  }
+  ClipSpec spec;
+  for(int i = 3; i < argc; i++) {
+    if(!parseClipFlag(argc, argv, i, spec)) {
+      printf("unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  return generateClip(argv[2], spec) ? 0 : 1;
+}
+
+/*!
+ * Decode a 4K clip at its own size and at window sizes, and compare how many frames a cache MB holds and
+ * how fast they decode.  Codecs with lowres decode the smaller sizes at a fraction of the source.  Then
+ * fill a cache at 4K and move it to 1080p, timing how long scaling the stale frames takes against
+ * decoding them again.
+ */
+static int benchScale(int argc, char** argv) {
+  const char* clip = argc > 2 ? argv[2] : "/tmp/videoPlayerBench.4k.mkv";
+  int frames = argc > 3 ? atoi(argv[3]) : 120;
+  uint64_t cacheMB = argc > 4 ? atol(argv[4]) : 1024;
+  if(FILE* file = fopen(clip, "r")) {
+    fclose(file);
+  } else {
+    ClipSpec spec;
+    spec.width = 3840;
+    spec.height = 2160;
+    spec.frames = frames;
+    if(!generateClip(clip, spec)) return 1;
+  }
+
+  const int sizes[][2] = {{0, 0}, {1920, 1080}, {1280, 720}};
+  printf("%d frames of %s through a %lu MB cache\n", frames, clip, cacheMB);
+  printf("%10s %7s %10s %12s %12s %12s\n", "output", "lowres", "frame MB", "frames/GB", "cached", "decode fps");
+  for(auto& size : sizes) {
+    VideoCache cache(cacheMB);
+    VideoDecoder decoder(clip, cache);
+    if(!decoder.open()) return 1;
+    decoder.setOutputSize(size[0], size[1]);
+    cache.setFrameSize(decoder.getWidth(), decoder.getHeight());
+    int count = std::min(frames, decoder.getLastFrame() + 1);
+
+    Timer timer;
+    for(int frame = 0; frame < count; frame++) {
+      decoder.seekTo(frame);
+    }
+    double seconds = timer.getSeconds();
+
+    char sizeName[32];
+    snprintf(sizeName, sizeof(sizeName), "%dx%d", decoder.getWidth(), decoder.getHeight());
+    double frameMB = decoder.getFrameDataSize() / (1024. * 1024.);
+    printf("%10s %7d %10.2f %12.0f %12zu %12.1f\n", sizeName, decoder.getLowres(), frameMB, 1024. / frameMB,
+           cache.getFrameCount(), count / seconds);
+  }
+
+  // the window shrinking from 4K to 1080p with the cache full
+  VideoCache cache(cacheMB);
+  VideoDecoder decoder(clip, cache);
+  if(!decoder.open()) return 1;
+  cache.setFrameSize(decoder.getWidth(), decoder.getHeight());
+  int count = std::min(frames, decoder.getLastFrame() + 1);
+  for(int frame = 0; frame < count; frame++) {
+    decoder.seekTo(frame);
+  }
+  size_t before = cache.getFrameCount();
+  cache.setFrameSize(1920, 1080);
+  Timer rescaleTimer;
+  int rescaled = cache.rescaleStale(0, count - 1);
+  double rescaleMs = rescaleTimer.getMs();
+  printf("resize to 1920x1080: %d of %zu cached frames scaled in %.2f ms/frame\n", rescaled, before,
+         rescaleMs / std::max(1, rescaled));
+  return 0;
+}
+
+/*!
+ * Extract a clip's frames with more and more workers, mapped and written in order, and check every run
+ * gives the same bytes as one decoder going through the clip frame by frame
+ * @return false if a run failed or gave other bytes
+ */
+static bool extractClip(const char* clip, int frames, int maxWorkers) {
+  const char* out = "/tmp/videoPlayerBench.yuv";
+
+  // what decoding in order gives
+  VideoCache cache(0);
+  VideoDecoder decoder(clip, cache);
+  if(!decoder.open()) return false;
+  cache.reserveFrames(decoder.getFrameDataSize());
+  frames = std::min(frames, decoder.getLastFrame() + 1);
+  uint64_t frameSize = decoder.getFrameDataSize();
+  std::vector<uint8_t> expected(frames * frameSize);
+  Timer sequentialTimer;
+  for(int frame = 0; frame < frames; frame++) {
+    decoder.seekTo(frame);
+    memcpy(&expected[frame * frameSize], decoder.getConvertedFrame()->data, frameSize);
+  }
+  double sequentialSeconds = sequentialTimer.getSeconds();
+
+  // keyframes a chunk can't just start decoding at
+  PacketIndex& index = decoder.getIndex();
+  int keyframes = 0;
+  int openGops = 0;
+  for(int frame = 0; frame < frames && index.isLoaded(); frame++) {
+    if(!index.isKeyframe(frame)) continue;
+    keyframes++;
+    if(index.hasLeadingFrames(frame)) openGops++;
+  }
+
+  printf("%d frames of %s, %.2f MB each, %d of %d GOPs open\n", frames, clip, frameSize / (1024. * 1024.),
+         openGops, keyframes);
+  printf("%-10s %8s %8s %10s %10s %8s %10s\n", "output", "workers", "chunks", "fps", "MB/s", "speedup", "identical");
+  printf("%-10s %8d %8d %10.1f %10.1f %8.2f %10s\n", "in order", 1, 1, frames / sequentialSeconds,
+         frames * frameSize / (1024. * 1024.) / sequentialSeconds, 1., "-");
+
+  std::vector<int> workerCounts;
+  for(int workers = 1; workers < maxWorkers; workers *= 2) workerCounts.push_back(workers);
+  workerCounts.push_back(maxWorkers);
+
+  std::vector<uint8_t> got(frames * frameSize);
+  for(bool mapOutput : {true, false}) {
+    for(int workers : workerCounts) {
+      FrameExtractor extractor(clip, workers);
+      extractor.setMapOutput(mapOutput);
+      if(!extractor.run(0, frames - 1, out)) return false;
+      ExtractStats stats = extractor.getStats();
+
+      FILE* file = fopen(out, "rb");
+      size_t read = file ? fread(got.data(), 1, got.size(), file) : 0;
+      if(file) fclose(file);
+      bool identical = read == got.size() && got == expected;
+      printf("%-10s %8d %8d %10.1f %10.1f %8.2f %10s\n", mapOutput ? "mapped" : "written", stats.workers, stats.chunks,
+             stats.getFps(), stats.getMBps(), sequentialSeconds / stats.seconds, identical ? "yes" : "NO");
+      if(!identical) return false;
+    }
+  }
+  unlink(out);
+  return true;
+}
+
+/*!
+ * Check the extract mode gives the same bytes as decoding in order, with any number of workers, and time
+ * it.  Without a clip it checks two generated 1080p ones with B-frames: one whose GOPs are left open, so
+ * the B-frames before each keyframe refer to the GOP before it, and one with closed GOPs.
+ */
+static int benchExtract(int argc, char** argv) {
+  int frames = argc > 3 ? atoi(argv[3]) : 600;
+  int maxWorkers = argc > 4 ? atoi(argv[4]) : std::max(1, (int)std::thread::hardware_concurrency());
+  if(argc > 2) return extractClip(argv[2], frames, maxWorkers) ? 0 : 1;
+
+  for(bool closedGop : {false, true}) {
+    const char* clip = closedGop ? "/tmp/videoPlayerBench.extract.closed.mkv" : "/tmp/videoPlayerBench.extract.mkv";
+    if(FILE* file = fopen(clip, "r")) {
+      fclose(file);
+    } else {
+      ClipSpec spec;
+      spec.frames = frames;
+      spec.bFrames = 2;
+      spec.closedGop = closedGop;
+      if(!generateClip(clip, spec)) return 1;
+    }
+    if(!extractClip(clip, frames, maxWorkers)) return 1;
+  }
+  return 0;
+}
+
+// played when the session isn't given a script
+static const char* defaultScript =
+  "play 300; jump -1; play 120; rewind 200; step 20; back 20; jump 2; seek 30; play 120; "
+  "pause 60; step 1; pause 60; back 1; pause 60; jump 1; pause 60; jump -1";
+
+/*!
+ * Drives a headless VideoPlayer through a script, the same way a user would, by pushing key events.
+ */
+struct Session {
+  VideoPlayer& player;
+  bool pace;
+  Timer vsync;
+  std::vector<double> frameTimes; // ms spent in each playback() call
+  std::vector<double> shuttleLag; // frames the display was behind the shuttle clock, each tick
+  int stalls = 0;                 // commands which gave up waiting for a frame
+  int unlockedTicks = 0;          // ticks at 1x where a visible stream showed another frame than the rest
+  std::string psiFile;            // simulated pressure source the pressure command writes
+  bool paused = false;            // the last command was a pause, so the next step or jump is the first
+  int firstSteps = 0;             // steps and jumps right after a pause, and how many were shown at once
+  int firstStepHits = 0;
+  int firstJumps = 0;
+  int firstJumpHits = 0;
+  std::mt19937 rng{1234};
+
+  Session(VideoPlayer& player, bool pace) : player(player), pace(pace) { }
+
+  void tick() {
+    Timer timer;
+    player.playback();
+    frameTimes.push_back(timer.getMs());
+    checkLocked();
+    if(pace) waitForVsync(vsync);
+  }
+
+  void checkLocked() {
+    if(player.getSpeed() > 1) return;
+    for(int stream = 0; stream < player.getStreamCount(); stream++) {
+      if(player.isStreamVisible(stream) && player.getStreamFrame(stream) != player.getFrameDisplayed()) {
+        unlockedTicks++;
+        return;
+      }
+    }
+  }
+
+  // the key is handled at the start of the next playback()
+  void press(SDL_Keycode key) {
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = SDL_KEYDOWN;
+    event.key.keysym.sym = key;
+    SDL_PushEvent(&event);
+    tick();
+  }
+
+  bool caughtUp() { return player.getFrameDisplayed() == player.getDesiredFrame(); }
+
+  // give up on a command if the display hasn't moved for this long
+  bool stalled(Timer& sinceProgress) {
+    if(sinceProgress.getSeconds() < 10) return false;
+    stalls++;
+    return true;
+  }
+
+  void waitCaughtUp() {
+    Timer sinceProgress;
+    while(!caughtUp() && !stalled(sinceProgress)) tick();
+  }
+
+  // play or rewind until n more frames are displayed, or we reach an end of the file
+  void waitDisplayed(uint64_t n) {
+    uint64_t target = player.getDisplayedFrames() + n;
+    uint64_t last = player.getDisplayedFrames();
+    Timer sinceProgress;
+    while(player.getDisplayedFrames() < target) {
+      bool atEnd = player.getMode() == PAUSE || (player.getMode() == REWIND && player.getDesiredFrame() == 0);
+      if(atEnd && caughtUp()) break;
+      if(player.getDisplayedFrames() != last) {
+        last = player.getDisplayedFrames();
+        sinceProgress.start();
+      }
+      if(stalled(sinceProgress)) break;
+      tick();
+    }
+  }
+
+  // play or rewind at 1x.  Pressing l or j again would speed up instead
+  void start(SDL_Keycode key, PlaybackMode mode) {
+    if(player.getMode() == mode && player.getSpeed() == 1) return;
+    if(player.getMode() == mode) press(SDLK_k);
+    press(key);
+  }
+
+  // shuttle at a speed for three seconds, or until we reach an end of the file
+  void shuttle(int speed) {
+    press(SDLK_k);
+    for(int pressed = 1; pressed <= abs(speed); pressed *= 2) {
+      press(speed > 0 ? SDLK_l : SDLK_j);
+    }
+    for(int i = 0; i < 180 && player.getSpeed() > 1; i++) {
+      if(player.getMode() == REWIND && player.getDesiredFrame() == 0) break;
+      tick();
+      shuttleLag.push_back(abs(player.getDesiredFrame() - player.getFrameDisplayed()));
+    }
+  }
+
+  bool run(const std::string& command, int count) {
+    bool first = paused;
+    paused = command == "pause";
+    if(command == "play") {
+      start(SDLK_l, PLAY);
+      waitDisplayed(count);
+    } else if(command == "rewind") {
+      start(SDLK_j, REWIND);
+      waitDisplayed(count);
+    } else if(command == "shuttle") {
+      shuttle(count);
+    } else if(command == "pause") {
+      press(SDLK_k);
+      for(int i = 0; i < count; i++) tick();
+    } else if(command == "step" || command == "back") {
+      for(int i = 0; i < count; i++) {
+        press(command == "step" ? SDLK_f : SDLK_d);
+        if(first && !i) {
+          firstSteps++;
+          firstStepHits += caughtUp();
+        }
+        waitCaughtUp();
+      }
+    } else if(command == "jump") {
+      // +-100 frames per jump
+      for(int i = 0; i < abs(count); i++) {
+        press(count > 0 ? SDLK_r : SDLK_e);
+        if(first && !i) {
+          firstJumps++;
+          firstJumpHits += caughtUp();
+        }
+        waitCaughtUp();
+      }
+    } else if(command == "pressure") {
+      // the next line the memory monitor reads says tasks stalled this percent of the last 10 seconds
+      FILE* file = psiFile.empty() ? nullptr : fopen(psiFile.c_str(), "w");
+      if(!file) {
+        printf("pressure needs --psi-file\n");
+        return false;
+      }
+      fprintf(file, "some avg10=%d.00 avg60=0.00 avg300=0.00 total=0\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=0\n", count);
+      fclose(file);
+    } else if(command == "seek") {
+      std::uniform_int_distribution<int> dist(0, player.getLastFrame());
+      for(int i = 0; i < count; i++) {
+        player.seek(dist(rng));
+        tick();
+        waitCaughtUp();
+      }
+    } else {
+      return false;
+    }
+    return true;
+  }
+};
+
+/*!
+ * A session script from a file, if it names one, otherwise the script itself
+ */
+static std::string loadScript(const std::string& script) {
+  FILE* file = fopen(script.c_str(), "r");
+  if(!file) return script;
+  std::string loaded;
+  char line[256];
+  while(fgets(line, sizeof(line), file)) loaded += line;
+  fclose(file);
+  return loaded;
+}
+
+/*!
+ * Run a script's commands one after another
+ * @return false if there's a command the session doesn't know
+ */
+static bool runScript(Session& session, std::string script) {
+  for(char* step = strtok(&script[0], ";\n"); step; step = strtok(nullptr, ";\n")) {
+    char command[32];
+    int count = 1;
+    if(sscanf(step, " %31s %d", command, &count) < 1 || command[0] == '#') continue;
+    if(!session.run(command, count)) {
+      printf("unknown command %s\n", command);
+      return false;
+    }
+  }
+  return true;
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+  if(sorted.empty()) return 0;
+  return sorted[(size_t)(p * (sorted.size() - 1))];
+}
+
+/*!
+ * One of the serve benchmark's clients: follow the playhead, reading every pixel of each frame, and now
+ * and then ask for a frame which isn't in the ring.  A slow client holds each frame for a while.
+ */
+static void serveClient(const char* name, int id, bool slow, int frames) {
+  FrameClient* client = frameClientOpen(name);
+  if(!client) return;
+  uint64_t received = 0, requested = 0, requestMisses = 0, bytes = 0, sum = 0;
+  Timer clock;
+  FrameClientFrame frame;
+  while(true) {
+    int result = frameClientNextFrame(client, 100, &frame);
+    if(result == FRAME_CLIENT_CLOSED) break;
+    if(result != FRAME_CLIENT_OK) continue;
+    for(int y = 0; y < frame.height; y++) {
+      const uint8_t* row = frame.planes[0] + (size_t)y * frame.linesize[0];
+      for(int x = 0; x < frame.width; x++) sum += row[x];
+    }
+    bytes += frame.size;
+    received++;
+    if(slow) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    int other = (frame.frame + frames / 2) % frames;
+    frameClientRelease(client, &frame);
+
+    if(received % 30 == 0) {
+      requested++;
+      if(frameClientGetFrame(client, other, 100, &frame) == FRAME_CLIENT_OK) frameClientRelease(client, &frame);
+      else requestMisses++;
+    }
+  }
+  double seconds = clock.getSeconds();
+  printf("client %d%s: %lu frames, %.1f fps, %.0f MB/s read in place, %lu of %lu requests missed (luma sum %lu)\n",
+         id, slow ? " (slow)" : "", received, received / seconds, bytes / (1024. * 1024.) / seconds, requestMisses,
+         requested, sum);
+  frameClientClose(client);
+}
+
+/*!
+ * Publish 1080p frames at the display rate through a FrameServer while several client processes follow
+ * them with the C API, and report how long publishing took.  The slow clients hold frames far longer than
+ * a display frame, which should cost drops, never a slower publish.
+ */
+static int benchServe(int argc, char** argv) {
+  int clients = argc > 2 ? atoi(argv[2]) : 4;
+  double seconds = argc > 3 ? atof(argv[3]) : 5;
+  int slowClients = argc > 4 ? atoi(argv[4]) : 1;
+  const char* name = "videoPlayerBench";
+  const int width = 1920, height = 1080, frames = 60;
+
+  // a second of frames in the cache, for the clients to ask for
+  VideoCache cache(1024);
+  for(int frame = 0; frame < frames; frame++) {
+    FrameRecord* rec = cache.allocFrame(frame, width, height);
+    memset(rec->data, frame * 4, VideoCache::getFrameBytes(width, height));
+    cache.releaseFrame(cache.insertFrame(rec));
+  }
+
+  FrameServer server;
+  if(!server.open(name, 8, VideoCache::getFrameBytes(width, height), nullptr, 1, 60)) return 1;
+  fflush(stdout);
+  std::vector<pid_t> children;
+  for(int id = 0; id < clients; id++) {
+    pid_t pid = fork();
+    if(pid == 0) {
+      serveClient(name, id, id < slowClients, frames);
+      fflush(stdout);
+      _exit(0);
+    }
+    if(pid > 0) children.push_back(pid);
+  }
+
+  // give the clients time to attach
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  std::vector<double> publishMs;
+  Timer clock, frameTimer;
+  for(int tick = 0; clock.getSeconds() < seconds; tick++) {
+    FrameRecord* rec = cache.getFrame(tick % frames);
+    Timer publishTimer;
+    server.publish(rec);
+    publishMs.push_back(publishTimer.getMs());
+    cache.releaseFrame(rec);
+    server.serveRequests(cache);
+    waitForVsync(frameTimer);
+  }
+  FrameServerStats stats = server.getStats();
+  server.close();
+  for(pid_t pid : children) waitpid(pid, nullptr, 0);
+
+  std::sort(publishMs.begin(), publishMs.end());
+  printf("%lu frames published, %lu for requests, %lu dropped for %d clients (%d slow)\n", stats.published,
+         stats.requests, stats.drops, clients, slowClients);
+  printf("publish ms: p50 %.3f, p99 %.3f, max %.3f\n", percentile(publishMs, 0.5), percentile(publishMs, 0.99),
+         publishMs.empty() ? 0 : publishMs.back());
+  return 0;
+}
+
+/*!
+ * Results of bursts of jumps
+ */
+struct JumpResult {
+  std::vector<double> latencyMs; // from the last jump of each burst until its frame was ready to show
+  int timeouts = 0;
+  uint64_t decoded = 0;
+  uint64_t seeks = 0;
+  uint64_t cancelled = 0;
+};
+
+/*!
+ * Press jump several times, a display frame apart like someone tapping r, while paused.  Each burst
+ * lands in frames which haven't been decoded, so its first jumps start seeks which its last one makes
+ * obsolete.
+ */
+static JumpResult jumpBursts(const char* clip, bool useIndex, bool cancelSeeks, int bursts, int presses, int jump) {
+  JumpResult r;
+  VideoCache cache(1024);
+  VideoDecoder decoder(clip, cache);
+  decoder.setUseIndex(useIndex);
+  if(!decoder.open()) exit(1);
+  decoder.seekTo(0);
+  uint64_t decoded0 = decoder.getDecodedFrames(), seeks0 = decoder.getSeeks();
+
+  FrameProducer producer(decoder, cache);
+  producer.setCancelSeeks(cancelSeeks);
+  producer.start(8);
+
+  Timer frameTimer;
+  int target = 0;
+  for(int burst = 0; burst < bursts; burst++) {
+    Timer pressed;
+    for(int press = 0; press < presses; press++) {
+      target += jump;
+      pressed.start();
+      producer.request(target, 0);
+      waitForVsync(frameTimer);
+    }
+
+    bool ready = false;
+    while(!ready && pressed.getSeconds() < 10) {
+      producer.request(target, 0);
+      if(producer.peekFrame(target)) {
+        producer.popFrame();
+        ready = true;
+      } else if(FrameRecord* rec = cache.getFrame(target)) {
+        cache.releaseFrame(rec);
+        ready = true;
+      } else if(producer.hasPassed(target)) {
+        producer.restart();
+      }
+      if(!ready) waitForVsync(frameTimer);
+    }
+    if(ready) r.latencyMs.push_back(pressed.getMs());
+    else r.timeouts++;
+
+    // a moment on the frame before the next burst
+    for(int tick = 0; tick < 10; tick++) waitForVsync(frameTimer);
+  }
+
+  producer.stop();
+  r.decoded = decoder.getDecodedFrames() - decoded0;
+  r.seeks = decoder.getSeeks() - seeks0;
+  r.cancelled = decoder.getCancelledSeeks();
+  std::sort(r.latencyMs.begin(), r.latencyMs.end());
+  return r;
+}
+
+/*!
+ * Time from the last of a burst of jumps to its frame being ready to show, on a clip with long GOPs,
+ * with the decode thread finishing each seek it starts and with it giving up on seeks a newer jump made
+ * obsolete.  Both with and without the index, which seek differently.  The clip is generated if it
+ * doesn't exist.
+ */
+static int benchJumps(int argc, char** argv) {
+  const char* clip = argc > 2 ? argv[2] : "/tmp/videoPlayerBench.jumps.mkv";
+  int bursts = argc > 3 ? atoi(argv[3]) : 4;
+  int presses = argc > 4 ? atoi(argv[4]) : 5;
+  const int jump = 100; // the player's r key
+  if(FILE* file = fopen(clip, "r")) {
+    fclose(file);
+  } else {
+    ClipSpec spec;
+    spec.width = 1280;
+    spec.height = 720;
+    spec.gop = 250;
+    spec.frames = bursts * presses * jump + spec.gop;
+    if(!generateClip(clip, spec)) return 1;
+  }
+
+  printf("%d bursts of %d jumps of %d frames, a display frame apart\n", bursts, presses, jump);
+  printf("%-9s %-7s %8s %8s %8s %8s %8s %10s\n", "seeking", "cancel", "p50 ms", "max ms", "timeouts", "decoded",
+         "seeks", "cancelled");
+  for(bool useIndex : {true, false}) {
+    for(bool cancelSeeks : {false, true}) {
+      JumpResult r = jumpBursts(clip, useIndex, cancelSeeks, bursts, presses, jump);
+      printf("%-9s %-7s %8.1f %8.1f %8d %8lu %8lu %10lu\n", useIndex ? "index" : "no index",
+             cancelSeeks ? "yes" : "no", percentile(r.latencyMs, 0.5), r.latencyMs.empty() ? 0 : r.latencyMs.back(),
+             r.timeouts, r.decoded, r.seeks, r.cancelled);
+    }
+  }
+  return 0;
+}
+
+/*!
+ * Replay a scripted session on a headless player and report frame times, cache hit rate, decodes per
+ * displayed frame and peak RSS as JSON.  The script is a file or a string of "command count" pairs
+ * separated by ';' or newlines: play N, rewind N, pause N, step N, back N, jump +-N, seek N, and
+ * shuttle +-S, which runs at S times speed for three seconds.
+ * With several clips they're played together, and the JSON has each one's share of the cache budget
+ * and the number of ticks they weren't showing the same frame.
+ * "pressure P" writes P as the stall percentage to the --psi-file the player watches instead of the
+ * kernel's, to try out the adaptive budget.  For real limits, --memory-max runs it again in a systemd
+ * scope with that memory.max.  With a clip much bigger than the limit, such as
+ *   session "play 1500; rewind 600; play 900" --clip /tmp/big.mkv --size 3840x2160 --frames 3000 --memory-max 1024
+ * the page cache of reading the clip fills the cgroup, and the JSON's min_target_mb shows whether the
+ * budget held anyway.
+ * The first step or jump after a pause counts as a hit if it's shown on the tick the key is pressed,
+ * which is how well the workers used the pause.
+ */
+static int benchSession(int argc, char** argv) {
+  std::string script = defaultScript;
+  std::vector<std::string> clips;
+  std::string jsonFile;
+  std::string analyticsFile;
+  ClipSpec spec;
+  PlayerOptions options;
+  options.headless = true;
+  bool pace = true;
+  long memoryMaxMB = 0;
+
+  for(int i = 2; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if(!strcmp(argv[i], "--clip") && hasValue) clips.push_back(argv[++i]);
+    else if(!strcmp(argv[i], "--json") && hasValue) jsonFile = argv[++i];
+    else if(!strcmp(argv[i], "--cache") && hasValue) options.cacheMB = atol(argv[++i]);
+    else if(!strcmp(argv[i], "--workers") && hasValue) options.workers = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--no-pace")) pace = false;
+    else if(!strcmp(argv[i], "--no-proxies")) options.proxies = false;
+    else if(!strcmp(argv[i], "--eviction") && hasValue) options.eviction = argv[++i];
+    else if(!strcmp(argv[i], "--no-mmap")) options.mmap = false;
+    else if(!strcmp(argv[i], "--no-adaptive")) options.adaptive = false;
+    else if(!strcmp(argv[i], "--psi-file") && hasValue) options.psiFile = argv[++i];
+    else if(!strcmp(argv[i], "--memory-max") && hasValue) memoryMaxMB = atol(argv[++i]);
+    else if(!strcmp(argv[i], "--analytics") && hasValue) analyticsFile = argv[++i];
+    else if(!strcmp(argv[i], "--window") && hasValue) sscanf(argv[++i], "%dx%d", &options.windowWidth, &options.windowHeight);
+    else if(!strcmp(argv[i], "--full-res")) options.fitOutput = false;
+    else if(parseClipFlag(argc, argv, i, spec)) continue;
+    else if(argv[i][0] != '-') script = argv[i];
+    else {
+      printf("unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if(clips.empty()) {
+    printf("usage: videoPlayerBench session [script] --clip <file> [--clip <file>...] [--cache MB] [--workers N] [--no-pace]\n"
+           "                                [--no-proxies] [--eviction lru | cost] [--no-mmap] [--no-adaptive]\n"
+           "                                [--psi-file path] [--memory-max MB] [--json out]\n"
+           "                                [--analytics out] [--window WxH] [--full-res] %s\n"
+           "  clips are generated if they don't exist\n", clipFlagsUsage);
+    return 1;
+  }
+
+  // start again in a scope with the limit, which the environment variable stops us doing twice
+  if(memoryMaxMB > 0 && !getenv("VIDEOPLAYERBENCH_SCOPE")) {
+    setenv("VIDEOPLAYERBENCH_SCOPE", "1", 1);
+    std::string memoryMax = "MemoryMax=" + std::to_string(memoryMaxMB) + "M";
+    std::vector<const char*> args = {"systemd-run", "--user", "--scope", "--quiet", "-p", memoryMax.c_str(),
+                                     "-p", "MemorySwapMax=0"};
+    args.insert(args.end(), argv, argv + argc);
+    args.push_back(nullptr);
+    execvp(args[0], (char* const*)args.data());
+    printf("can't run systemd-run for --memory-max: %s\n", strerror(errno));
+    return 1;
+  }
+
+  script = loadScript(script);
+
+  for(auto& clip : clips) {
+    if(FILE* file = fopen(clip.c_str(), "r")) {
+      fclose(file);
+    } else if(!generateClip(clip, spec)) {
+      return 1;
+    }
+  }
+
+  VideoPlayer player(clips, options);
+  if(!player.isOpen()) return 1;
+  Session session(player, pace);
+  session.psiFile = options.psiFile;
+
+  Timer wall;
+  if(!runScript(session, script)) return 1;
+  double seconds = wall.getSeconds();
+
+  std::vector<double> sorted = session.frameTimes;
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<double> lag = session.shuttleLag;
+  std::sort(lag.begin(), lag.end());
+  CacheTierStats stats = player.getCacheStats();
+  uint64_t displayed = std::max<uint64_t>(1, player.getDisplayedFrames());
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  MemoryMonitorStats memory = player.getMemoryStats();
+  double budgetMB = 0;
+  for(int stream = 0; stream < player.getStreamCount(); stream++) {
+    budgetMB += player.getStreamShare(stream).bytes / (1024. * 1024.);
+  }
+
+  std::string streams;
+  for(int stream = 0; stream < player.getStreamCount(); stream++) {
+    StreamShare share = player.getStreamShare(stream);
+    CacheTierStats streamStats = player.getCacheStats(stream);
+    char entry[512];
+    snprintf(entry, sizeof(entry), "%s{\"clip\": \"%s\", \"budget_mb\": %.1f, \"weight\": %.3f, \"decode_ms\": %.3f, \"cache_hit_rate\": %.4f}",
+             stream ? ", " : "", clips[stream].c_str(), share.bytes / (1024. * 1024.), share.weight, share.decodeMs,
+             (double)streamStats.ramHits / std::max<uint64_t>(1, streamStats.ramHits + streamStats.ramMisses));
+    streams += entry;
+  }
+
+  char json[4096];
+  snprintf(json, sizeof(json),
+           "{\"clip\": \"%s\", \"seconds\": %.3f, \"iterations\": %zu, \"displayed\": %lu, \"stalls\": %d, "
+           "\"frame_ms\": {\"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+           "\"shuttle_lag_frames\": {\"p50\": %.0f, \"p95\": %.0f, \"max\": %.0f}, "
+           "\"cache_hit_rate\": %.4f, \"proxy_hit_rate\": %.4f, \"decodes_per_frame\": %.3f, \"redecodes\": %lu, \"rescaled\": %lu, \"io_wait_ms_per_frame\": %.3f, \"peak_rss_mb\": %.1f, "
+           "\"unlocked_ticks\": %d, "
+           "\"memory\": {\"budget_mb\": %.1f, \"target_mb\": %.1f, \"min_target_mb\": %.1f, \"cuts\": %lu, \"grows\": %lu, \"triggers\": %lu, "
+           "\"cgroup_max_mb\": %.1f, \"cgroup_used_mb\": %.1f, \"cgroup_page_cache_mb\": %.1f}, \"after_pause\": {\"steps\": %d, \"step_hit_rate\": %.4f, \"jumps\": %d, \"jump_hit_rate\": %.4f}, "
+           "\"streams\": [%s]}\n",
+           clips[0].c_str(), seconds, sorted.size(), player.getDisplayedFrames(), session.stalls,
+           percentile(sorted, 0.5), percentile(sorted, 0.95), percentile(sorted, 0.99), sorted.empty() ? 0 : sorted.back(),
+           percentile(lag, 0.5), percentile(lag, 0.95), lag.empty() ? 0 : lag.back(),
+           (double)stats.ramHits / std::max<uint64_t>(1, stats.ramHits + stats.ramMisses), stats.getProxyHitRate(),
+           (double)player.getDecodedFrames() / displayed, stats.redecodes, stats.rescaled, player.getIoWaitNs() / 1.e6 / displayed, usage.ru_maxrss / 1024., session.unlockedTicks,
+           budgetMB, memory.targetBytes / (1024. * 1024.), memory.minTargetBytes / (1024. * 1024.), memory.shrinks,
+           memory.grows, memory.triggers, memory.cgroupMax / (1024. * 1024.),
+           (memory.cgroupCurrent - memory.cgroupFile) / (1024. * 1024.), memory.cgroupFile / (1024. * 1024.),
+           session.firstSteps, (double)session.firstStepHits / std::max(1, session.firstSteps),
+           session.firstJumps, (double)session.firstJumpHits / std::max(1, session.firstJumps), streams.c_str());
+  printf("%s", json);
+  if(!analyticsFile.empty() && !player.writeAnalytics(analyticsFile)) return 1;
+
+  if(!jsonFile.empty()) {
+    FILE* out = fopen(jsonFile.c_str(), "w");
+    if(!out) {
+      printf("can't write %s\n", jsonFile.c_str());
+      return 1;
+    }
+    fputs(json, out);
+    fclose(out);
+  }
+  return 0;
+}
+
+// sessions the eviction benchmark replays when it isn't given any: the session default, hunting back and
+// forth around an edit, and going over a section again and again
+static const char* evictScripts[] = {
+  defaultScript,
+  "play 200; back 40; step 20; rewind 150; play 90; jump -1; play 60; back 30; jump 2; rewind 240; step 10; "
+  "play 120; back 60; jump -1; rewind 90; step 30",
+  "play 400; rewind 300; play 300; rewind 300; play 200; shuttle -4; play 200; rewind 200",
+};
+
+/*!
+ * Replay sessions on a headless player once for each eviction policy, with a cache too small for the
+ * clip, and compare how many frames each decoded again after cleaning them.  Sessions are scripts like
+ * the session benchmark's.  The clip has long GOPs, where what a frame costs to decode again depends on
+ * how far into its GOP it is, and is generated if it doesn't exist.
+ */
+static int benchEvict(int argc, char** argv) {
+  std::string clip = "/tmp/videoPlayerBench.evict.mkv";
+  std::vector<std::string> scripts;
+  ClipSpec spec;
+  spec.gop = 120;
+  spec.frames = 1200;
+  PlayerOptions options;
+  options.headless = true;
+  options.cacheMB = 256;
+  options.adaptive = false;
+  bool pace = true;
+
+  for(int i = 2; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if(!strcmp(argv[i], "--clip") && hasValue) clip = argv[++i];
+    else if(!strcmp(argv[i], "--cache") && hasValue) options.cacheMB = atol(argv[++i]);
+    else if(!strcmp(argv[i], "--workers") && hasValue) options.workers = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--no-pace")) pace = false;
+    else if(!strcmp(argv[i], "--no-proxies")) options.proxies = false;
+    else if(parseClipFlag(argc, argv, i, spec)) continue;
+    else if(argv[i][0] != '-') scripts.push_back(loadScript(argv[i]));
+    else {
+      printf("usage: videoPlayerBench evict [script...] [--clip file] [--cache MB] [--workers N] [--no-pace]\n"
+             "                              [--no-proxies] %s\n", clipFlagsUsage);
+      return 1;
+    }
+  }
+  if(scripts.empty()) scripts.assign(std::begin(evictScripts), std::end(evictScripts));
+  if(FILE* file = fopen(clip.c_str(), "r")) {
+    fclose(file);
+  } else if(!generateClip(clip, spec)) {
+    return 1;
+  }
+
+  printf("%s through a %lu MB cache\n", clip.c_str(), options.cacheMB);
+  printf("%-7s %-7s %10s %10s %8s %10s %8s %8s\n", "session", "policy", "displayed", "decoded", "dec/f", "redecodes",
+         "hit rate", "stalls");
+  for(size_t i = 0; i < scripts.size(); i++) {
+    for(const char* policy : {"lru", "cost"}) {
+      options.eviction = policy;
+      VideoPlayer player({clip}, options);
+      if(!player.isOpen()) return 1;
+      Session session(player, pace);
+      if(!runScript(session, scripts[i])) return 1;
+
+      CacheTierStats stats = player.getCacheStats();
+      uint64_t displayed = std::max<uint64_t>(1, player.getDisplayedFrames());
+      printf("%-7zu %-7s %10lu %10lu %8.3f %10lu %8.4f %8d\n", i + 1, policy, player.getDisplayedFrames(),
+             player.getDecodedFrames(), (double)player.getDecodedFrames() / displayed, stats.redecodes,
+             (double)stats.ramHits / std::max<uint64_t>(1, stats.ramHits + stats.ramMisses), session.stalls);
+    }
+  }
+  return 0;
+}
+
+/*!
+ * A bare cache replaying where a viewer goes, with decoding simulated.  Showing a frame which isn't cached
+ * decodes from its keyframe, or on from the last frame decoded if that's on the way, and caches every
+ * frame on the way.  A frame's re-decode cost is its position in the GOP, in frames.
+ */
+struct CacheReplay {
+  static const int width = 320;
+  static const int height = 180;
+
+  CacheReplay(const char* policy, bool proxies, int cacheFrames, int gop) : cache(0), gop(gop) {
+    cache.setFrameSize(width, height);
+    if(proxies) cache.enableProxies();
+    cache.setMaxBytes(cacheFrames * (VideoCache::getFrameBytes(width, height) + sizeof(FrameRecord)));
+    cache.setEvictionPolicy(EvictionPolicy::create(policy));
+  }
+
+  void decodeTo(int frame) {
+    int keyframe = frame / gop * gop;
+    int from = decoderFrame >= keyframe && decoderFrame < frame ? decoderFrame + 1 : keyframe;
+    for(int f = from; f <= frame; f++) {
+      decoded++;
+      if(FrameRecord* rec = cache.pinFrame(f)) {
+        cache.releaseFrame(rec);
+        continue;
+      }
+      FrameRecord* rec = cache.allocFrame(f, width, height);
+      rec->redecodeMs = f - keyframe + 1;
+      cache.releaseFrame(cache.insertFrame(rec));
+    }
+    decoderFrame = frame;
+  }
+
+  void show(int frame, int direction) {
+    cache.setPlayhead(frame, 20, direction);
+    if(FrameRecord* rec = cache.getFrame(frame)) cache.releaseFrame(rec);
+    else decodeTo(frame);
+    shown++;
+  }
+
+  // show every frame from one up to, but not including, another
+  void play(int from, int to) {
+    int direction = to > from ? 1 : -1;
+    for(int frame = from; frame != to; frame += direction) show(frame, direction);
+  }
+
+  VideoCache cache;
+  int gop;
+  int decoderFrame = -1;
+  uint64_t decoded = 0;
+  uint64_t shown = 0;
+};
+
+// where the replayed viewers go: review passes with a few turns, hunting back and forth around an edit
+// with the odd jump, and going over a section again and again
+static const char* replayTraces[] = {"review", "hunt", "rewind"};
+
+static void replayTrace(int trace, CacheReplay& replay) {
+  if(trace == 0) {
+    replay.play(0, 600);
+    replay.play(600, 300);
+    replay.play(300, 500);
+    replay.play(500, 470);
+    replay.play(470, 520);
+    replay.play(520, 100);
+    replay.play(100, 400);
+    for(int i = 0; i < 5; i++) {
+      replay.play(400, 380);
+      replay.play(380, 400);
+    }
+  } else if(trace == 1) {
+    std::mt19937 rng(trace);
+    int at = 1000;
+    for(int i = 0; i < 60; i++) {
+      int length = std::uniform_int_distribution<int>(5, 120)(rng);
+      int direction = rng() % 2 ? 1 : -1;
+      int to = std::max(0, at + direction * length);
+      replay.play(at, to);
+      at = to;
+      if(rng() % 5 == 0) at = std::max(0, at + (rng() % 2 ? 100 : -100));
+    }
+  } else {
+    for(int i = 0; i < 4; i++) {
+      replay.play(i * 150, i * 150 + 300);
+      replay.play(i * 150 + 300, i * 150);
+    }
+  }
+}
+
+/*!
+ * Replay viewing traces on a bare cache once for each eviction policy, with and without proxies, and
+ * compare how many frames each decoded again after cleaning them.  Runs in a moment and needs no clip,
+ * so it's for trying policy changes out; the eviction benchmark checks them on a real player.
+ */
+static int benchReplay(int argc, char** argv) {
+  int cacheFrames = 200;
+  int gop = 60;
+  for(int i = 2; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if(!strcmp(argv[i], "--cache-frames") && hasValue) cacheFrames = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--gop") && hasValue) gop = std::max(1, atoi(argv[++i]));
+    else {
+      printf("usage: videoPlayerBench replay [--cache-frames N] [--gop N]\n");
+      return 1;
+    }
+  }
+
+  printf("%d frame cache, %d frame GOPs\n", cacheFrames, gop);
+  printf("%-7s %-8s %-7s %8s %8s %10s\n", "trace", "proxies", "policy", "shown", "decoded", "redecodes");
+  for(int trace = 0; trace < (int)(sizeof(replayTraces) / sizeof(replayTraces[0])); trace++) {
+    for(bool proxies : {false, true}) {
+      for(const char* policy : {"lru", "cost"}) {
+        CacheReplay replay(policy, proxies, cacheFrames, gop);
+        replayTrace(trace, replay);
+        printf("%-7s %-8s %-7s %8lu %8lu %10lu\n", replayTraces[trace], proxies ? "on" : "off", policy,
+               replay.shown, replay.decoded, replay.cache.getStats().redecodes);
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const char* which = argc > 1 ? argv[1] : "cache";
+
+  if(!strcmp(which, "cache")) {
+    return benchCache();
+  } else if(!strcmp(which, "rewind")) {
+    return benchRewind(argc, argv);
+  } else if(!strcmp(which, "seek")) {
+    return benchSeek(argc, argv);
+  } else if(!strcmp(which, "spill")) {
+    return benchSpill(argc, argv);
+  } else if(!strcmp(which, "scrub")) {
+    return benchScrub(argc, argv);
+  } else if(!strcmp(which, "fill")) {
+    return benchFill(argc, argv);
+  } else if(!strcmp(which, "gen")) {
+    return benchGen(argc, argv);
+  } else if(!strcmp(which, "session")) {
+    return benchSession(argc, argv);
+  } else if(!strcmp(which, "convert")) {
+    return benchConvert(argc, argv);
+  } else if(!strcmp(which, "alloc")) {
+    return benchAlloc(argc, argv);
+  } else if(!strcmp(which, "io")) {
+    return benchIo(argc, argv);
+  } else if(!strcmp(which, "scale")) {
+    return benchScale(argc, argv);
+  } else if(!strcmp(which, "serve")) {
+    return benchServe(argc, argv);
+  } else if(!strcmp(which, "extract")) {
+    return benchExtract(argc, argv);
+  } else if(!strcmp(which, "jumps")) {
+    return benchJumps(argc, argv);
+  } else if(!strcmp(which, "evict")) {
+    return benchEvict(argc, argv);
+  } else if(!strcmp(which, "replay")) {
+    return benchReplay(argc, argv);
+  }
+
+  printf("usage: videoPlayerBench [cache | rewind | seek | spill | scrub | fill | gen | session | convert | alloc | io | scale | serve | extract | jumps | evict | replay]\n");
+  return 1;
+}
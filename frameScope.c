@@ -0,0 +1,153 @@
+/*
+ * Example frame server client: a luma scope which follows the player's playhead, or looks at one frame,
+ * reading the frames straight from the player's shared memory.  Also a throughput test, with several
+ * client processes following the playhead at once.
+ *
+ *   videoPlayer --serve scope clip.mkv
+ *   frameScope scope
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "FrameClient.h"
+
+static double nowSeconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1.e9;
+}
+
+/*!
+ * Histogram of a frame's luma in 8 bins, and its average
+ */
+static double lumaHistogram(const FrameClientFrame* frame, uint64_t bins[8]) {
+  uint64_t sum = 0;
+  memset(bins, 0, 8 * sizeof(uint64_t));
+  for(int y = 0; y < frame->height; y++) {
+    const uint8_t* row = frame->planes[0] + (size_t)y * frame->linesize[0];
+    for(int x = 0; x < frame->width; x++) {
+      bins[row[x] >> 5]++;
+      sum += row[x];
+    }
+  }
+  return (double)sum / ((uint64_t)frame->width * frame->height);
+}
+
+static void printFrame(FrameClient* client, const FrameClientFrame* frame) {
+  uint64_t bins[8];
+  double average = lumaHistogram(frame, bins);
+  int num, den;
+  frameClientGetTimeBase(client, &num, &den);
+  printf("frame %d", frame->frame);
+  if(frame->pts != INT64_MIN && den) printf(" (%.3f s)", (double)frame->pts * num / den);
+  printf(" %dx%d%s luma %.1f [", frame->width, frame->height, frame->level ? " proxy" : "", average);
+  uint64_t pixels = (uint64_t)frame->width * frame->height;
+  for(int bin = 0; bin < 8; bin++) printf("%s%.0f%%", bin ? " " : "", 100. * bins[bin] / pixels);
+  printf("]\n");
+}
+
+/*!
+ * One of the throughput test's clients: follow the playhead for a while, reading every pixel of each
+ * frame, and report
+ */
+static int benchClient(const char* name, int id, double seconds) {
+  FrameClient* client = frameClientOpen(name);
+  if(!client) return 1;
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t bins[8];
+  double start = nowSeconds();
+  double holdSeconds = 0;
+  while(nowSeconds() - start < seconds) {
+    FrameClientFrame frame;
+    int result = frameClientNextFrame(client, 100, &frame);
+    if(result == FRAME_CLIENT_CLOSED) break;
+    if(result != FRAME_CLIENT_OK) continue;
+    double held = nowSeconds();
+    lumaHistogram(&frame, bins);
+    bytes += frame.size;
+    frames++;
+    frameClientRelease(client, &frame);
+    holdSeconds += nowSeconds() - held;
+  }
+  double elapsed = nowSeconds() - start;
+  printf("client %d: %lu frames, %.1f fps, %.0f MB/s read in place, %.2f ms held per frame\n", id, frames,
+         frames / elapsed, bytes / (1024. * 1024.) / elapsed, frames ? 1000 * holdSeconds / frames : 0);
+  frameClientClose(client);
+  return 0;
+}
+
+/*!
+ * Start several clients following the playhead and see how many frames they get and how many the player
+ * dropped for them
+ */
+static int bench(const char* name, int clients, double seconds) {
+  FrameClient* client = frameClientOpen(name);
+  if(!client) return 1;
+  uint64_t drops = frameClientGetDrops(client);
+
+  for(int id = 0; id < clients; id++) {
+    pid_t pid = fork();
+    if(pid == 0) {
+      exit(benchClient(name, id, seconds));
+    }
+    if(pid < 0) printf("couldn't start client %d\n", id);
+  }
+  while(wait(NULL) > 0) { }
+
+  printf("%d clients for %.0f s: the player dropped %lu frames for them\n", clients, seconds,
+         frameClientGetDrops(client) - drops);
+  frameClientClose(client);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2) {
+    printf("usage: frameScope <name> [--frame N] [--count N] [--bench clients [seconds]]\n");
+    return 1;
+  }
+  const char* name = argv[1];
+  int frameNumber = -1;
+  int count = -1;
+  for(int i = 2; i < argc; i++) {
+    int hasValue = i + 1 < argc;
+    if(!strcmp(argv[i], "--frame") && hasValue) frameNumber = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--count") && hasValue) count = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--bench") && hasValue) {
+      int clients = atoi(argv[++i]);
+      double seconds = i + 1 < argc ? atof(argv[++i]) : 10;
+      return bench(name, clients, seconds);
+    }
+  }
+
+  FrameClient* client = frameClientOpen(name);
+  if(!client) return 1;
+
+  FrameClientFrame frame;
+  if(frameNumber >= 0) {
+    int result = frameClientGetFrame(client, frameNumber, 2000, &frame);
+    if(result == FRAME_CLIENT_OK) {
+      printFrame(client, &frame);
+      frameClientRelease(client, &frame);
+    } else {
+      printf("frame %d isn't shown or cached\n", frameNumber);
+    }
+    frameClientClose(client);
+    return result != FRAME_CLIENT_OK;
+  }
+
+  // follow the playhead until the player exits
+  while(count < 0 || count-- > 0) {
+    int result = frameClientNextFrame(client, -1, &frame);
+    if(result == FRAME_CLIENT_CLOSED) break;
+    printFrame(client, &frame);
+    frameClientRelease(client, &frame);
+  }
+  frameClientClose(client);
+  return 0;
+}
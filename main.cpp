@@ -1,20 +1,112 @@
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "FrameExtractor.h"
 #include "VideoPlayer.h"
 
+static int usage() {
+  printf("usage: video <filename> [cacheMB] [more filenames] [--spill MB] [--spill-file path] [--packets MB]\n"
+         "             [--workers N] [--fill-radius frames] [--no-proxies] [--eviction lru | cost] [--no-slab]\n"
+         "             [--no-mmap] [--no-adaptive] [--psi-file path] [--window WxH] [--full-res]\n"
+         "             [--trace out.json] [--analytics out.json] [--serve name]\n"
+         "  several files are played together, frame-locked, sharing the cache budget\n"
+         "  --serve publishes the frames shown to shared memory for frameScope and other FrameClient.h clients\n"
+         "       video --extract <filename> <start> <end> <out | -> [--workers N] [--no-mmap] [--write]\n"
+         "  decodes frames start to end as raw YUV420P, with no window, on every core.  --write writes a file\n"
+         "  in order instead of mapping it\n");
+  return 1;
+}
+
+/*!
+ * Decode a range of frames to raw YUV420P, with no window or pacing, and report the throughput
+ */
+static int extract(int argc, char** argv) {
+  if(argc < 6) return usage();
+  int workers = -1;
+  bool mapOutput = true;
+  FileReadMode readMode = READ_MMAP;
+  for(int i = 6; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if(!strcmp(argv[i], "--workers") && hasValue) {
+      workers = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "--no-mmap")) {
+      readMode = READ_FFMPEG;
+    } else if(!strcmp(argv[i], "--write")) {
+      mapOutput = false;
+    } else {
+      return usage();
+    }
+  }
+
+  FrameExtractor extractor(argv[2], workers);
+  extractor.setReadMode(readMode);
+  extractor.setMapOutput(mapOutput);
+  if(!extractor.run(atoi(argv[3]), atoi(argv[4]), argv[5])) return 1;
+
+  // with the frames on stdout, this goes to stderr
+  ExtractStats stats = extractor.getStats();
+  printf("extracted %d frames (%.1f MB) in %.2f s: %.1f fps, %.1f MB/s with %d workers over %d chunks, %s\n",
+         stats.frames, stats.bytes / (1024. * 1024.), stats.seconds, stats.getFps(), stats.getMBps(), stats.workers,
+         stats.chunks, stats.mapped ? "mapped" : "written in order");
+  printf("  decoding %.2f s across the workers, writing %.2f s, workers waiting on the writer %.2f s\n",
+         stats.decodeSeconds, stats.writeSeconds, stats.stallSeconds);
+  return 0;
+}
+
 int main(int argc, char** argv) {
 
-  uint64_t cacheSize;
-  if(argc == 3) {
-    cacheSize = atol(argv[2]);
-  } else if(argc == 2) {
-    cacheSize = 2048;
-  } else {
-    printf("usage: video <filename> <cacheMB>\n");
-    return 1;
+  if(argc < 2) return usage();
+  if(!strcmp(argv[1], "--extract")) return extract(argc, argv);
+
+  PlayerOptions options;
+  std::vector<std::string> fileNames = {argv[1]};
+  for(int i = 2; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if(!strcmp(argv[i], "--spill") && hasValue) {
+      options.spillMB = atol(argv[++i]);
+    } else if(!strcmp(argv[i], "--spill-file") && hasValue) {
+      options.spillFile = argv[++i];
+    } else if(!strcmp(argv[i], "--packets") && hasValue) {
+      options.packetMB = atol(argv[++i]);
+    } else if(!strcmp(argv[i], "--workers") && hasValue) {
+      options.workers = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "--fill-radius") && hasValue) {
+      options.fillRadius = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "--no-proxies")) {
+      options.proxies = false;
+    } else if(!strcmp(argv[i], "--eviction") && hasValue) {
+      options.eviction = argv[++i];
+    } else if(!strcmp(argv[i], "--no-slab")) {
+      options.slab = false;
+    } else if(!strcmp(argv[i], "--no-mmap")) {
+      options.mmap = false;
+    } else if(!strcmp(argv[i], "--no-adaptive")) {
+      options.adaptive = false;
+    } else if(!strcmp(argv[i], "--psi-file") && hasValue) {
+      options.psiFile = argv[++i];
+    } else if(!strcmp(argv[i], "--window") && hasValue) {
+      if(sscanf(argv[++i], "%dx%d", &options.windowWidth, &options.windowHeight) != 2) return usage();
+    } else if(!strcmp(argv[i], "--full-res")) {
+      options.fitOutput = false;
+    } else if(!strcmp(argv[i], "--trace") && hasValue) {
+      options.traceFile = argv[++i];
+      options.traceAtExit = true;
+    } else if(!strcmp(argv[i], "--analytics") && hasValue) {
+      options.analyticsFile = argv[++i];
+      options.analyticsAtExit = true;
+    } else if(!strcmp(argv[i], "--serve") && hasValue) {
+      options.serveName = argv[++i];
+    } else if(i == 2 && isdigit(argv[i][0])) {
+      options.cacheMB = atol(argv[i]);
+    } else if(argv[i][0] != '-') {
+      fileNames.push_back(argv[i]);
+    } else {
+      return usage();
+    }
   }
 
   // setup player
-  VideoPlayer player(argv[1], cacheSize);
+  VideoPlayer player(fileNames, options);
 
   // run player
   while(true) {
@@ -22,4 +114,4 @@ int main(int argc, char** argv) {
   }
 
   return 0;
-}
\ No newline at end of file
+}